@@ -0,0 +1,332 @@
+/*
+Structured level 3: SYRK, SYMM and TRMM on o5's packing and micro-kernel
+
+- ssyrk: C += op(A) op(A)^T on one triangle of C only. Per row band, the off-diagonal columns go straight
+  into C and the diagonal block into a scratch tile whose triangle is added, so half the tiles are skipped
+- strmm: C += T B with T triangular. The k loop of a row band stops at the diagonal (half the flops), and packed
+  diagonal blocks get their other triangle zeroed
+- ssymm: C += S B with S symmetric and only one triangle stored. Same flops as a GEMM, but S is packed from the
+  stored triangle (reflected), so the other half never has to exist
+- row bands are split over threads by their share of the triangular work, not by row count
+- a transposed operand packs with the other routine (pack_a for pack_b and back), without a transposed copy
+
+Usage: gcc blas3.c -O3 -mavx2 -mfma -mf16c -lpthread
+       ./a.out [n k [threads]]    compares each against matmul_ex on the full / explicitly transposed operands
+*/
+
+#define O5_NO_MAIN
+#include "o5.c"
+#include <math.h>
+
+#define UPLO_LOWER 0
+#define UPLO_UPPER 1
+#define TRANS_N 0 // op(A) = A
+#define TRANS_T 1 // op(A) = A^T
+
+#define OP_SYRK 0
+#define OP_SYMM 1
+#define OP_TRMM 2
+
+typedef struct {
+    int op, uplo, trans;
+    const float *A;
+    int lda;
+    const float *B;
+    int ldb;
+    float *C;
+    int ldc;
+    int M, N, K;    // C is M x N, K the inner dimension
+    int band;       // rows per band
+    int start_row;
+    int end_row;
+} Blas3Args;
+
+// op(A) rows [i, i + mb) x cols [k, k + kb) into MR panels. op(A) = A^T packs like B.
+static void pack_a_op(int trans, int mb, int kb, const float *A, int lda, int i, int k, float *A_to) {
+    if (trans == TRANS_N) pack_a(DTYPE_F32, mb, kb, &A[(size_t)i * lda + k], lda, A_to);
+    else pack_b(DTYPE_F32, kb, mb, &A[(size_t)k * lda + i], lda, A_to);
+}
+
+// op(B) rows [k, k + kb) x cols [j, j + nb) into NR panels. op(B) = B^T packs like A.
+static void pack_b_op(int trans, int kb, int nb, const float *B, int ldb, int k, int j, float *B_to) {
+    if (trans == TRANS_N) pack_b(DTYPE_F32, kb, nb, &B[(size_t)k * ldb + j], ldb, B_to);
+    else pack_a(DTYPE_F32, nb, kb, &B[(size_t)j * ldb + k], ldb, B_to);
+}
+
+// Symmetric S rows [i, i + mb) x cols [k, k + kb) with only the uplo triangle valid: blocks wholly on the
+// stored side pack directly, wholly on the other side from the mirror, blocks on the diagonal element by element
+static void pack_a_sym(int uplo, int mb, int kb, const float *S, int lds, int i, int k, float *A_to) {
+    int stored_below = uplo == UPLO_LOWER;
+    if (stored_below ? k + kb <= i + 1 : k >= i + mb - 1) {
+        pack_a(DTYPE_F32, mb, kb, &S[(size_t)i * lds + k], lds, A_to);
+        return;
+    }
+    if (stored_below ? k >= i + mb - 1 : k + kb <= i + 1) {
+        pack_b(DTYPE_F32, kb, mb, &S[(size_t)k * lds + i], lds, A_to);
+        return;
+    }
+    for (int p = 0; p < mb; p += MR) {
+        for (int kk = 0; kk < kb; kk++) {
+            for (int r = 0; r < MR; r++) {
+                int row = i + p + r, col = k + kk;
+                int direct = stored_below ? col <= row : col >= row;
+                A_to[kk * MR + r] = p + r >= mb ? 0.0f : direct ? S[(size_t)row * lds + col] : S[(size_t)col * lds + row];
+            }
+        }
+        A_to += MR * kb;
+    }
+}
+
+// Zero the packed entries of T rows [i, i + mb) x cols [k, k + kb) outside its uplo triangle
+static void mask_packed_tri(int uplo, int mb, int kb, int i, int k, float *A_to) {
+    for (int p = 0; p < mb; p += MR) {
+        for (int kk = 0; kk < kb; kk++) {
+            for (int r = 0; r < MR; r++) {
+                int row = i + p + r, col = k + kk;
+                if (uplo == UPLO_LOWER ? col > row : col < row) A_to[kk * MR + r] = 0.0f;
+            }
+        }
+        A_to += MR * kb;
+    }
+}
+
+// Work of the band at rows [i, i + mb): columns (SYRK) or k steps (TRMM) on the computed side of the diagonal
+static double band_work(const Blas3Args *a, int i, int mb) {
+    if (a->op == OP_SYMM) return mb;
+    int n = a->op == OP_SYRK ? a->N : a->K;
+    return (double)mb * (a->uplo == UPLO_LOWER ? i + mb : n - i);
+}
+
+void *blas3_thread(void *arg) {
+    Blas3Args *a = (Blas3Args *)arg;
+    int N = a->N, K = a->K;
+    if (a->end_row <= a->start_row) return NULL;
+
+    int kc = K < KC ? K : KC;
+    int mc = (a->band + MR - 1) / MR * MR;
+    int nc = N < NC ? (N + NR - 1) / NR * NR : NC;
+    size_t ac_size = ((size_t)mc * kc + 15) / 16 * 16;
+    size_t bc_size = ((size_t)kc * nc + 15) / 16 * 16;
+    size_t d_size = a->op == OP_SYRK ? (size_t)mc * mc : 0;
+    size_t buf_bytes = (ac_size + bc_size + d_size) * sizeof(float);
+    float *Ac = (float *)alloc_pages(buf_bytes);
+    float *Bc = Ac + ac_size;
+    float *D = Bc + bc_size; // SYRK diagonal block, mc x mc
+
+    for (int i = a->start_row; i < a->end_row; i += a->band) {
+        int mb = (i + a->band <= a->end_row) ? a->band : a->end_row - i;
+
+        // Inner range, and the columns that go straight to C
+        int k_lo = 0, k_hi = K, j_lo = 0, j_hi = N;
+        if (a->op == OP_TRMM) {
+            if (a->uplo == UPLO_LOWER) k_hi = i + mb;
+            else k_lo = i;
+        } else if (a->op == OP_SYRK) {
+            if (a->uplo == UPLO_LOWER) j_hi = i;
+            else j_lo = i + mb;
+            memset(D, 0, (size_t)mb * mb * sizeof(float));
+        }
+
+        for (int k = k_lo; k < k_hi; k += KC) {
+            int kb = (k + KC <= k_hi) ? KC : k_hi - k;
+
+            if (a->op == OP_SYMM) {
+                pack_a_sym(a->uplo, mb, kb, a->A, a->lda, i, k, Ac);
+            } else {
+                pack_a_op(a->op == OP_SYRK ? a->trans : TRANS_N, mb, kb, a->A, a->lda, i, k, Ac);
+                if (a->op == OP_TRMM && k < i + mb && k + kb > i) mask_packed_tri(a->uplo, mb, kb, i, k, Ac);
+            }
+
+            for (int j = j_lo; j < j_hi; j += NC) {
+                int nb = (j + NC <= j_hi) ? NC : j_hi - j;
+                if (a->op == OP_SYRK) pack_b_op(!a->trans, kb, nb, a->A, a->lda, k, j, Bc); // op(A)^T
+                else pack_b(DTYPE_F32, kb, nb, &a->B[(size_t)k * a->ldb + j], a->ldb, Bc);
+                compute_kernel(mb, nb, kb, Ac, Bc, &a->C[(size_t)i * a->ldc + j], a->ldc, NULL, i, j);
+            }
+
+            if (a->op == OP_SYRK) {
+                pack_b_op(!a->trans, kb, mb, a->A, a->lda, k, i, Bc);
+                compute_kernel(mb, mb, kb, Ac, Bc, D, mb, NULL, i, i);
+            }
+        }
+
+        if (a->op == OP_SYRK) {
+            for (int r = 0; r < mb; r++) {
+                int c0 = a->uplo == UPLO_LOWER ? 0 : r, c1 = a->uplo == UPLO_LOWER ? r + 1 : mb;
+                for (int c = c0; c < c1; c++) a->C[(size_t)(i + r) * a->ldc + i + c] += D[r * mb + c];
+            }
+        }
+    }
+
+    free_pages(Ac, buf_bytes);
+    return NULL;
+}
+
+// Row bands of at most MC rows, smaller when there would be too few to go around, handed out in
+// contiguous runs of about equal triangular work
+static void blas3_launch(Blas3Args *proto, int num_threads) {
+    Blas3Args args[MAX_THREADS];
+    int M = proto->M;
+    if (num_threads > MAX_THREADS) num_threads = MAX_THREADS;
+
+    int band = MC;
+    if ((M + band - 1) / band < 4 * num_threads) band = (M / (4 * num_threads) + MR - 1) / MR * MR;
+    if (band < MR) band = MR;
+    if (band > MC) band = MC;
+    proto->band = band;
+
+    double total = 0.0;
+    for (int i = 0; i < M; i += band) total += band_work(proto, i, i + band <= M ? band : M - i);
+
+    int t = 0, i = 0;
+    double done = 0.0;
+    for (; t < num_threads && i < M; t++) {
+        args[t] = *proto;
+        args[t].start_row = i;
+        double target = total * (t + 1) / num_threads;
+        while (i < M && (done < target || t == num_threads - 1)) {
+            done += band_work(proto, i, i + band <= M ? band : M - i);
+            i += band;
+        }
+        args[t].end_row = i < M ? i : M;
+    }
+    launch_threads(blas3_thread, args, sizeof(Blas3Args), t);
+}
+
+// C[n x n] += op(A) op(A)^T on the uplo triangle of C (the other is not touched). op(A) is n x k:
+// TRANS_N takes A as n x k (C += A A^T), TRANS_T as k x n (C += A^T A, a Gram matrix).
+void ssyrk(int uplo, int trans, int n, int k, const float *A, int lda, float *C, int ldc, int num_threads) {
+    Blas3Args a = {OP_SYRK, uplo, trans, A, lda, NULL, 0, C, ldc, n, n, k};
+    blas3_launch(&a, num_threads);
+}
+
+// C[m x n] += S B with S m x m symmetric, read only from its uplo triangle, B m x n
+void ssymm(int uplo, int m, int n, const float *S, int lds, const float *B, int ldb, float *C, int ldc, int num_threads) {
+    Blas3Args a = {OP_SYMM, uplo, TRANS_N, S, lds, B, ldb, C, ldc, m, n, m};
+    blas3_launch(&a, num_threads);
+}
+
+// C[m x n] += T B with T m x m triangular (uplo, the other triangle is ignored), B m x n
+void strmm(int uplo, int m, int n, const float *T, int ldt, const float *B, int ldb, float *C, int ldc, int num_threads) {
+    Blas3Args a = {OP_TRMM, uplo, TRANS_N, T, ldt, B, ldb, C, ldc, m, n, m};
+    blas3_launch(&a, num_threads);
+}
+
+// Copy the uplo triangle of C[n x n] onto the other, after ssyrk when the full matrix is wanted
+void symmetrize(int uplo, float *C, int n, int ldc) {
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < i; j++) {
+            if (uplo == UPLO_LOWER) C[(size_t)j * ldc + i] = C[(size_t)i * ldc + j];
+            else C[(size_t)i * ldc + j] = C[(size_t)j * ldc + i];
+        }
+    }
+}
+
+// Max relative error of C against R, over the uplo triangle only when tri_only
+static double max_rel_error(const float *C, const float *R, int n, int cols, int uplo, int tri_only) {
+    double worst = 0.0;
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < cols; j++) {
+            if (tri_only && (uplo == UPLO_LOWER ? j > i : j < i)) continue;
+            double r = R[(size_t)i * cols + j], mag = r < 0 ? -r : r;
+            double err = (C[(size_t)i * cols + j] - r) / (mag > 1.0 ? mag : 1.0);
+            if (err < 0) err = -err;
+            if (!(err <= worst)) worst = err;
+        }
+    }
+    return worst;
+}
+
+int main(int argc, char *argv[]) {
+    int n = 2048, k = 2048;
+    int num_threads = 24;
+    if (argc >= 3) {
+        n = atoi(argv[1]);
+        k = atoi(argv[2]);
+    }
+    if (argc >= 4) num_threads = atoi(argv[3]);
+    if (n <= 0 || k <= 0 || num_threads <= 0 || num_threads > MAX_THREADS) {
+        fprintf(stderr, "Usage: %s [n k [threads (1..%d)]]\n", argv[0], MAX_THREADS);
+        return 1;
+    }
+
+    size_t nk = (size_t)n * k * sizeof(float), nn = (size_t)n * n * sizeof(float);
+    float *A = (float *)alloc_matrix(nk);   // k x n, Gram matrix A^T A
+    float *At = (float *)alloc_matrix(nk);  // its transpose, for the GEMM
+    float *S = (float *)alloc_matrix(nn);   // n x n, symmetric / triangular operand
+    float *B = (float *)alloc_matrix(nk);   // n x k
+    float *C = (float *)alloc_matrix(nn > nk ? nn : nk);
+    float *R = (float *)alloc_matrix(nn > nk ? nn : nk);
+    uint64_t seed = time(NULL);
+    init_uniform(DTYPE_F32, A, k, n, -1.0f, 1.0f, seed, num_threads);
+    init_uniform(DTYPE_F32, S, n, n, -1.0f, 1.0f, seed + 1, num_threads);
+    init_uniform(DTYPE_F32, B, n, k, -1.0f, 1.0f, seed + 2, num_threads);
+    for (int r = 0; r < k; r++) {
+        for (int c = 0; c < n; c++) At[(size_t)c * k + r] = A[(size_t)r * n + c];
+    }
+
+    // SYRK against the full GEMM A^T A
+    // GFLOPS in telemetry lines and results count the full GEMM's flops
+    Telemetry tel, tel_gemm;
+    memset(R, 0, nn);
+    telemetry_start(&tel_gemm, num_threads);
+    matmul_ex(At, DTYPE_F32, A, DTYPE_F32, R, n, n, k, NULL, num_threads);
+    double gemm = telemetry_stop(&tel_gemm);
+    memset(C, 0, nn);
+    telemetry_start(&tel, num_threads);
+    ssyrk(UPLO_LOWER, TRANS_T, n, k, A, n, C, n, num_threads);
+    double elapsed = telemetry_stop(&tel);
+    printf("SYRK %d x %d (A^T A): %.6f seconds against GEMM %.6f seconds (%.2fx), max rel error %.2e\n", n, k, elapsed, gemm,
+           elapsed / gemm, max_rel_error(C, R, n, n, UPLO_LOWER, 1));
+    double flops = 2.0 * n * n * k;
+    bench_record(&tel, "ssyrk", n, n, k, "f32", num_threads, elapsed, flops);
+    bench_record(&tel_gemm, "ssyrk_gemm", n, n, k, "f32", num_threads, gemm, flops);
+
+    // SYMM: the GEMM needs the full symmetric matrix, SYMM only the lower triangle
+    for (int i = 0; i < n; i++) {
+        for (int j = i + 1; j < n; j++) S[(size_t)i * n + j] = S[(size_t)j * n + i];
+    }
+    memset(R, 0, nk);
+    telemetry_start(&tel_gemm, num_threads);
+    matmul_ex(S, DTYPE_F32, B, DTYPE_F32, R, n, k, n, NULL, num_threads);
+    gemm = telemetry_stop(&tel_gemm);
+    for (int i = 0; i < n; i++) {
+        for (int j = i + 1; j < n; j++) S[(size_t)i * n + j] = NAN; // never read
+    }
+    memset(C, 0, nk);
+    telemetry_start(&tel, num_threads);
+    ssymm(UPLO_LOWER, n, k, S, n, B, k, C, k, num_threads);
+    elapsed = telemetry_stop(&tel);
+    printf("SYMM %d x %d: %.6f seconds against GEMM %.6f seconds (%.2fx), max rel error %.2e\n", n, k, elapsed, gemm,
+           elapsed / gemm, max_rel_error(C, R, n, k, UPLO_LOWER, 0));
+    bench_record(&tel, "ssymm", n, k, n, "f32", num_threads, elapsed, flops);
+    bench_record(&tel_gemm, "ssymm_gemm", n, k, n, "f32", num_threads, gemm, flops);
+
+    // TRMM: the GEMM multiplies the zeros too
+    for (int i = 0; i < n; i++) {
+        for (int j = i + 1; j < n; j++) S[(size_t)i * n + j] = 0.0f;
+    }
+    memset(R, 0, nk);
+    telemetry_start(&tel_gemm, num_threads);
+    matmul_ex(S, DTYPE_F32, B, DTYPE_F32, R, n, k, n, NULL, num_threads);
+    gemm = telemetry_stop(&tel_gemm);
+    for (int i = 0; i < n; i++) {
+        for (int j = i + 1; j < n; j++) S[(size_t)i * n + j] = NAN; // never read
+    }
+    memset(C, 0, nk);
+    telemetry_start(&tel, num_threads);
+    strmm(UPLO_LOWER, n, k, S, n, B, k, C, k, num_threads);
+    elapsed = telemetry_stop(&tel);
+    printf("TRMM %d x %d: %.6f seconds against GEMM %.6f seconds (%.2fx), max rel error %.2e\n", n, k, elapsed, gemm,
+           elapsed / gemm, max_rel_error(C, R, n, k, UPLO_LOWER, 0));
+    bench_record(&tel, "strmm", n, k, n, "f32", num_threads, elapsed, flops);
+    bench_record(&tel_gemm, "strmm_gemm", n, k, n, "f32", num_threads, gemm, flops);
+
+    free_matrix(A, nk);
+    free_matrix(At, nk);
+    free_matrix(S, nn);
+    free_matrix(B, nk);
+    free_matrix(C, nn > nk ? nn : nk);
+    free_matrix(R, nn > nk ? nn : nk);
+    return 0;
+}
@@ -0,0 +1,384 @@
+/*
+Complex single precision GEMM (complex64), C += A B, with A, B and C interleaved (re, im) pairs of floats
+
+Instead of four real matmul() calls on split temporaries:
+
+- packing reads the interleaved operands once and writes split panels: per k step of an A panel, CMR real parts
+  then CMR imaginary parts; per k step of a B panel, NR real parts then NR imaginary parts, deinterleaved with
+  two shuffles and a permute
+- the CMR x NR complex micro-kernel keeps real and imaginary accumulators in registers and does the complex
+  multiply-accumulate as four FMAs per row (re += ar br - ai bi, im += ar bi + ai br). The tile is interleaved
+  again only at the store, so C is read and written once per KC block
+- 3M mode (CGEMM_3M) uses Ar Br, Ai Bi and (Ar + Ai)(Br + Bi) on o5's real micro-kernel, 6 instead of 8 flops per
+  complex multiply-add: Cr = T1 - T2, Ci = T3 - T1 - T2. It adds rounding error on the order of |A| |B| rather
+  than |A B|, so CGEMM_AUTO only takes it when every dimension is at least CGEMM_3M_MIN
+
+Usage: gcc cgemm.c -O3 -mavx2 -mfma -mf16c -lpthread
+       ./a.out [M N K [threads]]    compares four real matmul_ex calls, 4M and 3M
+*/
+
+#define O5_NO_MAIN
+#include "o5.c"
+#include <math.h>
+
+#define CMR 6      // complex rows per micro-tile: 12 accumulators, 2 B vectors, 2 broadcasts
+#define CMC 96     // complex rows per A block (multiple of CMR), 192 KB packed
+#define CKC 256
+#define CNC 2048   // complex columns per B block, 4 MB packed
+#define CNC_3M 512 // 3M keeps three T tiles per block, so narrower blocks
+
+#define CGEMM_AUTO 0
+#define CGEMM_4M 1
+#define CGEMM_3M 2
+#define CGEMM_3M_MIN 1024
+
+typedef struct {
+    const float *A, *B;
+    float *C;
+    int M, N, K;
+    int start_row;
+    int end_row;
+} CgemmArgs;
+
+// mb x kb complex block of A (row stride lda complex) into CMR panels of split (re, im), zero padded
+static void pack_ca(int mb, int kb, const float *A, int lda, float *A_to) {
+    for (int p = 0; p < mb; p += CMR) {
+        for (int r = 0; r < CMR; r++) {
+            const float *row = &A[2 * (size_t)(p + r) * lda];
+            for (int k = 0; k < kb; k++) {
+                int in = p + r < mb;
+                A_to[k * 2 * CMR + r] = in ? row[2 * k] : 0.0f;
+                A_to[k * 2 * CMR + CMR + r] = in ? row[2 * k + 1] : 0.0f;
+            }
+        }
+        A_to += 2 * CMR * kb;
+    }
+}
+
+// 8 interleaved complex values into 8 real and 8 imaginary parts
+FORCE_INLINE void deinterleave8(const float *src, __m256 *re, __m256 *im) {
+    __m256 v0 = _mm256_loadu_ps(src), v1 = _mm256_loadu_ps(src + 8);
+    // Per 128-bit lane: r0 r1 r4 r5 | r2 r3 r6 r7, then the permute puts the 64-bit pairs in order
+    *re = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(_mm256_shuffle_ps(v0, v1, _MM_SHUFFLE(2, 0, 2, 0))), 0xd8));
+    *im = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(_mm256_shuffle_ps(v0, v1, _MM_SHUFFLE(3, 1, 3, 1))), 0xd8));
+}
+
+// kb x nb complex block of B (row stride ldb complex) into NR panels of split (re, im), zero padded
+static void pack_cb(int kb, int nb, const float *B, int ldb, float *B_to) {
+    for (int j = 0; j < nb; j += NR) {
+        int n = nb - j < NR ? nb - j : NR;
+        for (int k = 0; k < kb; k++) {
+            const float *src = &B[2 * ((size_t)k * ldb + j)];
+            if (n == NR) {
+                __m256 re, im;
+                deinterleave8(src, &re, &im);
+                _mm256_store_ps(&B_to[k * 2 * NR], re);
+                _mm256_store_ps(&B_to[k * 2 * NR + NR], im);
+            } else {
+                for (int c = 0; c < NR; c++) {
+                    B_to[k * 2 * NR + c] = c < n ? src[2 * c] : 0.0f;
+                    B_to[k * 2 * NR + NR + c] = c < n ? src[2 * c + 1] : 0.0f;
+                }
+            }
+        }
+        B_to += 2 * NR * kb;
+    }
+}
+
+// C[m x n] += A panel * B panel, complex. m is a constant for full tiles, so the accumulators stay in registers.
+FORCE_INLINE void cmicro_kernel(const int m, int n, int K, const float *A, const float *B, float *C, int ldc) {
+    __m256 cr[CMR], ci[CMR];
+    for (int i = 0; i < m; ++i) cr[i] = ci[i] = _mm256_setzero_ps();
+
+    for (int k = 0; k < K; ++k) {
+        __m256 br = _mm256_load_ps(&B[k * 2 * NR]);
+        __m256 bi = _mm256_load_ps(&B[k * 2 * NR + NR]);
+        for (int i = 0; i < m; ++i) {
+            __m256 ar = _mm256_broadcast_ss(&A[k * 2 * CMR + i]);
+            __m256 ai = _mm256_broadcast_ss(&A[k * 2 * CMR + CMR + i]);
+            cr[i] = _mm256_fmadd_ps(ar, br, cr[i]);
+            cr[i] = _mm256_fnmadd_ps(ai, bi, cr[i]);
+            ci[i] = _mm256_fmadd_ps(ar, bi, ci[i]);
+            ci[i] = _mm256_fmadd_ps(ai, br, ci[i]);
+        }
+    }
+
+    for (int i = 0; i < m; ++i) {
+        // Back to (re, im) pairs: unpack per lane, then swap the middle 128-bit halves
+        __m256 lo = _mm256_unpacklo_ps(cr[i], ci[i]), hi = _mm256_unpackhi_ps(cr[i], ci[i]);
+        __m256 c0 = _mm256_permute2f128_ps(lo, hi, 0x20), c1 = _mm256_permute2f128_ps(lo, hi, 0x31);
+        float *row = &C[2 * (size_t)i * ldc];
+        if (n == NR) {
+            _mm256_storeu_ps(row, _mm256_add_ps(_mm256_loadu_ps(row), c0));
+            _mm256_storeu_ps(row + 8, _mm256_add_ps(_mm256_loadu_ps(row + 8), c1));
+        } else {
+            float tile[2 * NR];
+            _mm256_storeu_ps(tile, c0);
+            _mm256_storeu_ps(tile + 8, c1);
+            for (int j = 0; j < 2 * n; ++j) row[j] += tile[j];
+        }
+    }
+}
+
+static void compute_ckernel(int M, int N, int K, const float *A, const float *B, float *C, int ldc) {
+    for (int i = 0; i < M; i += CMR) {
+        int m = M - i < CMR ? M - i : CMR;
+        for (int j = 0; j < N; j += NR) {
+            int n = N - j < NR ? N - j : NR;
+            const float *Ap = &A[(size_t)i * 2 * K], *Bp = &B[(size_t)j * 2 * K];
+            if (m == CMR) cmicro_kernel(CMR, n, K, Ap, Bp, &C[2 * ((size_t)i * ldc + j)], ldc);
+            else cmicro_kernel(m, n, K, Ap, Bp, &C[2 * ((size_t)i * ldc + j)], ldc);
+        }
+    }
+}
+
+void *cgemm_thread(void *arg) {
+    CgemmArgs *args = (CgemmArgs *)arg;
+    int N = args->N, K = args->K;
+    int start_row = args->start_row, end_row = args->end_row;
+    if (end_row <= start_row) return NULL;
+
+    int kc = K < CKC ? K : CKC;
+    int mc = end_row - start_row < CMC ? (end_row - start_row + CMR - 1) / CMR * CMR : CMC;
+    int nc = N < CNC ? (N + NR - 1) / NR * NR : CNC;
+    size_t ac_size = ((size_t)2 * mc * kc + 15) / 16 * 16;
+    size_t buf_bytes = (ac_size + (size_t)2 * kc * nc) * sizeof(float);
+    float *Ac = (float *)alloc_pages(buf_bytes);
+    float *Bc = Ac + ac_size;
+
+    for (int i = start_row; i < end_row; i += CMC) {
+        int mb = (i + CMC <= end_row) ? CMC : end_row - i;
+        for (int k = 0; k < K; k += CKC) {
+            int kb = (k + CKC <= K) ? CKC : K - k;
+            pack_ca(mb, kb, &args->A[2 * ((size_t)i * K + k)], K, Ac);
+            for (int j = 0; j < N; j += CNC) {
+                int nb = (j + CNC <= N) ? CNC : N - j;
+                pack_cb(kb, nb, &args->B[2 * ((size_t)k * N + j)], N, Bc);
+                compute_ckernel(mb, nb, kb, Ac, Bc, &args->C[2 * ((size_t)i * N + j)], N);
+            }
+        }
+    }
+
+    free_pages(Ac, buf_bytes);
+    return NULL;
+}
+
+// mb x kb complex block of A into three o5 MR panels: real parts, imaginary parts and their sum
+static void pack_a3(int mb, int kb, const float *A, int lda, float *Ar, float *Ai, float *As) {
+    for (int p = 0; p < mb; p += MR) {
+        for (int r = 0; r < MR; r++) {
+            const float *row = &A[2 * (size_t)(p + r) * lda];
+            for (int k = 0; k < kb; k++) {
+                float re = p + r < mb ? row[2 * k] : 0.0f, im = p + r < mb ? row[2 * k + 1] : 0.0f;
+                Ar[k * MR + r] = re;
+                Ai[k * MR + r] = im;
+                As[k * MR + r] = re + im;
+            }
+        }
+        Ar += MR * kb;
+        Ai += MR * kb;
+        As += MR * kb;
+    }
+}
+
+// kb x nb complex block of B into three o5 NR panels, as pack_a3
+static void pack_b3(int kb, int nb, const float *B, int ldb, float *Br, float *Bi, float *Bs) {
+    for (int j = 0; j < nb; j += NR) {
+        int n = nb - j < NR ? nb - j : NR;
+        for (int k = 0; k < kb; k++) {
+            const float *src = &B[2 * ((size_t)k * ldb + j)];
+            __m256 re, im;
+            if (n == NR) {
+                deinterleave8(src, &re, &im);
+            } else {
+                float t[2 * NR] = {0};
+                memcpy(t, src, 2 * n * sizeof(float));
+                deinterleave8(t, &re, &im);
+            }
+            _mm256_store_ps(&Br[k * NR], re);
+            _mm256_store_ps(&Bi[k * NR], im);
+            _mm256_store_ps(&Bs[k * NR], _mm256_add_ps(re, im));
+        }
+        Br += NR * kb;
+        Bi += NR * kb;
+        Bs += NR * kb;
+    }
+}
+
+// C[mb x nb] += (T1 - T2) + i (T3 - T1 - T2), then clear the T tiles (row stride ldt) for the next KC block
+static void combine_3m(int mb, int nb, float *T1, float *T2, float *T3, int ldt, float *C, int ldc) {
+    for (int i = 0; i < mb; i++) {
+        float *t1 = &T1[(size_t)i * ldt], *t2 = &T2[(size_t)i * ldt], *t3 = &T3[(size_t)i * ldt];
+        float *row = &C[2 * (size_t)i * ldc];
+        int j = 0;
+        for (; j + 8 <= nb; j += 8) {
+            __m256 a = _mm256_loadu_ps(&t1[j]), b = _mm256_loadu_ps(&t2[j]), s = _mm256_loadu_ps(&t3[j]);
+            __m256 re = _mm256_sub_ps(a, b), im = _mm256_sub_ps(s, _mm256_add_ps(a, b));
+            __m256 lo = _mm256_unpacklo_ps(re, im), hi = _mm256_unpackhi_ps(re, im);
+            float *c = &row[2 * j];
+            _mm256_storeu_ps(c, _mm256_add_ps(_mm256_loadu_ps(c), _mm256_permute2f128_ps(lo, hi, 0x20)));
+            _mm256_storeu_ps(c + 8, _mm256_add_ps(_mm256_loadu_ps(c + 8), _mm256_permute2f128_ps(lo, hi, 0x31)));
+        }
+        for (; j < nb; j++) {
+            row[2 * j] += t1[j] - t2[j];
+            row[2 * j + 1] += t3[j] - t1[j] - t2[j];
+        }
+        memset(t1, 0, nb * sizeof(float));
+        memset(t2, 0, nb * sizeof(float));
+        memset(t3, 0, nb * sizeof(float));
+    }
+}
+
+void *cgemm_3m_thread(void *arg) {
+    CgemmArgs *args = (CgemmArgs *)arg;
+    int N = args->N, K = args->K;
+    int start_row = args->start_row, end_row = args->end_row;
+    if (end_row <= start_row) return NULL;
+
+    int kc = K < KC ? K : KC;
+    int mc = end_row - start_row < MC ? (end_row - start_row + MR - 1) / MR * MR : MC;
+    int nc = N < CNC_3M ? (N + NR - 1) / NR * NR : CNC_3M;
+    size_t a_size = (size_t)mc * kc, b_size = (size_t)kc * nc, t_size = (size_t)mc * nc;
+    size_t buf_bytes = 3 * (a_size + b_size + t_size) * sizeof(float);
+    float *Ar = (float *)alloc_pages(buf_bytes); // zeroed, so the T tiles start clear
+    float *Ai = Ar + a_size, *As = Ai + a_size;
+    float *Br = As + a_size, *Bi = Br + b_size, *Bs = Bi + b_size;
+    float *T1 = Bs + b_size, *T2 = T1 + t_size, *T3 = T2 + t_size;
+
+    for (int i = start_row; i < end_row; i += MC) {
+        int mb = (i + MC <= end_row) ? MC : end_row - i;
+        for (int k = 0; k < K; k += KC) {
+            int kb = (k + KC <= K) ? KC : K - k;
+            pack_a3(mb, kb, &args->A[2 * ((size_t)i * K + k)], K, Ar, Ai, As);
+            for (int j = 0; j < N; j += CNC_3M) {
+                int nb = (j + CNC_3M <= N) ? CNC_3M : N - j;
+                pack_b3(kb, nb, &args->B[2 * ((size_t)k * N + j)], N, Br, Bi, Bs);
+                compute_kernel(mb, nb, kb, Ar, Br, T1, nb, NULL, 0, 0);
+                compute_kernel(mb, nb, kb, Ai, Bi, T2, nb, NULL, 0, 0);
+                compute_kernel(mb, nb, kb, As, Bs, T3, nb, NULL, 0, 0);
+                combine_3m(mb, nb, T1, T2, T3, nb, &args->C[2 * ((size_t)i * N + j)], N);
+            }
+        }
+    }
+
+    free_pages(Ar, buf_bytes);
+    return NULL;
+}
+
+// C[M x N] += A[M x K] B[K x N], complex64 stored as interleaved (re, im) floats.
+// mode is CGEMM_4M, CGEMM_3M, or CGEMM_AUTO (3M once every dimension reaches CGEMM_3M_MIN).
+void cgemm(int mode, const float *A, const float *B, float *C, int M, int N, int K, int num_threads) {
+    CgemmArgs args[MAX_THREADS];
+    if (mode == CGEMM_AUTO) mode = (M >= CGEMM_3M_MIN && N >= CGEMM_3M_MIN && K >= CGEMM_3M_MIN) ? CGEMM_3M : CGEMM_4M;
+    if (num_threads > MAX_THREADS) num_threads = MAX_THREADS;
+
+    // Rows in whole micro-tiles of the kernel that runs
+    int step = mode == CGEMM_3M ? MR : CMR;
+    int tiles = (M + step - 1) / step;
+    if (num_threads > tiles) num_threads = tiles > 0 ? tiles : 1;
+    for (int t = 0; t < num_threads; t++) {
+        int start = (int)((long)tiles * t / num_threads) * step, end = (int)((long)tiles * (t + 1) / num_threads) * step;
+        args[t] = (CgemmArgs){A, B, C, M, N, K, start, end < M ? end : M};
+    }
+    launch_threads(mode == CGEMM_3M ? cgemm_3m_thread : cgemm_thread, args, sizeof(CgemmArgs), num_threads);
+}
+
+typedef struct {
+    const float *X;
+    float *re, *im, *neg_im; // neg_im may be NULL
+    int cols;
+} SplitCtx;
+
+static void split_rows(void *ctx, int start_row, int end_row) {
+    SplitCtx *s = (SplitCtx *)ctx;
+    for (size_t p = (size_t)start_row * s->cols; p < (size_t)end_row * s->cols; p++) {
+        s->re[p] = s->X[2 * p];
+        s->im[p] = s->X[2 * p + 1];
+        if (s->neg_im) s->neg_im[p] = -s->X[2 * p + 1];
+    }
+}
+
+// What cgemm replaces: split the operands, Cr = Ar Br - Ai Bi and Ci = Ar Bi + Ai Br as four real GEMMs, interleave
+static void cgemm_4real(const float *A, const float *B, float *C, int M, int N, int K, float *tmp, int num_threads) {
+    float *Ar = tmp, *Ai = Ar + (size_t)M * K, *An = Ai + (size_t)M * K;
+    float *Br = An + (size_t)M * K, *Bi = Br + (size_t)K * N;
+    float *Cr = Bi + (size_t)K * N, *Ci = Cr + (size_t)M * N;
+    SplitCtx sa = {A, Ar, Ai, An, K}, sb = {B, Br, Bi, NULL, N}, sc = {C, Cr, Ci, NULL, N};
+    parallel_rows(M, num_threads, split_rows, &sa);
+    parallel_rows(K, num_threads, split_rows, &sb);
+    parallel_rows(M, num_threads, split_rows, &sc);
+    matmul_ex(Ar, DTYPE_F32, Br, DTYPE_F32, Cr, M, N, K, NULL, num_threads);
+    matmul_ex(An, DTYPE_F32, Bi, DTYPE_F32, Cr, M, N, K, NULL, num_threads);
+    matmul_ex(Ar, DTYPE_F32, Bi, DTYPE_F32, Ci, M, N, K, NULL, num_threads);
+    matmul_ex(Ai, DTYPE_F32, Br, DTYPE_F32, Ci, M, N, K, NULL, num_threads);
+    for (size_t p = 0; p < (size_t)M * N; p++) {
+        C[2 * p] = Cr[p];
+        C[2 * p + 1] = Ci[p];
+    }
+}
+
+// Max error of C over a sample of entries against a double precision reference, relative to sum |a| |b|
+static double sample_error(const float *A, const float *B, const float *C, int M, int N, int K, uint64_t seed) {
+    double worst = 0.0;
+    for (int s = 0; s < 256; s++) {
+        int i = rng_u64(seed, 2 * s) % M, j = rng_u64(seed, 2 * s + 1) % N;
+        double re = 0.0, im = 0.0, mag = 0.0;
+        for (int k = 0; k < K; k++) {
+            double ar = A[2 * ((size_t)i * K + k)], ai = A[2 * ((size_t)i * K + k) + 1];
+            double br = B[2 * ((size_t)k * N + j)], bi = B[2 * ((size_t)k * N + j) + 1];
+            re += ar * br - ai * bi;
+            im += ar * bi + ai * br;
+            mag += (fabs(ar) + fabs(ai)) * (fabs(br) + fabs(bi));
+        }
+        double err = (fabs(C[2 * ((size_t)i * N + j)] - re) + fabs(C[2 * ((size_t)i * N + j) + 1] - im)) / (mag > 0 ? mag : 1.0);
+        if (!(err <= worst)) worst = err;
+    }
+    return worst;
+}
+
+int main(int argc, char *argv[]) {
+    int M = 2048, N = 2048, K = 2048;
+    int num_threads = 24;
+    if (argc >= 4) {
+        M = atoi(argv[1]);
+        N = atoi(argv[2]);
+        K = atoi(argv[3]);
+    }
+    if (argc >= 5) num_threads = atoi(argv[4]);
+    if (M <= 0 || N <= 0 || K <= 0 || num_threads <= 0 || num_threads > MAX_THREADS) {
+        fprintf(stderr, "Usage: %s [M N K [threads (1..%d)]]\n", argv[0], MAX_THREADS);
+        return 1;
+    }
+
+    size_t a_bytes = (size_t)M * K * 2 * sizeof(float), b_bytes = (size_t)K * N * 2 * sizeof(float);
+    size_t c_bytes = (size_t)M * N * 2 * sizeof(float);
+    size_t tmp_bytes = (size_t)(3 * (size_t)M * K + 2 * (size_t)K * N + 2 * (size_t)M * N) * sizeof(float);
+    float *A = (float *)alloc_matrix(a_bytes);
+    float *B = (float *)alloc_matrix(b_bytes);
+    float *C = (float *)alloc_matrix(c_bytes);
+    float *tmp = (float *)alloc_matrix(tmp_bytes);
+    uint64_t seed = time(NULL);
+    init_uniform(DTYPE_F32, A, M, 2 * K, -1.0f, 1.0f, seed, num_threads);
+    init_uniform(DTYPE_F32, B, K, 2 * N, -1.0f, 1.0f, seed + 1, num_threads);
+    double flops = 8.0 * M * N * K; // counted as 4M for all three, so GFLOPS compare directly
+
+    const char *names[3] = {"4 x real matmul_ex", "cgemm 4M", "cgemm 3M"};
+    const char *kernels[3] = {"cgemm_4real", "cgemm_4m", "cgemm_3m"};
+    for (int run = 0; run < 3; run++) {
+        init_zero(C, M, (size_t)N * 2 * sizeof(float), num_threads);
+        Telemetry tel;
+        telemetry_start(&tel, num_threads);
+        if (run == 0) cgemm_4real(A, B, C, M, N, K, tmp, num_threads);
+        else cgemm(run == 1 ? CGEMM_4M : CGEMM_3M, A, B, C, M, N, K, num_threads);
+        double elapsed = telemetry_stop(&tel);
+        printf("%-18s %.6f seconds, %.2f GFLOPS (complex, 8 flops per multiply-add), max rel error %.2e\n", names[run],
+               elapsed, flops / (elapsed * 1e9), sample_error(A, B, C, M, N, K, seed + 2));
+        bench_record(&tel, kernels[run], M, N, K, "c64", num_threads, elapsed, flops);
+    }
+
+    free_matrix(A, a_bytes);
+    free_matrix(B, b_bytes);
+    free_matrix(C, c_bytes);
+    free_matrix(tmp, tmp_bytes);
+    return 0;
+}
@@ -0,0 +1,381 @@
+/*
+Implicit-GEMM 2D convolution on o5's packing, micro-kernel and epilogue, without an im2col buffer
+
+The convolution is a GEMM over K = C R S, but the patch matrix is never built. Its packing stage reads patches
+straight from the input tensor into micro-panels, applying padding as zeros:
+
+- NHWC: M = N P Q output pixels, N = output channels, K ordered (r, s, c) so every (pixel, r, s) is a
+  contiguous run of input channels. The patches are A, gathered into MR x KC panels. The weights are B,
+  reordered to (r, s, c) x K once and packed with sgemm_pack_b. The output is the M x K row-major C, so
+  bias per output channel is the epilogue's column bias
+- NCHW: per image M = output channels, N = P Q, K ordered (c, r, s) like OIHW weights, which are then A
+  as they are. The patches are B, gathered into KC x NR panels, 8 output pixels of one output row per k
+  step; with stride 1 and no padding in the way that is one unaligned load from the input row. The output
+  plane is C in place, so bias per output channel is the epilogue's row bias
+- the epilogue (scale, bias, activation, residual) is fused into the last KC block's store, as in matmul_ex
+
+Weights are OIHW (K x C x R x S) for both layouts. Stride, padding and dilation are the same in both
+spatial dimensions.
+
+Usage: gcc conv.c -O3 -mavx2 -mfma -mf16c -lpthread
+       ./a.out [nchw|nhwc [n c h w k r s stride pad [threads [dilation]]]]    compares against im2col + matmul_ex
+*/
+
+#define O5_NO_MAIN
+#include "o5.c"
+
+#define LAYOUT_NCHW 0
+#define LAYOUT_NHWC 1
+
+typedef struct {
+    int layout;
+    int n, c, h, w; // input
+    int k, r, s;    // output channels, filter height and width
+    int stride, pad, dilation;
+} ConvShape;
+
+// Output size, 0 when the padded input is smaller than the dilated filter (the division alone would truncate
+// that negative numerator toward zero and report one pixel). conv2d and main both reject a 0.
+FORCE_INLINE int conv_out_h(const ConvShape *cs) {
+    int span = cs->dilation * (cs->r - 1) + 1;
+    if (cs->h + 2 * cs->pad < span) return 0;
+    return (cs->h + 2 * cs->pad - span) / cs->stride + 1;
+}
+
+FORCE_INLINE int conv_out_w(const ConvShape *cs) {
+    int span = cs->dilation * (cs->s - 1) + 1;
+    if (cs->w + 2 * cs->pad < span) return 0;
+    return (cs->w + 2 * cs->pad - span) / cs->stride + 1;
+}
+
+typedef struct {
+    const ConvShape *cs;
+    const float *in;
+    const float *weight;  // OIHW, the A of NCHW
+    const PackedB *wp;    // (r, s, c) x k packed, the B of NHWC
+    float *out;
+    const Epilogue *ep;
+    int P, Q;
+    long start;           // NHWC: output pixels; NCHW: image * P Q + pixel
+    long end;
+} ConvArgs;
+
+// NHWC patch rows [m0, m0 + mb) x K columns [k0, k0 + kb) into MR panels. Within a panel, k runs of
+// constant (r, s) are contiguous input channels of every row.
+static void pack_patches_nhwc(const ConvShape *cs, const float *in, int P, int Q, long m0, int mb, int k0, int kb, float *A_to) {
+    int C = cs->c;
+    for (int p = 0; p < mb; p += MR) {
+        int m = mb - p < MR ? mb - p : MR;
+        long img[MR];
+        int h0[MR], w0[MR];
+        for (int i = 0; i < m; i++) {
+            long pix = m0 + p + i;
+            img[i] = pix / ((long)P * Q);
+            h0[i] = (int)(pix / Q % P) * cs->stride - cs->pad;
+            w0[i] = (int)(pix % Q) * cs->stride - cs->pad;
+        }
+
+        for (int k = k0; k < k0 + kb;) {
+            int rs = k / C, c0 = k % C;
+            int run = C - c0 < k0 + kb - k ? C - c0 : k0 + kb - k;
+            int dh = rs / cs->s * cs->dilation, dw = rs % cs->s * cs->dilation;
+            float *to = &A_to[(k - k0) * MR];
+            for (int i = 0; i < MR; i++) {
+                int hh = i < m ? h0[i] + dh : -1, ww = i < m ? w0[i] + dw : -1;
+                if (hh < 0 || hh >= cs->h || ww < 0 || ww >= cs->w) {
+                    for (int c = 0; c < run; c++) to[c * MR + i] = 0.0f;
+                    continue;
+                }
+                const float *src = &in[((img[i] * cs->h + hh) * cs->w + ww) * C + c0];
+                for (int c = 0; c < run; c++) to[c * MR + i] = src[c];
+            }
+            k += run;
+        }
+        A_to += MR * kb;
+    }
+}
+
+// NCHW patch rows K [k0, k0 + kb) x pixel columns [j0, j0 + nb) of image img into NR panels
+static void pack_patches_nchw(const ConvShape *cs, const float *in, int Q, long img, int k0, int kb, int j0, int nb, float *B_to) {
+    int RS = cs->r * cs->s;
+    const float *plane0 = &in[img * cs->c * cs->h * cs->w];
+    for (int j = 0; j < nb; j += NR) {
+        int n = nb - j < NR ? nb - j : NR;
+        int pix = j0 + j, p = pix / Q, q = pix % Q;
+        // All 8 in one output row: consecutive input columns at stride 1
+        int one_row = n == NR && q + NR <= Q;
+
+        for (int k = k0; k < k0 + kb; k++) {
+            int c = k / RS, rs = k % RS;
+            int dh = rs / cs->s * cs->dilation, dw = rs % cs->s * cs->dilation;
+            const float *plane = &plane0[(long)c * cs->h * cs->w];
+            float *to = &B_to[(k - k0) * NR];
+            if (one_row) {
+                int hh = p * cs->stride - cs->pad + dh, ww = q * cs->stride - cs->pad + dw;
+                if (hh < 0 || hh >= cs->h) {
+                    _mm256_store_ps(to, _mm256_setzero_ps());
+                    continue;
+                }
+                if (cs->stride == 1 && ww >= 0 && ww + NR <= cs->w) {
+                    _mm256_store_ps(to, _mm256_loadu_ps(&plane[hh * cs->w + ww]));
+                    continue;
+                }
+            }
+            for (int i = 0; i < NR; i++) {
+                float v = 0.0f;
+                if (i < n) {
+                    int pp = (pix + i) / Q, qq = (pix + i) % Q;
+                    int hh = pp * cs->stride - cs->pad + dh, ww = qq * cs->stride - cs->pad + dw;
+                    if (hh >= 0 && hh < cs->h && ww >= 0 && ww < cs->w) v = plane[hh * cs->w + ww];
+                }
+                to[i] = v;
+            }
+        }
+        B_to += NR * kb;
+    }
+}
+
+void *conv_nhwc_thread(void *arg) {
+    ConvArgs *a = (ConvArgs *)arg;
+    const ConvShape *cs = a->cs;
+    int N = cs->k, K = cs->r * cs->s * cs->c;
+    if (a->end <= a->start) return NULL;
+
+    int kc = K < KC ? K : KC;
+    long rows = a->end - a->start;
+    int mc = rows < MC ? (int)(rows + MR - 1) / MR * MR : MC;
+    size_t buf_bytes = (size_t)mc * kc * sizeof(float);
+    float *Ac = (float *)alloc_pages(buf_bytes);
+
+    for (long i = a->start; i < a->end; i += MC) {
+        int mb = (i + MC <= a->end) ? MC : (int)(a->end - i);
+        for (int k = 0; k < K; k += KC) {
+            int kb = (k + KC <= K) ? KC : K - k;
+            const Epilogue *ep = (k + kb >= K) ? a->ep : NULL;
+            pack_patches_nhwc(cs, a->in, a->P, a->Q, i, mb, k, kb, Ac);
+            for (int j = 0; j < N; j += NC) {
+                int nb = (j + NC <= N) ? NC : N - j;
+                compute_kernel(mb, nb, kb, Ac, &a->wp->data[(size_t)k * a->wp->Np + (size_t)kb * j], &a->out[i * N + j], N, ep, (int)i, j);
+            }
+        }
+    }
+
+    free_pages(Ac, buf_bytes);
+    return NULL;
+}
+
+void *conv_nchw_thread(void *arg) {
+    ConvArgs *a = (ConvArgs *)arg;
+    const ConvShape *cs = a->cs;
+    int M = cs->k, K = cs->c * cs->r * cs->s;
+    long PQ = (long)a->P * a->Q;
+    if (a->end <= a->start) return NULL;
+
+    int kc = K < KC ? K : KC;
+    int mc = M < MC ? (M + MR - 1) / MR * MR : MC;
+    int nc = a->end - a->start < NC ? (int)(a->end - a->start + NR - 1) / NR * NR : NC;
+    size_t ac_size = ((size_t)mc * kc + 15) / 16 * 16;
+    size_t buf_bytes = (ac_size + (size_t)kc * nc) * sizeof(float);
+    float *Ac = (float *)alloc_pages(buf_bytes);
+    float *Bc = Ac + ac_size;
+
+    // Column ranges never cross an image, each image's output plane is its own C
+    for (long pos = a->start; pos < a->end;) {
+        long img = pos / PQ;
+        int j = (int)(pos % PQ);
+        long stop = (img + 1) * PQ < a->end ? (img + 1) * PQ : a->end;
+        int nb = stop - pos < NC ? (int)(stop - pos) : NC;
+        float *C = &a->out[img * M * PQ];
+        Epilogue ep_img;
+        if (a->ep) {
+            ep_img = *a->ep;
+            if (ep_img.residual) ep_img.residual += img * M * PQ;
+        }
+
+        for (int k = 0; k < K; k += KC) {
+            int kb = (k + KC <= K) ? KC : K - k;
+            const Epilogue *ep = (a->ep && k + kb >= K) ? &ep_img : NULL;
+            pack_patches_nchw(cs, a->in, a->Q, img, k, kb, j, nb, Bc);
+            for (int i = 0; i < M; i += MC) {
+                int mb = (i + MC <= M) ? MC : M - i;
+                pack_a(DTYPE_F32, mb, kb, &a->weight[(size_t)i * K + k], K, Ac);
+                compute_kernel(mb, nb, kb, Ac, Bc, &C[(size_t)i * PQ + j], (int)PQ, ep, i, j);
+            }
+        }
+        pos += nb;
+    }
+
+    free_pages(Ac, buf_bytes);
+    return NULL;
+}
+
+// out += conv(in, weight), then ep (NULL for none) on the finished values. in and out are cs->layout
+// (N x C x H x W or N x H x W x C, out with K channels and conv_out_h x conv_out_w pixels), weight is OIHW.
+// ep's bias is per output channel in NHWC (columns), its row_bias per output channel in NCHW (rows); a
+// residual has the output's layout with ldr = K (NHWC) or P Q (NCHW).
+void conv2d(const ConvShape *cs, const float *in, const float *weight, float *out, const Epilogue *ep, int num_threads) {
+    ConvArgs args[MAX_THREADS];
+    int P = conv_out_h(cs), Q = conv_out_w(cs);
+    int K = cs->c * cs->r * cs->s;
+    if (P <= 0 || Q <= 0) return;
+    if (num_threads > MAX_THREADS) num_threads = MAX_THREADS;
+
+    PackedB *wp = NULL;
+    if (cs->layout == LAYOUT_NHWC) {
+        // OIHW to (r, s, c) x k, the order the patches are gathered in
+        float *wt = (float *)malloc((size_t)K * cs->k * sizeof(float));
+        if (!wt) {
+            fprintf(stderr, "Memory allocation failed\n");
+            exit(1);
+        }
+        for (int o = 0; o < cs->k; o++) {
+            for (int c = 0; c < cs->c; c++) {
+                for (int rs = 0; rs < cs->r * cs->s; rs++) {
+                    wt[((size_t)rs * cs->c + c) * cs->k + o] = weight[((size_t)o * cs->c + c) * cs->r * cs->s + rs];
+                }
+            }
+        }
+        wp = sgemm_pack_b(wt, K, cs->k);
+        free(wt);
+    }
+
+    // NHWC splits output pixels in MR multiples, NCHW (image, pixel) positions in NR multiples
+    long total = (long)cs->n * P * Q;
+    int step = cs->layout == LAYOUT_NHWC ? MR : NR;
+    long tiles = (total + step - 1) / step;
+    if (num_threads > tiles) num_threads = (int)tiles;
+    for (int t = 0; t < num_threads; t++) {
+        long start = tiles * t / num_threads * step, end = tiles * (t + 1) / num_threads * step;
+        args[t] = (ConvArgs){cs, in, weight, wp, out, ep, P, Q, start, end < total ? end : total};
+    }
+    launch_threads(cs->layout == LAYOUT_NHWC ? conv_nhwc_thread : conv_nchw_thread, args, sizeof(ConvArgs), num_threads);
+    sgemm_packed_free(wp);
+}
+
+// The buffer conv2d avoids: the explicit patch matrix, (r, s, c) x pixels rows for NHWC (M x K),
+// (c, r, s) x pixels for one NCHW image (K x P Q)
+static void im2col(const ConvShape *cs, const float *in, long img, float *col) {
+    int P = conv_out_h(cs), Q = conv_out_w(cs), RS = cs->r * cs->s, K = cs->c * RS;
+    for (int p = 0; p < P; p++) {
+        for (int q = 0; q < Q; q++) {
+            for (int k = 0; k < K; k++) {
+                int c, rs;
+                if (cs->layout == LAYOUT_NHWC) {
+                    rs = k / cs->c;
+                    c = k % cs->c;
+                } else {
+                    c = k / RS;
+                    rs = k % RS;
+                }
+                int hh = p * cs->stride - cs->pad + rs / cs->s * cs->dilation;
+                int ww = q * cs->stride - cs->pad + rs % cs->s * cs->dilation;
+                float v = 0.0f;
+                if (hh >= 0 && hh < cs->h && ww >= 0 && ww < cs->w) {
+                    v = cs->layout == LAYOUT_NHWC ? in[((img * cs->h + hh) * cs->w + ww) * cs->c + c]
+                                                  : in[((img * cs->c + c) * cs->h + hh) * cs->w + ww];
+                }
+                if (cs->layout == LAYOUT_NHWC) col[((size_t)p * Q + q) * K + k] = v;
+                else col[(size_t)k * P * Q + p * Q + q] = v;
+            }
+        }
+    }
+}
+
+int main(int argc, char *argv[]) {
+    ConvShape cs = {LAYOUT_NCHW, 8, 64, 56, 56, 64, 3, 3, 1, 1, 1};
+    int num_threads = 24;
+    if (argc >= 2) {
+        if (strcmp(argv[1], "nhwc") == 0) cs.layout = LAYOUT_NHWC;
+        else if (strcmp(argv[1], "nchw") != 0) cs.layout = -1;
+    }
+    if (argc >= 11) {
+        cs.n = atoi(argv[2]);
+        cs.c = atoi(argv[3]);
+        cs.h = atoi(argv[4]);
+        cs.w = atoi(argv[5]);
+        cs.k = atoi(argv[6]);
+        cs.r = atoi(argv[7]);
+        cs.s = atoi(argv[8]);
+        cs.stride = atoi(argv[9]);
+        cs.pad = atoi(argv[10]);
+    }
+    if (argc >= 12) num_threads = atoi(argv[11]);
+    if (argc >= 13) cs.dilation = atoi(argv[12]);
+    if (cs.layout < 0 || cs.n <= 0 || cs.c <= 0 || cs.h <= 0 || cs.w <= 0 || cs.k <= 0 || cs.r <= 0 || cs.s <= 0 ||
+        cs.stride <= 0 || cs.pad < 0 || cs.dilation <= 0 || conv_out_h(&cs) <= 0 || conv_out_w(&cs) <= 0 || num_threads <= 0 || num_threads > MAX_THREADS) {
+        fprintf(stderr, "Usage: %s [nchw|nhwc [n c h w k r s stride pad [threads (1..%d) [dilation]]]]\n", argv[0], MAX_THREADS);
+        return 1;
+    }
+
+    int P = conv_out_h(&cs), Q = conv_out_w(&cs), K = cs.c * cs.r * cs.s;
+    size_t in_len = (size_t)cs.n * cs.c * cs.h * cs.w, out_len = (size_t)cs.n * cs.k * P * Q, w_len = (size_t)cs.k * K;
+    size_t col_len = cs.layout == LAYOUT_NHWC ? (size_t)cs.n * P * Q * K : (size_t)K * P * Q;
+    float *in = (float *)alloc_matrix(in_len * sizeof(float));
+    float *weight = (float *)alloc_matrix(w_len * sizeof(float));
+    float *bias = (float *)alloc_matrix(cs.k * sizeof(float));
+    float *out = (float *)alloc_matrix(out_len * sizeof(float));
+    float *ref = (float *)alloc_matrix(out_len * sizeof(float));
+    float *col = (float *)alloc_matrix(col_len * sizeof(float));
+    float *wt = (float *)alloc_matrix(w_len * sizeof(float));
+    uint64_t seed = time(NULL);
+    init_uniform(DTYPE_F32, in, cs.n * cs.c, cs.h * cs.w, -1.0f, 1.0f, seed, num_threads);
+    init_uniform(DTYPE_F32, weight, cs.k, K, -0.1f, 0.1f, seed + 1, num_threads);
+    init_uniform(DTYPE_F32, bias, 1, cs.k, -0.1f, 0.1f, seed + 2, 1);
+    const char *name = cs.layout == LAYOUT_NHWC ? "NHWC" : "NCHW";
+    printf("%s %dx%dx%dx%d, %d filters %dx%d, stride %d, pad %d, dilation %d -> %dx%d, im2col buffer %.1f MB (input %.1f MB)\n", name, cs.n,
+           cs.c, cs.h, cs.w, cs.k, cs.r, cs.s, cs.stride, cs.pad, cs.dilation, P, Q, col_len * 4 / 1e6, in_len * 4 / 1e6);
+
+    // im2col + matmul_ex, bias and ReLU fused the same way
+    double flops = 2.0 * cs.n * cs.k * P * Q * K;
+    // Results are keyed by the GEMM view (n P Q x k x c r s); the kernel name carries what that view leaves out
+    char kernel[2][96];
+    for (int v = 0; v < 2; v++) {
+        snprintf(kernel[v], sizeof(kernel[v]), "%s %s %dx%d stride %d pad %d dilation %d", v ? "conv2d" : "im2col_matmul",
+                 cs.layout == LAYOUT_NHWC ? "nhwc" : "nchw", cs.r, cs.s, cs.stride, cs.pad, cs.dilation);
+    }
+    Epilogue ep_col = {1.0f, bias, ACT_RELU, NULL, 0, NULL}, ep_row = {1.0f, NULL, ACT_RELU, NULL, 0, bias};
+    init_zero(ref, cs.n * cs.k, (size_t)P * Q * sizeof(float), num_threads);
+    Telemetry tel;
+    telemetry_start(&tel, num_threads);
+    if (cs.layout == LAYOUT_NHWC) {
+        for (int o = 0; o < cs.k; o++) {
+            for (int c = 0; c < cs.c; c++) {
+                for (int rs = 0; rs < cs.r * cs.s; rs++) wt[((size_t)rs * cs.c + c) * cs.k + o] = weight[((size_t)o * cs.c + c) * cs.r * cs.s + rs];
+            }
+        }
+        for (int img = 0; img < cs.n; img++) im2col(&cs, in, img, &col[(size_t)img * P * Q * K]);
+        matmul_ex(col, DTYPE_F32, wt, DTYPE_F32, ref, cs.n * P * Q, cs.k, K, &ep_col, num_threads);
+    } else {
+        for (int img = 0; img < cs.n; img++) {
+            im2col(&cs, in, img, col);
+            matmul_ex(weight, DTYPE_F32, col, DTYPE_F32, &ref[(size_t)img * cs.k * P * Q], cs.k, P * Q, K, &ep_row, num_threads);
+        }
+    }
+    double elapsed = telemetry_stop(&tel);
+    printf("im2col + matmul_ex: %.6f seconds, %.2f GFLOPS\n", elapsed, flops / (elapsed * 1e9));
+    bench_record(&tel, kernel[0], cs.n * P * Q, cs.k, K, "f32", num_threads, elapsed, flops);
+
+    init_zero(out, cs.n * cs.k, (size_t)P * Q * sizeof(float), num_threads);
+    telemetry_start(&tel, num_threads);
+    conv2d(&cs, in, weight, out, cs.layout == LAYOUT_NHWC ? &ep_col : &ep_row, num_threads);
+    double implicit = telemetry_stop(&tel);
+
+    double worst = 0.0;
+    for (size_t i = 0; i < out_len; i++) {
+        double err = out[i] - ref[i];
+        if (err < 0) err = -err;
+        if (!(err <= worst)) worst = err;
+    }
+    printf("implicit GEMM:      %.6f seconds, %.2f GFLOPS, %.2fx, max abs error %.2e\n", implicit, flops / (implicit * 1e9),
+           elapsed / implicit, worst);
+    bench_record(&tel, kernel[1], cs.n * P * Q, cs.k, K, "f32", num_threads, implicit, flops);
+
+    free_matrix(in, in_len * sizeof(float));
+    free_matrix(weight, w_len * sizeof(float));
+    free_matrix(bias, cs.k * sizeof(float));
+    free_matrix(out, out_len * sizeof(float));
+    free_matrix(ref, out_len * sizeof(float));
+    free_matrix(col, col_len * sizeof(float));
+    free_matrix(wt, w_len * sizeof(float));
+    return 0;
+}
@@ -0,0 +1,268 @@
+/*
+Double precision GEMM through the o5 blocked engine
+
+- same MC / KC / NC loop nest, per-thread packing buffers and row split as o5's matmul_thread
+- 6 x 8 register tile: 6 rows x 2 __m256d = 12 accumulators, enough to cover FMA latency on 2 ports
+- panels are zero padded, edge tiles reuse the micro-kernel through a scratch tile
+- reports the fraction of the theory.py bound, which assumes double precision (simd_factor = 4)
+
+Usage: gcc dgemm.c -O3 -mavx2 -mfma ; ./a.out [M N K [threads]]
+*/
+
+#define O5_NO_MAIN
+#include "o5.c"
+
+// Micro-kernel size
+#define DMR 6
+#define DNR 8
+
+// Packing buffer size: A panel 6 x 256 doubles (12 KB) and B panel 256 x 8 doubles (16 KB) share L1
+#define DMC 72
+#define DKC 256
+#define DNC 4080
+
+// Same factors as theory.py
+#define THEORY_CLOCK 4.8e9
+#define THEORY_CORES 12
+#define THEORY_SIMD 4
+#define THEORY_FMA 2
+#define THEORY_SUPERSCALAR 6
+
+typedef struct {
+    const double *A;
+    const double *B;
+    double *C;
+    int M, N, K;
+    int start_row;
+    int end_row;
+} DThreadArgs;
+
+// Function to pack A into DMR-row micro-panels, k-major inside a panel, zero padded
+FORCE_INLINE void pack_a_d(int M, int K, const double *A, int lda, double *A_to) {
+    for (int i = 0; i < M; i += DMR) {
+        int m = (i + DMR <= M) ? DMR : M - i;
+        for (int k = 0; k < K; ++k) {
+            for (int r = 0; r < m; ++r) {
+                A_to[k * DMR + r] = A[(size_t)(i + r) * lda + k];
+            }
+            for (int r = m; r < DMR; ++r) {
+                A_to[k * DMR + r] = 0.0;
+            }
+        }
+        A_to += DMR * K;
+    }
+}
+
+// Function to pack B into DNR-column micro-panels, zero padded
+FORCE_INLINE void pack_b_d(int K, int N, const double *B, int ldb, double *B_to) {
+    for (int j = 0; j < N; j += DNR) {
+        int n = (j + DNR <= N) ? DNR : N - j;
+        if (n == DNR) {
+            for (int k = 0; k < K; ++k) {
+                _mm256_store_pd(&B_to[k * DNR], _mm256_loadu_pd(&B[(size_t)k * ldb + j]));
+                _mm256_store_pd(&B_to[k * DNR + 4], _mm256_loadu_pd(&B[(size_t)k * ldb + j + 4]));
+            }
+        } else {
+            for (int k = 0; k < K; ++k) {
+                for (int c = 0; c < n; ++c) {
+                    B_to[k * DNR + c] = B[(size_t)k * ldb + j + c];
+                }
+                for (int c = n; c < DNR; ++c) {
+                    B_to[k * DNR + c] = 0.0;
+                }
+            }
+        }
+        B_to += DNR * K;
+    }
+}
+
+// Micro-kernel: C[DMR x DNR] += A panel * B panel
+FORCE_INLINE void micro_kernel_d(int K, const double *A, const double *B, double *C, int ldc) {
+    __m256d c0[DMR], c1[DMR];
+    for (int i = 0; i < DMR; ++i) {
+        c0[i] = _mm256_setzero_pd();
+        c1[i] = _mm256_setzero_pd();
+    }
+
+    for (int k = 0; k < K; ++k) {
+        __m256d b0 = _mm256_load_pd(&B[k * DNR]);
+        __m256d b1 = _mm256_load_pd(&B[k * DNR + 4]);
+        for (int i = 0; i < DMR; ++i) {
+            __m256d a = _mm256_broadcast_sd(&A[k * DMR + i]);
+            c0[i] = _mm256_fmadd_pd(a, b0, c0[i]);
+            c1[i] = _mm256_fmadd_pd(a, b1, c1[i]);
+        }
+    }
+
+    for (int i = 0; i < DMR; ++i) {
+        _mm256_storeu_pd(&C[i * ldc], _mm256_add_pd(_mm256_loadu_pd(&C[i * ldc]), c0[i]));
+        _mm256_storeu_pd(&C[i * ldc + 4], _mm256_add_pd(_mm256_loadu_pd(&C[i * ldc + 4]), c1[i]));
+    }
+}
+
+// Function to handle edge cases: run the full tile into scratch and add M x N of it
+FORCE_INLINE void edge_case_micro_kernel_d(int M, int N, int K, const double *A, const double *B, double *C, int ldc) {
+    double ALIGN tile[DMR * DNR] = {0};
+    micro_kernel_d(K, A, B, tile, DNR);
+    for (int i = 0; i < M; ++i) {
+        for (int j = 0; j < N; ++j) {
+            C[i * ldc + j] += tile[i * DNR + j];
+        }
+    }
+}
+
+void compute_kernel_d(int M, int N, int K, const double *A, const double *B, double *C, int ldc) {
+    int mb = (M + DMR - 1) / DMR;
+    int nb = (N + DNR - 1) / DNR;
+
+    for (int i = 0; i < mb; ++i) {
+        int m = (i != mb - 1 || M % DMR == 0) ? DMR : M % DMR;
+
+        for (int j = 0; j < nb; ++j) {
+            int n = (j != nb - 1 || N % DNR == 0) ? DNR : N % DNR;
+
+            if (m == DMR && n == DNR) {
+                micro_kernel_d(K, &A[i * DMR * K], &B[j * DNR * K], &C[(size_t)i * DMR * ldc + j * DNR], ldc);
+            } else {
+                edge_case_micro_kernel_d(m, n, K, &A[i * DMR * K], &B[j * DNR * K], &C[(size_t)i * DMR * ldc + j * DNR], ldc);
+            }
+        }
+    }
+}
+
+void *dgemm_thread(void *arg) {
+    DThreadArgs *args = (DThreadArgs *)arg;
+    const double *A = args->A;
+    const double *B = args->B;
+    double *C = args->C;
+    int N = args->N, K = args->K;
+    int start_row = args->start_row;
+    int end_row = args->end_row;
+
+    // Packed buffers, private to each thread, in one mapping on 2 MB pages where available.
+    // Sized to the call, small problems do not fault in whole huge pages.
+    size_t kc = K < DKC ? K : DKC;
+    size_t mc = end_row - start_row < DMC ? (end_row - start_row + DMR - 1) / DMR * DMR : DMC;
+    size_t nc = N < DNC ? (N + DNR - 1) / DNR * DNR : DNC;
+    size_t ac_size = (mc * kc + 7) / 8 * 8; // Bc starts on a cache line
+    size_t buf_bytes = (ac_size + kc * nc) * sizeof(double);
+    double *Ac = (double *)alloc_pages(buf_bytes);
+    double *Bc = Ac + ac_size;
+
+    for (int i = start_row; i < end_row; i += DMC) {
+        int mb = (i + DMC <= end_row) ? DMC : end_row - i;
+
+        for (int k = 0; k < K; k += DKC) {
+            int kb = (k + DKC <= K) ? DKC : K - k;
+
+            // Pack A
+            pack_a_d(mb, kb, &A[(size_t)i * K + k], K, Ac);
+
+            for (int j = 0; j < N; j += DNC) {
+                int nb = (j + DNC <= N) ? DNC : N - j;
+
+                // Pack B
+                pack_b_d(kb, nb, &B[(size_t)k * N + j], N, Bc);
+
+                // Compute
+                compute_kernel_d(mb, nb, kb, Ac, Bc, &C[(size_t)i * N + j], N);
+            }
+        }
+    }
+
+    free_pages(Ac, buf_bytes);
+    return NULL;
+}
+
+typedef struct {
+    double *X;
+    int cols;
+    uint64_t seed;
+} DFillArgs;
+
+static void fill_uniform_d_rows(void *ctx, int start_row, int end_row) {
+    DFillArgs *f = (DFillArgs *)ctx;
+    for (size_t i = (size_t)start_row * f->cols; i < (size_t)end_row * f->cols; i++) {
+        f->X[i] = (double)(rng_u64(f->seed, i) >> 11) * (1.0 / 9007199254740992.0); // [0, 1)
+    }
+}
+
+// C += A B in double precision
+void dgemm(const double *A, const double *B, double *C, int M, int N, int K, int num_threads) {
+    DThreadArgs thread_args[MAX_THREADS];
+
+    if (num_threads > MAX_THREADS) num_threads = MAX_THREADS;
+    for (int i = 0; i < num_threads; i++) {
+        thread_args[i].A = A;
+        thread_args[i].B = B;
+        thread_args[i].C = C;
+        thread_args[i].M = M;
+        thread_args[i].N = N;
+        thread_args[i].K = K;
+        // Split on DMR boundaries so only the last thread sees a short tile
+        thread_args[i].start_row = (int)((long)(M / DMR) * i / num_threads) * DMR;
+        thread_args[i].end_row = (i == num_threads - 1) ? M : (int)((long)(M / DMR) * (i + 1) / num_threads) * DMR;
+    }
+
+    launch_threads(dgemm_thread, thread_args, sizeof(DThreadArgs), num_threads);
+}
+
+int main(int argc, char *argv[]) {
+    int M = 4096, N = 4096, K = 4096;
+    int num_threads = 24; // Adjust based on your CPU
+    if (argc >= 4) {
+        M = atoi(argv[1]);
+        N = atoi(argv[2]);
+        K = atoi(argv[3]);
+    }
+    if (argc >= 5) {
+        num_threads = atoi(argv[4]);
+    }
+    if (M <= 0 || N <= 0 || K <= 0 || num_threads <= 0 || num_threads > MAX_THREADS) {
+        fprintf(stderr, "Usage: %s [M N K [threads (1..%d)]]\n", argv[0], MAX_THREADS);
+        return 1;
+    }
+
+    double *A = (double *)alloc_matrix((size_t)M * K * sizeof(double));
+    double *B = (double *)alloc_matrix((size_t)K * N * sizeof(double));
+    double *C = (double *)alloc_matrix((size_t)M * N * sizeof(double));
+
+    // Initialize matrices with random values, in parallel so row bands are first touched by their workers
+    uint64_t seed = time(NULL);
+    DFillArgs fa = {A, K, seed}, fb = {B, N, seed + 1};
+    parallel_rows(M, num_threads, fill_uniform_d_rows, &fa);
+    parallel_rows(K, num_threads, fill_uniform_d_rows, &fb);
+    init_zero(C, M, (size_t)N * sizeof(double), num_threads);
+
+    Telemetry tel;
+    telemetry_start(&tel, num_threads);
+    dgemm(A, B, C, M, N, K, num_threads);
+    double elapsed_time = telemetry_stop(&tel);
+
+    // Spot check a few rows against a scalar reference
+    double max_err = 0.0;
+    for (int i = 0; i < M; i += (M > 8 ? M / 8 : 1)) {
+        for (int j = 0; j < N; j++) {
+            double ref = 0.0;
+            for (int k = 0; k < K; k++) ref += A[(size_t)i * K + k] * B[(size_t)k * N + j];
+            double err = (ref - C[(size_t)i * N + j]) / (ref != 0.0 ? ref : 1.0);
+            if (err < 0) err = -err;
+            if (err > max_err) max_err = err;
+        }
+    }
+
+    double flops = 2.0 * M * N * K;
+    double gflops = flops / (elapsed_time * 1e9);
+    double peak = THEORY_CLOCK * THEORY_CORES * THEORY_SIMD * THEORY_FMA * THEORY_SUPERSCALAR;
+
+    printf("Time: %.6f seconds\n", elapsed_time);
+    printf("Performance: %.2f GFLOPS\n", gflops);
+    bench_record(&tel, "dgemm", M, N, K, "f64", num_threads, elapsed_time, flops);
+    printf("theory.py bound: %.2f GFLOPS (%.1f%% reached)\n", peak / 1e9, 100.0 * gflops * 1e9 / peak);
+    printf("Max relative error: %.3e\n", max_err);
+
+    free_matrix(A, (size_t)M * K * sizeof(double));
+    free_matrix(B, (size_t)K * N * sizeof(double));
+    free_matrix(C, (size_t)M * N * sizeof(double));
+    return 0;
+}
@@ -0,0 +1,399 @@
+/*
+Einsum-style tensor contraction on o5's packed GEMM: einsum("bik,bkj->bij", A, B, C) computes C += contraction
+
+Index letters are classed by where they appear: in A, B and C a batch index, in A and C an M index, in B and C an
+N index, in A and B a contracted K index. Each group is flattened into one GEMM dimension, so the call becomes a
+batch of M x N x K GEMMs over the original strided storage:
+
+- per group and operand, a table of element offsets (A(b, m, k) = A[a_b[b] + a_m[m] + a_k[k]]), so any strides
+  and any index order work, without permuted copies
+- when a group's table is affine the block goes to o5's own packing: rows of stride lda with unit-stride k
+  through pack_a, unit-stride rows with stride-s k through pack_b, and likewise for B. Anything else is gathered through the tables
+  straight into MR x KC / KC x NR panels, a vector at a time where 8 rows (columns of B) are contiguous
+- C is written by the micro-kernel in place when its M and N groups are affine with unit-stride N, otherwise
+  through a scratch tile and a scatter
+- (batch, MC row band) pairs are the work items split over threads, the bands narrowed when there are fewer
+  items than threads
+
+Indices in only one operand (sums), repeated indices (traces) and broadcasting are not supported.
+
+Usage: gcc einsum.c -O3 -mavx2 -mfma -mf16c -lpthread
+       ./a.out [size [threads]]    runs a few contractions against permuted copies + matmul_ex
+*/
+
+#define O5_NO_MAIN
+#include "o5.c"
+
+#define EINSUM_MAX_DIMS 8
+#define NOT_AFFINE INT64_MIN
+
+// A strided view: element (i0, i1, ...) at data[i0 * stride[0] + i1 * stride[1] + ...]
+typedef struct {
+    float *data;
+    int ndim;
+    int shape[EINSUM_MAX_DIMS];
+    long stride[EINSUM_MAX_DIMS]; // in elements
+} Tensor;
+
+// Contiguous row-major view of data
+Tensor tensor_view(float *data, int ndim, const int *shape) {
+    Tensor t = {data, ndim};
+    long s = 1;
+    for (int d = ndim - 1; d >= 0; d--) {
+        t.shape[d] = shape[d];
+        t.stride[d] = s;
+        s *= shape[d];
+    }
+    return t;
+}
+
+// View with its dimensions reordered: dimension d of the result is dimension perm[d] of t. No data moves.
+Tensor tensor_permute(const Tensor *t, const int *perm) {
+    Tensor p = *t;
+    for (int d = 0; d < t->ndim; d++) {
+        p.shape[d] = t->shape[perm[d]];
+        p.stride[d] = t->stride[perm[d]];
+    }
+    return p;
+}
+
+// Offsets of one flattened index group in one operand
+typedef struct {
+    long *off;
+    long len;
+    long stride; // off[i] = off[0] + i * stride, or NOT_AFFINE
+} Group;
+
+typedef struct {
+    const float *A, *B;
+    float *C;
+    Group a_b, a_m, a_k, b_b, b_k, b_n, c_b, c_m, c_n;
+    int M, N, K;
+    int band;  // rows per work item
+    int bands; // work items per batch
+    long start_item;
+    long end_item;
+} EinsumArgs;
+
+// Offsets for the row-major flattening of the indices idx (sizes size[]) in an operand with per-letter strides
+static Group make_group(const char *idx, int n, const int *size, const long *stride_of) {
+    Group g;
+    g.len = 1;
+    for (int d = 0; d < n; d++) g.len *= size[(unsigned char)idx[d]];
+    g.off = (long *)malloc(g.len * sizeof(long));
+    if (!g.off) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(1);
+    }
+    for (long f = 0; f < g.len; f++) {
+        long rest = f, off = 0;
+        for (int d = n - 1; d >= 0; d--) {
+            int s = size[(unsigned char)idx[d]];
+            off += (rest % s) * stride_of[(unsigned char)idx[d]];
+            rest /= s;
+        }
+        g.off[f] = off;
+    }
+    g.stride = g.len > 1 ? g.off[1] - g.off[0] : 1;
+    for (long f = 2; f < g.len && g.stride != NOT_AFFINE; f++) {
+        if (g.off[f] - g.off[f - 1] != g.stride) g.stride = NOT_AFFINE;
+    }
+    return g;
+}
+
+// X(p, d) = X[gp->off[p] + gd->off[d]] for p in [p0, p0 + np), d in [d0, d0 + nd) into 8-wide panels, k-major
+// (A with p = M, B with p = N, both with d = K). Affine groups go to o5's packing: unit-stride d through pack_a,
+// unit-stride p through pack_b.
+// Anything else is gathered panel by panel, 8 contiguous values at a time where the panel's p are.
+static void pack_panels(const float *X, const Group *gp, const Group *gd, int p0, int d0, int np, int nd, float *to) {
+    const float *base = X + gp->off[p0] + gd->off[d0];
+    if (gd->stride == 1 && gp->stride != NOT_AFFINE) {
+        pack_a(DTYPE_F32, np, nd, base, (int)gp->stride, to);
+        return;
+    }
+    if (gp->stride == 1 && gd->stride != NOT_AFFINE) {
+        pack_b(DTYPE_F32, nd, np, base, (int)gd->stride, to);
+        return;
+    }
+    for (int p = 0; p < np; p += MR) {
+        int m = np - p < MR ? np - p : MR;
+        const long *ro = &gp->off[p0 + p];
+        int contiguous = m == MR;
+        for (int r = 1; r < m && contiguous; r++) contiguous = ro[r] == ro[0] + r;
+        if (contiguous) {
+            for (int d = 0; d < nd; d++) _mm256_store_ps(&to[d * MR], _mm256_loadu_ps(&X[ro[0] + gd->off[d0 + d]]));
+        } else {
+            for (int d = 0; d < nd; d++) {
+                long o = gd->off[d0 + d];
+                for (int r = 0; r < MR; r++) to[d * MR + r] = r < m ? X[ro[r] + o] : 0.0f;
+            }
+        }
+        to += MR * nd;
+    }
+}
+
+void *einsum_thread(void *arg) {
+    EinsumArgs *a = (EinsumArgs *)arg;
+    int N = a->N, K = a->K;
+    if (a->end_item <= a->start_item) return NULL;
+
+    // C in place needs unit-stride columns and evenly spaced rows
+    int direct = a->c_n.stride == 1 && a->c_m.stride != NOT_AFFINE;
+    int kc = K < KC ? K : KC;
+    int mc = (a->band + MR - 1) / MR * MR;
+    int nc = N < NC ? (N + NR - 1) / NR * NR : NC;
+    size_t ac_size = ((size_t)mc * kc + 15) / 16 * 16;
+    size_t bc_size = ((size_t)kc * nc + 15) / 16 * 16;
+    size_t d_size = direct ? 0 : (size_t)mc * nc;
+    size_t buf_bytes = (ac_size + bc_size + d_size) * sizeof(float);
+    float *Ac = (float *)alloc_pages(buf_bytes);
+    float *Bc = Ac + ac_size;
+    float *D = Bc + bc_size;
+
+    for (long item = a->start_item; item < a->end_item; item++) {
+        long b = item / a->bands;
+        int i = (int)(item % a->bands) * a->band;
+        int mb = a->M - i < a->band ? a->M - i : a->band;
+        const float *A = a->A + a->a_b.off[b], *B = a->B + a->b_b.off[b];
+        float *C = a->C + a->c_b.off[b];
+
+        for (int j = 0; j < N; j += NC) {
+            int nb = (j + NC <= N) ? NC : N - j;
+            for (int k = 0; k < K; k += KC) {
+                int kb = (k + KC <= K) ? KC : K - k;
+                pack_panels(A, &a->a_m, &a->a_k, i, k, mb, kb, Ac);
+                pack_panels(B, &a->b_n, &a->b_k, j, k, nb, kb, Bc);
+                if (direct) compute_kernel(mb, nb, kb, Ac, Bc, C + a->c_m.off[i] + a->c_n.off[j], (int)a->c_m.stride, NULL, i, j);
+                else compute_kernel(mb, nb, kb, Ac, Bc, D, nb, NULL, i, j);
+            }
+            if (!direct) {
+                for (int r = 0; r < mb; r++) {
+                    float *row = C + a->c_m.off[i + r];
+                    for (int c = 0; c < nb; c++) row[a->c_n.off[j + c]] += D[(size_t)r * nb + c];
+                }
+                memset(D, 0, (size_t)mb * nb * sizeof(float));
+            }
+        }
+    }
+
+    free_pages(Ac, buf_bytes);
+    return NULL;
+}
+
+// Letters of one operand of the spec, up to the terminator; -1 on a bad letter, a repeat or too many
+static int parse_operand(const char **p, const char *end_chars, char *idx) {
+    int n = 0;
+    while (**p && !strchr(end_chars, **p)) {
+        char c = *(*p)++;
+        if (c == ' ') continue;
+        if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')) || n == EINSUM_MAX_DIMS || memchr(idx, c, n)) return -1;
+        idx[n++] = c;
+    }
+    return n;
+}
+
+// C += contraction of A and B described by spec ("bik,bkj->bij"). Every letter of C must be in A or B, every
+// letter of A and B in exactly two of the three. Returns 0, or -1 (after a message) for a spec or shape the
+// tensors do not fit.
+int einsum(const char *spec, const Tensor *A, const Tensor *B, Tensor *C, int num_threads) {
+    char ia[EINSUM_MAX_DIMS], ib[EINSUM_MAX_DIMS], ic[EINSUM_MAX_DIMS];
+    const char *p = spec;
+    int na = parse_operand(&p, ",", ia);
+    if (*p == ',') p++;
+    int nb = parse_operand(&p, "-", ib);
+    int nc = -1;
+    if (p[0] == '-' && p[1] == '>') {
+        p += 2;
+        nc = parse_operand(&p, "", ic);
+    }
+    if (na < 0 || nb < 0 || nc < 0) {
+        fprintf(stderr, "einsum: bad spec \"%s\", expected e.g. \"bik,bkj->bij\"\n", spec);
+        return -1;
+    }
+    if (na != A->ndim || nb != B->ndim || nc != C->ndim) {
+        fprintf(stderr, "einsum: \"%s\" does not match tensors of %d, %d and %d dimensions\n", spec, A->ndim, B->ndim, C->ndim);
+        return -1;
+    }
+
+    // Size and per-operand stride of every letter (0 where the operand does not have it)
+    int size[128] = {0};
+    long sa[128] = {0}, sb[128] = {0}, sc[128] = {0};
+    const Tensor *ts[3] = {A, B, C};
+    const char *is[3] = {ia, ib, ic};
+    long *ss[3] = {sa, sb, sc};
+    for (int t = 0; t < 3; t++) {
+        for (int d = 0; d < ts[t]->ndim; d++) {
+            unsigned char c = is[t][d];
+            if (size[c] && size[c] != ts[t]->shape[d]) {
+                fprintf(stderr, "einsum: index %c is %d in one operand and %d in another\n", c, size[c], ts[t]->shape[d]);
+                return -1;
+            }
+            size[c] = ts[t]->shape[d];
+            ss[t][c] = ts[t]->stride[d];
+        }
+    }
+
+    // Groups: batch and M / N in C's order, K in A's
+    char gb[EINSUM_MAX_DIMS], gm[EINSUM_MAX_DIMS], gn[EINSUM_MAX_DIMS], gk[EINSUM_MAX_DIMS];
+    int nbatch = 0, nm = 0, nn = 0, nk = 0;
+    for (int d = 0; d < nc; d++) {
+        int in_a = memchr(ia, ic[d], na) != NULL, in_b = memchr(ib, ic[d], nb) != NULL;
+        if (in_a && in_b) gb[nbatch++] = ic[d];
+        else if (in_a) gm[nm++] = ic[d];
+        else if (in_b) gn[nn++] = ic[d];
+        else {
+            fprintf(stderr, "einsum: output index %c is in neither input\n", ic[d]);
+            return -1;
+        }
+    }
+    for (int d = 0; d < na; d++) {
+        if (memchr(ic, ia[d], nc)) continue;
+        if (!memchr(ib, ia[d], nb)) {
+            fprintf(stderr, "einsum: index %c is only in the first input (sums are not supported)\n", ia[d]);
+            return -1;
+        }
+        gk[nk++] = ia[d];
+    }
+    for (int d = 0; d < nb; d++) {
+        if (!memchr(ic, ib[d], nc) && !memchr(ia, ib[d], na)) {
+            fprintf(stderr, "einsum: index %c is only in the second input (sums are not supported)\n", ib[d]);
+            return -1;
+        }
+    }
+
+    EinsumArgs proto = {A->data, B->data, C->data};
+    proto.a_b = make_group(gb, nbatch, size, sa);
+    proto.a_m = make_group(gm, nm, size, sa);
+    proto.a_k = make_group(gk, nk, size, sa);
+    proto.b_b = make_group(gb, nbatch, size, sb);
+    proto.b_k = make_group(gk, nk, size, sb);
+    proto.b_n = make_group(gn, nn, size, sb);
+    proto.c_b = make_group(gb, nbatch, size, sc);
+    proto.c_m = make_group(gm, nm, size, sc);
+    proto.c_n = make_group(gn, nn, size, sc);
+    Group *groups[9] = {&proto.a_b, &proto.a_m, &proto.a_k, &proto.b_b, &proto.b_k, &proto.b_n, &proto.c_b, &proto.c_m, &proto.c_n};
+    if (proto.c_m.len > INT32_MAX || proto.b_n.len > INT32_MAX || proto.a_k.len > INT32_MAX) {
+        fprintf(stderr, "einsum: a flattened dimension exceeds 2^31\n");
+        for (int g = 0; g < 9; g++) free(groups[g]->off);
+        return -1;
+    }
+    proto.M = (int)proto.c_m.len;
+    proto.N = (int)proto.c_n.len;
+    proto.K = (int)proto.a_k.len;
+    long batches = proto.c_b.len;
+
+    // Work items: MC row bands of every batch, halved while there are fewer than threads
+    if (num_threads > MAX_THREADS) num_threads = MAX_THREADS;
+    int band = MC;
+    while (band > MR && batches * ((proto.M + band - 1) / band) < num_threads) band = (band / 2 + MR - 1) / MR * MR;
+    proto.band = band;
+    proto.bands = (proto.M + band - 1) / band;
+    long items = batches * proto.bands;
+    if (num_threads > items) num_threads = items > 0 ? (int)items : 1;
+
+    EinsumArgs args[MAX_THREADS];
+    for (int t = 0; t < num_threads; t++) {
+        args[t] = proto;
+        args[t].start_item = items * t / num_threads;
+        args[t].end_item = items * (t + 1) / num_threads;
+    }
+    if (proto.M > 0 && proto.N > 0) launch_threads(einsum_thread, args, sizeof(EinsumArgs), num_threads);
+
+    for (int g = 0; g < 9; g++) free(groups[g]->off);
+    return 0;
+}
+
+// Contiguous row-major copy of a strided view, the permuted copy einsum avoids
+static void tensor_copy(const Tensor *t, float *dst) {
+    int idx[EINSUM_MAX_DIMS] = {0};
+    long total = 1;
+    for (int d = 0; d < t->ndim; d++) total *= t->shape[d];
+    int last = t->ndim - 1;
+    for (long f = 0; f < total; f += t->shape[last]) {
+        long off = 0;
+        for (int d = 0; d < last; d++) off += idx[d] * t->stride[d];
+        for (int i = 0; i < t->shape[last]; i++) dst[f + i] = t->data[off + i * t->stride[last]];
+        for (int d = last - 1; d >= 0 && ++idx[d] == t->shape[d]; d--) idx[d] = 0;
+    }
+}
+
+typedef struct {
+    const char *spec;
+    int na, nb, nc;
+    int a_shape[4], b_shape[4], c_shape[4];
+    int a_perm[4], b_perm[4]; // into (batch, M, K) and (batch, K, N) order for the copies
+    int batch, M, N, K;
+} Case;
+
+int main(int argc, char *argv[]) {
+    int s = 512;
+    int num_threads = 24;
+    if (argc >= 2) s = atoi(argv[1]);
+    if (argc >= 3) num_threads = atoi(argv[2]);
+    if (s < 16 || s % 16 != 0 || num_threads <= 0 || num_threads > MAX_THREADS) {
+        fprintf(stderr, "Usage: %s [size (multiple of 16) [threads (1..%d)]]\n", argv[0], MAX_THREADS);
+        return 1;
+    }
+
+    int t = s / 16;
+    Case cases[] = {
+        {"bik,bkj->bij", 3, 3, 3, {8, s, s}, {8, s, s}, {8, s, s}, {0, 1, 2}, {0, 1, 2}, 8, s, s, s},
+        {"bik,bjk->bij", 3, 3, 3, {8, s, s}, {8, s, s}, {8, s, s}, {0, 1, 2}, {0, 2, 1}, 8, s, s, s},
+        {"abcd,cde->abe", 4, 3, 3, {16, t, 16, t}, {16, t, s}, {16, t, s}, {0, 1, 2, 3}, {0, 1, 2}, 1, s, s, s},
+        {"acbd,dce->abe", 4, 3, 3, {16, 16, t, t}, {t, 16, s}, {16, t, s}, {0, 2, 1, 3}, {1, 0, 2}, 1, s, s, s},
+    };
+
+    uint64_t seed = time(NULL);
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+        Case *cs = &cases[c];
+        size_t a_len = (size_t)cs->batch * cs->M * cs->K, b_len = (size_t)cs->batch * cs->K * cs->N;
+        size_t c_len = (size_t)cs->batch * cs->M * cs->N;
+        float *A = (float *)alloc_matrix(a_len * sizeof(float)), *Ap = (float *)alloc_matrix(a_len * sizeof(float));
+        float *B = (float *)alloc_matrix(b_len * sizeof(float)), *Bp = (float *)alloc_matrix(b_len * sizeof(float));
+        float *C = (float *)alloc_matrix(c_len * sizeof(float)), *R = (float *)alloc_matrix(c_len * sizeof(float));
+        init_uniform(DTYPE_F32, A, cs->batch * cs->M, cs->K, -1.0f, 1.0f, seed + 2 * c, num_threads);
+        init_uniform(DTYPE_F32, B, cs->batch * cs->K, cs->N, -1.0f, 1.0f, seed + 2 * c + 1, num_threads);
+        Tensor ta = tensor_view(A, cs->na, cs->a_shape), tb = tensor_view(B, cs->nb, cs->b_shape);
+        Tensor tc = tensor_view(C, cs->nc, cs->c_shape);
+
+        // Permuted copies, then one matmul_ex per batch
+        Telemetry tel, tel_copies;
+        telemetry_start(&tel_copies, num_threads);
+        Tensor pa = tensor_permute(&ta, cs->a_perm), pb = tensor_permute(&tb, cs->b_perm);
+        tensor_copy(&pa, Ap);
+        tensor_copy(&pb, Bp);
+        for (int b = 0; b < cs->batch; b++) {
+            matmul_ex(&Ap[(size_t)b * cs->M * cs->K], DTYPE_F32, &Bp[(size_t)b * cs->K * cs->N], DTYPE_F32,
+                      &R[(size_t)b * cs->M * cs->N], cs->M, cs->N, cs->K, NULL, num_threads);
+        }
+        double copies = telemetry_stop(&tel_copies);
+
+        telemetry_start(&tel, num_threads);
+        if (einsum(cs->spec, &ta, &tb, &tc, num_threads) != 0) return 1;
+        double elapsed = telemetry_stop(&tel);
+
+        double worst = 0.0;
+        for (size_t i = 0; i < c_len; i++) {
+            double err = C[i] - R[i];
+            if (err < 0) err = -err;
+            if (!(err <= worst)) worst = err;
+        }
+        double flops = 2.0 * cs->batch * cs->M * cs->N * cs->K;
+        printf("%-14s copies + matmul_ex %.6f seconds, einsum %.6f seconds (%.2f GFLOPS, %.2fx), max abs error %.2e\n",
+               cs->spec, copies, elapsed, flops / (elapsed * 1e9), copies / elapsed, worst);
+        // Per batch GEMM shape, the spec in the kernel name
+        char kernel[64];
+        snprintf(kernel, sizeof(kernel), "einsum %s", cs->spec);
+        bench_record(&tel, kernel, cs->M, cs->N, cs->K, "f32", num_threads, elapsed, flops);
+        snprintf(kernel, sizeof(kernel), "einsum_copies %s", cs->spec);
+        bench_record(&tel_copies, kernel, cs->M, cs->N, cs->K, "f32", num_threads, copies, flops);
+
+        free_matrix(A, a_len * sizeof(float));
+        free_matrix(Ap, a_len * sizeof(float));
+        free_matrix(B, b_len * sizeof(float));
+        free_matrix(Bp, b_len * sizeof(float));
+        free_matrix(C, c_len * sizeof(float));
+        free_matrix(R, c_len * sizeof(float));
+    }
+    return 0;
+}
@@ -0,0 +1,569 @@
+/*
+GEMM service: one daemon owns the cores and the pre-packed weights, local processes submit C = A W
+
+- the daemon maps a shared job ring (O5_GEMMD, default /o5_gemmd), and packs every weight once at startup
+- each client creates its own shared arena for operands, so A and C are never copied through the ring:
+  a job names the client's arena and the offsets of A and C in it, the daemon reads A and writes C in place
+- the dispatcher always takes the oldest pending job, then coalesces other pending jobs on the same weight
+  (up to GEMMD_MAX_ROWS rows in total) into one taller GEMM: their A rows are gathered, one
+  sgemm_compute_packed_ex runs on all the daemon's threads, C rows are scattered back
+- FIFO order with a bounded batch keeps any job's wait to the batches ahead of it
+- clients may die at any point: the ring lock is robust (a lock held by a dead client is recovered), and the
+  dispatcher frees the slots of dead clients every GEMMD_REAP_SECONDS, so they cannot wedge or drain the ring
+
+bench runs clients against a daemon, then the same load with every client running its own matmul_ex
+threads (the oversubscribed setup this replaces), and prints throughput and latency percentiles for both.
+
+Usage: gcc gemmd.c -O3 -mavx2 -mfma -mf16c -lpthread
+       ./a.out serve threads W0.mat [W1.mat ...]      weights are K x N, f32 / f16 / bf16
+       ./a.out bench W.mat [clients [jobs [rows]]]    against a running daemon, weight 0 must be W.mat
+*/
+
+#define O5_NO_MAIN
+#include "o5.c"
+#include <signal.h>
+#include <errno.h>
+#include <sys/wait.h>
+
+#define GEMMD_MAGIC 0x444d4547 // "GEMD"
+#define GEMMD_SLOTS 64
+#define GEMMD_MAX_WEIGHTS 16
+#define GEMMD_MAX_ROWS 512 // rows per coalesced batch
+#define GEMMD_MAPS 64      // client arenas the daemon keeps mapped
+#define GEMMD_NAME 64
+#define GEMMD_REAP_SECONDS 0.1 // how often the dispatcher looks for slots of dead clients
+
+// Slot states
+#define SLOT_FREE 0
+#define SLOT_SUBMITTED 1
+#define SLOT_RUNNING 2
+#define SLOT_DONE 3
+
+typedef struct {
+    int state;
+    int status;              // 0, or -1 for a bad job
+    uint64_t seq;            // submission order
+    int client;              // arena /<ring name>.<client>
+    pid_t owner;             // submitting process
+    size_t arena_bytes;
+    int weight;
+    int M;
+    size_t a_off, c_off;     // bytes into the arena, A is M x K and C is M x N, both f32 row-major
+    pthread_cond_t done;
+} GemmJob;
+
+typedef struct {
+    uint32_t magic;
+    pid_t daemon;
+    int weights;
+    int K[GEMMD_MAX_WEIGHTS], N[GEMMD_MAX_WEIGHTS];
+    int next_client;
+    uint64_t next_seq;
+    pthread_mutex_t lock;
+    pthread_cond_t submitted;  // daemon waits for jobs
+    pthread_cond_t freed;      // clients wait for a free slot
+    GemmJob slots[GEMMD_SLOTS];
+} GemmRing;
+
+const char *ring_name() {
+    const char *env = getenv("O5_GEMMD");
+    return env && *env ? env : "/o5_gemmd";
+}
+
+// Lock the ring. A client that died holding the lock leaves it EOWNERDEAD: every update under the lock is
+// complete before a slot's state changes, so the ring is consistent as it stands.
+static void ring_recover(GemmRing *ring, int rc) {
+    if (rc == EOWNERDEAD) pthread_mutex_consistent(&ring->lock);
+}
+
+static void ring_lock(GemmRing *ring) {
+    ring_recover(ring, pthread_mutex_lock(&ring->lock));
+}
+
+// Timed wait on one of the ring's conditions, ETIMEDOUT or 0
+static int ring_wait(GemmRing *ring, pthread_cond_t *cond, const struct timespec *ts) {
+    int rc = pthread_cond_timedwait(cond, &ring->lock, ts);
+    ring_recover(ring, rc);
+    return rc == ETIMEDOUT ? ETIMEDOUT : 0;
+}
+
+// ---- client ----
+
+typedef struct {
+    GemmRing *ring;
+    int id;
+    char name[GEMMD_NAME + 16];
+    char *arena;
+    size_t arena_bytes;
+} GemmClient;
+
+// Attach to the daemon with an operand arena of arena_bytes. NULL when no daemon is running.
+GemmClient *gemmd_connect(size_t arena_bytes) {
+    int fd = shm_open(ring_name(), O_RDWR, 0);
+    if (fd < 0) {
+        fprintf(stderr, "No GEMM daemon at %s\n", ring_name());
+        return NULL;
+    }
+    GemmRing *ring = (GemmRing *)mmap(NULL, sizeof(GemmRing), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (ring == MAP_FAILED || ring->magic != GEMMD_MAGIC) {
+        fprintf(stderr, "%s is not a GEMM daemon ring\n", ring_name());
+        return NULL;
+    }
+
+    GemmClient *c = (GemmClient *)calloc(1, sizeof(GemmClient));
+    if (!c) {
+        fprintf(stderr, "Failed to allocate client\n");
+        exit(1);
+    }
+    c->ring = ring;
+    ring_lock(ring);
+    c->id = ring->next_client++;
+    pthread_mutex_unlock(&ring->lock);
+    snprintf(c->name, sizeof(c->name), "%s.%d", ring_name(), c->id);
+
+    fd = shm_open(c->name, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0 || ftruncate(fd, arena_bytes) != 0) {
+        perror(c->name);
+        return NULL;
+    }
+    c->arena = (char *)mmap(NULL, arena_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (c->arena == MAP_FAILED) {
+        perror(c->name);
+        return NULL;
+    }
+    c->arena_bytes = arena_bytes;
+    return c;
+}
+
+// Operand memory shared with the daemon: A and C passed to gemmd_sgemm must live here
+void *gemmd_arena(GemmClient *c) {
+    return c->arena;
+}
+
+// C = A W[weight], A is M x K and C is M x N (the weight's dims). Blocks until done, 0 or -1.
+int gemmd_sgemm(GemmClient *c, int weight, const float *A, float *C, int M) {
+    GemmRing *ring = c->ring;
+    ring_lock(ring);
+    GemmJob *job = NULL;
+    while (!job) {
+        for (int i = 0; i < GEMMD_SLOTS && !job; i++) {
+            if (ring->slots[i].state == SLOT_FREE) job = &ring->slots[i];
+        }
+        if (!job) {
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_sec += 1;
+            if (ring_wait(ring, &ring->freed, &ts) == ETIMEDOUT && kill(ring->daemon, 0) != 0) {
+                pthread_mutex_unlock(&ring->lock);
+                fprintf(stderr, "GEMM daemon is gone\n");
+                return -1;
+            }
+        }
+    }
+    job->seq = ring->next_seq++;
+    job->client = c->id;
+    job->owner = getpid();
+    job->arena_bytes = c->arena_bytes;
+    job->weight = weight;
+    job->M = M;
+    job->a_off = (const char *)A - c->arena;
+    job->c_off = (char *)C - c->arena;
+    job->state = SLOT_SUBMITTED;
+    pthread_cond_signal(&ring->submitted);
+
+    // A daemon that went away leaves the job pending forever, so check on it every second
+    while (job->state != SLOT_DONE) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += 1;
+        if (ring_wait(ring, &job->done, &ts) == ETIMEDOUT && kill(ring->daemon, 0) != 0) {
+            pthread_mutex_unlock(&ring->lock);
+            fprintf(stderr, "GEMM daemon is gone\n");
+            return -1;
+        }
+    }
+    int status = job->status;
+    job->state = SLOT_FREE;
+    pthread_cond_signal(&ring->freed);
+    pthread_mutex_unlock(&ring->lock);
+    return status;
+}
+
+void gemmd_close(GemmClient *c) {
+    munmap(c->arena, c->arena_bytes);
+    shm_unlink(c->name);
+    munmap(c->ring, sizeof(GemmRing));
+    free(c);
+}
+
+// ---- daemon ----
+
+typedef struct {
+    int client;
+    char *map;
+    size_t bytes;
+} ArenaMap;
+
+static volatile sig_atomic_t stop;
+
+static void on_signal(int sig) {
+    (void)sig;
+    stop = 1;
+}
+
+// Client arena, mapped on first use and kept (round robin eviction). NULL if it cannot be mapped.
+static char *client_arena(ArenaMap *maps, int *next, int client, size_t bytes) {
+    for (int i = 0; i < GEMMD_MAPS; i++) {
+        if (maps[i].map && maps[i].client == client && maps[i].bytes == bytes) return maps[i].map;
+    }
+    char name[GEMMD_NAME + 16];
+    snprintf(name, sizeof(name), "%s.%d", ring_name(), client);
+    int fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0) return NULL;
+    struct stat st;
+    char *map = fstat(fd, &st) == 0 && (size_t)st.st_size >= bytes
+                    ? (char *)mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : (char *)MAP_FAILED;
+    close(fd);
+    if (map == MAP_FAILED) return NULL;
+
+    ArenaMap *m = &maps[*next];
+    *next = (*next + 1) % GEMMD_MAPS;
+    if (m->map) munmap(m->map, m->bytes);
+    m->client = client;
+    m->map = map;
+    m->bytes = bytes;
+    return map;
+}
+
+// Free the slots of clients that exited without collecting their job: submitted jobs are dropped, finished
+// ones released. A running job is left to finish and is freed on a later pass. Called with the ring locked.
+static void reap_dead_clients(GemmRing *ring) {
+    int freed = 0;
+    for (int i = 0; i < GEMMD_SLOTS; i++) {
+        GemmJob *j = &ring->slots[i];
+        if ((j->state != SLOT_SUBMITTED && j->state != SLOT_DONE) || kill(j->owner, 0) == 0 || errno != ESRCH) continue;
+        char name[GEMMD_NAME + 16];
+        snprintf(name, sizeof(name), "%s.%d", ring_name(), j->client);
+        shm_unlink(name); // the arena it never got to unlink
+        j->state = SLOT_FREE;
+        freed++;
+    }
+    if (freed) pthread_cond_broadcast(&ring->freed);
+}
+
+static int serve(int num_threads, int weights, char *paths[]) {
+    PackedB *W[GEMMD_MAX_WEIGHTS];
+    int fd = shm_open(ring_name(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0 || ftruncate(fd, sizeof(GemmRing)) != 0) {
+        perror(ring_name());
+        if (errno == EEXIST) fprintf(stderr, "Another daemon is serving, or a stale ring is left in /dev/shm%s\n", ring_name());
+        return 1;
+    }
+    GemmRing *ring = (GemmRing *)mmap(NULL, sizeof(GemmRing), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (ring == MAP_FAILED) {
+        perror(ring_name());
+        shm_unlink(ring_name());
+        return 1;
+    }
+
+    for (int w = 0; w < weights; w++) {
+        Matrix *m = mat_load(paths[w]);
+        if (!m || m->dtype > MAT_BF16) {
+            fprintf(stderr, "%s: need an f32 / f16 / bf16 matrix\n", paths[w]);
+            shm_unlink(ring_name());
+            return 1;
+        }
+        void *copy;
+        W[w] = sgemm_pack_b_ex(mat_dense(m, &copy), m->dtype, m->rows, m->cols);
+        ring->K[w] = m->rows;
+        ring->N[w] = m->cols;
+        free(copy);
+        mat_free(m);
+        printf("Weight %d: %s, %d x %d\n", w, paths[w], ring->K[w], ring->N[w]);
+    }
+
+    pthread_mutexattr_t ma;
+    pthread_condattr_t ca;
+    pthread_mutexattr_init(&ma);
+    pthread_mutexattr_setpshared(&ma, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&ma, PTHREAD_MUTEX_ROBUST);
+    pthread_condattr_init(&ca);
+    pthread_condattr_setpshared(&ca, PTHREAD_PROCESS_SHARED);
+    pthread_mutex_init(&ring->lock, &ma);
+    pthread_cond_init(&ring->submitted, &ca);
+    pthread_cond_init(&ring->freed, &ca);
+    for (int i = 0; i < GEMMD_SLOTS; i++) pthread_cond_init(&ring->slots[i].done, &ca);
+    ring->weights = weights;
+    ring->daemon = getpid();
+    __atomic_store_n(&ring->magic, GEMMD_MAGIC, __ATOMIC_RELEASE);
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    printf("Serving on %s with %d threads, Ctrl-C to stop\n", ring_name(), num_threads);
+    fflush(stdout);
+
+    ArenaMap maps[GEMMD_MAPS] = {{0}};
+    int next_map = 0;
+    int max_k = 0, max_n = 0;
+    for (int w = 0; w < weights; w++) {
+        if (ring->K[w] > max_k) max_k = ring->K[w];
+        if (ring->N[w] > max_n) max_n = ring->N[w];
+    }
+    // Staging for coalesced batches
+    size_t stage_a_bytes = (size_t)GEMMD_MAX_ROWS * max_k * sizeof(float);
+    size_t stage_c_bytes = (size_t)GEMMD_MAX_ROWS * max_n * sizeof(float);
+    float *stage_a = (float *)alloc_pages(stage_a_bytes);
+    float *stage_c = (float *)alloc_pages(stage_c_bytes);
+    long jobs = 0, batches = 0, rows = 0;
+    double next_reap = 0.0;
+
+    while (!stop) {
+        GemmJob *batch[GEMMD_SLOTS];
+        int count = 0;
+
+        ring_lock(ring);
+        if (get_time() >= next_reap) {
+            reap_dead_clients(ring);
+            next_reap = get_time() + GEMMD_REAP_SECONDS;
+        }
+        GemmJob *oldest = NULL;
+        for (int i = 0; i < GEMMD_SLOTS; i++) {
+            GemmJob *j = &ring->slots[i];
+            if (j->state == SLOT_SUBMITTED && (!oldest || j->seq < oldest->seq)) oldest = j;
+        }
+        if (!oldest) {
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_nsec += 100000000; // wake up to check for a signal
+            if (ts.tv_nsec >= 1000000000) {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000;
+            }
+            ring_wait(ring, &ring->submitted, &ts);
+            pthread_mutex_unlock(&ring->lock);
+            continue;
+        }
+
+        // Oldest first, then the rest of the same weight in submission order while they fit
+        batch[count++] = oldest;
+        int batch_rows = oldest->M;
+        for (;;) {
+            GemmJob *next = NULL;
+            for (int i = 0; i < GEMMD_SLOTS; i++) {
+                GemmJob *j = &ring->slots[i];
+                if (j->state == SLOT_SUBMITTED && j != oldest && j->weight == oldest->weight &&
+                    j->seq > batch[count - 1]->seq && batch_rows + j->M <= GEMMD_MAX_ROWS && (!next || j->seq < next->seq)) next = j;
+            }
+            if (!next) break;
+            batch[count++] = next;
+            batch_rows += next->M;
+        }
+        for (int i = 0; i < count; i++) batch[i]->state = SLOT_RUNNING;
+        pthread_mutex_unlock(&ring->lock);
+
+        // Validate and resolve every job's operands
+        int w = oldest->weight;
+        float *A[GEMMD_SLOTS], *C[GEMMD_SLOTS];
+        int good = 0;
+        for (int i = 0; i < count; i++) {
+            GemmJob *j = batch[i];
+            char *arena = NULL;
+            if (w >= 0 && w < weights && j->M > 0) arena = client_arena(maps, &next_map, j->client, j->arena_bytes);
+            size_t a_bytes = arena ? (size_t)j->M * ring->K[w] * sizeof(float) : 0;
+            size_t c_bytes = arena ? (size_t)j->M * ring->N[w] * sizeof(float) : 0;
+            j->status = arena && j->a_off % sizeof(float) == 0 && j->c_off % sizeof(float) == 0 &&
+                        j->a_off <= j->arena_bytes && a_bytes <= j->arena_bytes - j->a_off &&
+                        j->c_off <= j->arena_bytes && c_bytes <= j->arena_bytes - j->c_off ? 0 : -1;
+            if (j->status == 0) {
+                A[good] = (float *)(arena + j->a_off);
+                C[good] = (float *)(arena + j->c_off);
+                batch[good++] = j;
+            } else {
+                ring_lock(ring);
+                j->state = SLOT_DONE;
+                pthread_cond_signal(&j->done);
+                pthread_mutex_unlock(&ring->lock);
+            }
+        }
+        count = good;
+
+        if (count == 1) {
+            // Zero copy: straight from the client's A into its C
+            memset(C[0], 0, (size_t)batch[0]->M * ring->N[w] * sizeof(float));
+            sgemm_compute_packed_ex(A[0], DTYPE_F32, W[w], C[0], batch[0]->M, NULL, num_threads);
+        } else if (count > 1) {
+            size_t a_row = (size_t)ring->K[w] * sizeof(float), c_row = (size_t)ring->N[w] * sizeof(float);
+            int r = 0;
+            for (int i = 0; i < count; i++) {
+                memcpy((char *)stage_a + r * a_row, A[i], batch[i]->M * a_row);
+                r += batch[i]->M;
+            }
+            memset(stage_c, 0, r * c_row);
+            sgemm_compute_packed_ex(stage_a, DTYPE_F32, W[w], stage_c, r, NULL, num_threads);
+            r = 0;
+            for (int i = 0; i < count; i++) {
+                memcpy(C[i], (char *)stage_c + r * c_row, batch[i]->M * c_row);
+                r += batch[i]->M;
+            }
+        }
+
+        ring_lock(ring);
+        for (int i = 0; i < count; i++) {
+            batch[i]->state = SLOT_DONE;
+            pthread_cond_signal(&batch[i]->done);
+            rows += batch[i]->M;
+        }
+        pthread_mutex_unlock(&ring->lock);
+        jobs += count;
+        batches += count > 0;
+    }
+
+    printf("\nServed %ld jobs in %ld batches (%.1f jobs, %.1f rows per batch)\n", jobs, batches,
+           batches ? (double)jobs / batches : 0.0, batches ? (double)rows / batches : 0.0);
+    shm_unlink(ring_name());
+    for (int i = 0; i < GEMMD_MAPS; i++) {
+        if (maps[i].map) munmap(maps[i].map, maps[i].bytes);
+    }
+    free_pages(stage_a, stage_a_bytes);
+    free_pages(stage_c, stage_c_bytes);
+    for (int w = 0; w < weights; w++) sgemm_packed_free(W[w]);
+    munmap(ring, sizeof(GemmRing));
+    return 0;
+}
+
+// ---- bench ----
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+// clients processes, each submitting jobs of rows x K, through the daemon or each with its own threads.
+// Latencies land in lat[client * jobs + job], shared with the children. Returns wall time, < 0 on failure.
+static double run_clients(const Matrix *W, const float *Wf, int clients, int jobs, int rows, int daemon, double *lat, double *err) {
+    int K = W->rows, N = W->cols;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    double start_time = get_time();
+    for (int c = 0; c < clients; c++) {
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("fork");
+            return -1;
+        }
+        if (pid > 0) continue;
+        // Independent processes left to the scheduler: pinned, all of them would start from the same first CPU
+        if (!daemon) setenv("O5_PIN", "none", 1);
+
+        size_t a_bytes = (size_t)rows * K * sizeof(float), c_bytes = (size_t)rows * N * sizeof(float);
+        GemmClient *client = daemon ? gemmd_connect(a_bytes + c_bytes) : NULL;
+        if (daemon && !client) _exit(1);
+        float *A = daemon ? (float *)gemmd_arena(client) : (float *)alloc_pages(a_bytes + c_bytes);
+        float *C = A + (size_t)rows * K;
+        for (int j = 0; j < jobs; j++) {
+            init_uniform(DTYPE_F32, A, rows, K, -1.0f, 1.0f, (uint64_t)c * jobs + j, 1);
+            double t0 = get_time();
+            if (daemon) {
+                if (gemmd_sgemm(client, 0, A, C, rows) != 0) _exit(1);
+            } else {
+                memset(C, 0, c_bytes);
+                // What each process does on its own: as many threads as the box has cores
+                matmul_ex(A, DTYPE_F32, Wf, DTYPE_F32, C, rows, N, K, NULL, cpus < MAX_THREADS ? (int)cpus : MAX_THREADS);
+            }
+            lat[(size_t)c * jobs + j] = get_time() - t0;
+
+            // Spot check a row against a scalar dot product
+            if (j == 0) {
+                double worst = 0.0;
+                for (int n = 0; n < N; n++) {
+                    double ref = 0.0;
+                    for (int k = 0; k < K; k++) ref += (double)A[k] * Wf[(size_t)k * N + n];
+                    double e = C[n] - ref;
+                    if (e < 0) e = -e;
+                    if (e > worst) worst = e;
+                }
+                err[c] = worst;
+            }
+        }
+        if (daemon) gemmd_close(client);
+        else free_pages(A, a_bytes + c_bytes);
+        _exit(0);
+    }
+
+    int failed = 0;
+    for (int c = 0; c < clients; c++) {
+        int status;
+        if (wait(&status) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) failed = 1;
+    }
+    return failed ? -1.0 : get_time() - start_time;
+}
+
+static int bench(const char *path, int clients, int jobs, int rows) {
+    Matrix *W = mat_load(path);
+    if (!W || W->dtype != MAT_F32) {
+        fprintf(stderr, "%s: bench needs an f32 weight\n", path);
+        return 1;
+    }
+    void *copy;
+    const float *Wf = (const float *)mat_dense(W, &copy);
+
+    size_t n = (size_t)clients * jobs;
+    size_t shared_bytes = (n + clients) * sizeof(double);
+    double *lat = (double *)mmap(NULL, shared_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (lat == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+    double *err = lat + n;
+    double flops = 2.0 * n * rows * W->rows * W->cols;
+    printf("%d clients x %d jobs of %d x %d x %d\n", clients, jobs, rows, W->cols, W->rows);
+
+    for (int daemon = 1; daemon >= 0; daemon--) {
+        // Clients and daemon between them keep the whole box busy, so every CPU is sampled
+        Telemetry tel;
+        telemetry_start(&tel, MAX_CPUS);
+        double elapsed = run_clients(W, Wf, clients, jobs, rows, daemon, lat, err);
+        telemetry_stop(&tel);
+        if (elapsed < 0) {
+            fprintf(stderr, "A client failed\n");
+            return 1;
+        }
+        double worst = 0.0;
+        for (int c = 0; c < clients; c++) {
+            if (err[c] > worst) worst = err[c];
+        }
+        qsort(lat, n, sizeof(double), cmp_double);
+        printf("%-16s %.3f s, %.2f GFLOPS, latency p50 %.3f ms, p99 %.3f ms, max %.3f ms, max abs error %.2e\n",
+               daemon ? "daemon:" : "own threads:", elapsed, flops / (elapsed * 1e9), lat[n / 2] * 1e3,
+               lat[n * 99 / 100] * 1e3, lat[n - 1] * 1e3, worst);
+        // One job's shape, with the client count in the threads field
+        bench_record(&tel, daemon ? "gemmd_daemon" : "gemmd_own_threads", rows, W->rows, W->cols, "f32", clients,
+                     elapsed, flops);
+    }
+
+    munmap(lat, shared_bytes);
+    free(copy);
+    mat_free(W);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc >= 4 && strcmp(argv[1], "serve") == 0) {
+        int num_threads = atoi(argv[2]);
+        if (num_threads > 0 && num_threads <= MAX_THREADS && argc - 3 <= GEMMD_MAX_WEIGHTS) {
+            return serve(num_threads, argc - 3, &argv[3]);
+        }
+    } else if (argc >= 3 && strcmp(argv[1], "bench") == 0) {
+        int clients = argc >= 4 ? atoi(argv[3]) : 8;
+        int jobs = argc >= 5 ? atoi(argv[4]) : 100;
+        int rows = argc >= 6 ? atoi(argv[5]) : 16;
+        if (clients > 0 && jobs > 0 && rows > 0) return bench(argv[2], clients, jobs, rows);
+    }
+
+    fprintf(stderr, "Usage: %s serve threads (1..%d) W0.mat [W1.mat ...]   (up to %d weights)\n", argv[0], MAX_THREADS,
+            GEMMD_MAX_WEIGHTS);
+    fprintf(stderr, "       %s bench W.mat [clients [jobs [rows]]]\n", argv[0]);
+    return 1;
+}
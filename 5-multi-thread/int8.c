@@ -0,0 +1,453 @@
+/*
+u8 x s8 GEMM with int32 accumulation, alongside the fp32 o5 pipeline
+
+- A is uint8 (activations), B is int8 (weights), C accumulates in int32
+- K is packed in groups of 4, so one 32-bit lane holds 4 consecutive k of a row / column
+- AVX2: vpmaddubsw (u8 * s8 pairs -> s16) then vpmaddwd by ones (-> s32)
+  the s16 step saturates if a[k] * b[k] + a[k+1] * b[k+1] leaves s16, same caveat as every AVX2 int8 BLAS.
+  keep weights in 7 bits (-64..63) on AVX2-only parts
+- AVX-VNNI / AVX512-VNNI: vpdpbusd does all of it in one instruction with no saturation, picked at runtime
+- per-row scale / zero point for A, per-column scale / zero point for B,
+  applied on store: s32 out, fp32 dequantize, or u8 requantize
+- same MC / NC / thread split as o5, 4 x 16 register tiles
+
+Usage: gcc int8.c -O3 -mavx2 -mfma ; ./a.out [M N K [threads]]
+O5_NO_VNNI=1 forces the AVX2 path
+*/
+
+#define O5_NO_MAIN
+#include "o5.c"
+
+// Micro-kernel size: 4 rows x 16 columns = 8 int32 accumulators
+#define I8_MR 4
+#define I8_NR 16
+
+// Packing buffer size. int8 panels are 4x smaller than fp32, so KC goes up by 4x for the same footprint.
+#define I8_MC 128
+#define I8_KC 1024
+#define I8_NC 1024
+
+// Output of matmul_u8s8
+#define I8_OUT_S32 0 // exact zero point corrected int32
+#define I8_OUT_F32 1 // dequantized: a_scale[i] * b_scale[j] * s32
+#define I8_OUT_U8 2  // requantized: clamp(round(f32 / out_scale) + out_zero, 0, 255)
+
+// real A[i][k] = a_scale[i] * (A[i][k] - a_zero[i]), real B[k][j] = b_scale[j] * (B[k][j] - b_zero[j]).
+// NULL arrays mean scale 1 / zero point 0.
+typedef struct {
+    const float *a_scale;
+    const int32_t *a_zero;
+    const float *b_scale;
+    const int32_t *b_zero;
+    int out;
+    float out_scale;
+    int32_t out_zero;
+} QuantParams;
+
+typedef struct {
+    const uint8_t *A;
+    const int8_t *B;
+    void *C;
+    int M, N, K;
+    int start_row;
+    int end_row;
+    const QuantParams *q;
+    const int32_t *b_sum; // column sums of B, only when A has zero points
+    int vnni;
+} I8ThreadArgs;
+
+// 0: AVX2, 1: AVX-VNNI (VEX), 2: AVX512-VNNI (EVEX, needs VL for ymm)
+int i8_detect_vnni(void) {
+    const char *off = getenv("O5_NO_VNNI");
+    if (off && *off && *off != '0') return 0;
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avxvnni")) return 1;
+    if (__builtin_cpu_supports("avx512vnni") && __builtin_cpu_supports("avx512vl")) return 2;
+    return 0;
+}
+
+// c += 4-way u8 * s8 dot products per 32-bit lane. vpdpbusd goes through inline asm so the
+// same source builds with plain -mavx2 and the choice is made at runtime.
+FORCE_INLINE __m256i dot4(const int vnni, __m256i c, __m256i a, __m256i b, __m256i ones) {
+    if (vnni == 1) {
+        __asm__("%{vex%} vpdpbusd %2, %1, %0" : "+x"(c) : "x"(a), "x"(b));
+        return c;
+    }
+    if (vnni == 2) {
+        __asm__("vpdpbusd %2, %1, %0" : "+v"(c) : "v"(a), "v"(b));
+        return c;
+    }
+    return _mm256_add_epi32(c, _mm256_madd_epi16(_mm256_maddubs_epi16(a, b), ones));
+}
+
+// Function to pack A into I8_MR-row micro-panels: for each group of 4 k, 4 bytes per row, zero padded
+FORCE_INLINE void pack_a_u8(int M, int K, const uint8_t *A, int lda, uint8_t *A_to) {
+    int KG = (K + 3) / 4;
+    for (int i = 0; i < M; i += I8_MR) {
+        int m = (i + I8_MR <= M) ? I8_MR : M - i;
+        for (int g = 0; g < KG; ++g) {
+            for (int r = 0; r < I8_MR; ++r) {
+                for (int t = 0; t < 4; ++t) {
+                    int k = g * 4 + t;
+                    A_to[(g * I8_MR + r) * 4 + t] = (r < m && k < K) ? A[(size_t)(i + r) * lda + k] : 0;
+                }
+            }
+        }
+        A_to += I8_MR * KG * 4;
+    }
+}
+
+// Function to pack B into I8_NR-column micro-panels: for each group of 4 k, 4 bytes per column, zero padded
+FORCE_INLINE void pack_b_s8(int K, int N, const int8_t *B, int ldb, int8_t *B_to) {
+    int KG = (K + 3) / 4;
+    for (int j = 0; j < N; j += I8_NR) {
+        int n = (j + I8_NR <= N) ? I8_NR : N - j;
+        for (int g = 0; g < KG; ++g) {
+            int kt = (g * 4 + 4 <= K) ? 4 : K - g * 4;
+            if (n == I8_NR && kt == 4) {
+                // Interleave 4 rows of 16 bytes into 16 columns of 4 bytes
+                __m128i r0 = _mm_loadu_si128((const __m128i *)&B[(size_t)(g * 4 + 0) * ldb + j]);
+                __m128i r1 = _mm_loadu_si128((const __m128i *)&B[(size_t)(g * 4 + 1) * ldb + j]);
+                __m128i r2 = _mm_loadu_si128((const __m128i *)&B[(size_t)(g * 4 + 2) * ldb + j]);
+                __m128i r3 = _mm_loadu_si128((const __m128i *)&B[(size_t)(g * 4 + 3) * ldb + j]);
+                __m128i t01lo = _mm_unpacklo_epi8(r0, r1), t01hi = _mm_unpackhi_epi8(r0, r1);
+                __m128i t23lo = _mm_unpacklo_epi8(r2, r3), t23hi = _mm_unpackhi_epi8(r2, r3);
+                __m128i *dst = (__m128i *)&B_to[g * I8_NR * 4];
+                _mm_store_si128(dst + 0, _mm_unpacklo_epi16(t01lo, t23lo));
+                _mm_store_si128(dst + 1, _mm_unpackhi_epi16(t01lo, t23lo));
+                _mm_store_si128(dst + 2, _mm_unpacklo_epi16(t01hi, t23hi));
+                _mm_store_si128(dst + 3, _mm_unpackhi_epi16(t01hi, t23hi));
+                continue;
+            }
+            for (int c = 0; c < I8_NR; ++c) {
+                for (int t = 0; t < 4; ++t) {
+                    B_to[(g * I8_NR + c) * 4 + t] = (c < n && t < kt) ? B[(size_t)(g * 4 + t) * ldb + j + c] : 0;
+                }
+            }
+        }
+        B_to += I8_NR * KG * 4;
+    }
+}
+
+// Micro-kernel: tile[I8_MR x I8_NR] = A panel * B panel over KG groups of 4
+FORCE_INLINE void i8_micro_kernel(const int vnni, int KG, const uint8_t *A, const int8_t *B, int32_t *tile) {
+    __m256i c0[I8_MR], c1[I8_MR];
+    __m256i ones = _mm256_set1_epi16(1);
+    for (int i = 0; i < I8_MR; ++i) {
+        c0[i] = _mm256_setzero_si256();
+        c1[i] = _mm256_setzero_si256();
+    }
+
+    for (int g = 0; g < KG; ++g) {
+        __m256i b0 = _mm256_load_si256((const __m256i *)&B[g * I8_NR * 4]);
+        __m256i b1 = _mm256_load_si256((const __m256i *)&B[g * I8_NR * 4 + 32]);
+        for (int i = 0; i < I8_MR; ++i) {
+            int32_t a4;
+            memcpy(&a4, &A[(g * I8_MR + i) * 4], sizeof(a4));
+            __m256i a = _mm256_set1_epi32(a4);
+            c0[i] = dot4(vnni, c0[i], a, b0, ones);
+            c1[i] = dot4(vnni, c1[i], a, b1, ones);
+        }
+    }
+
+    for (int i = 0; i < I8_MR; ++i) {
+        _mm256_store_si256((__m256i *)&tile[i * I8_NR], c0[i]);
+        _mm256_store_si256((__m256i *)&tile[i * I8_NR + 8], c1[i]);
+    }
+}
+
+// Zero point correction and output conversion for 8 consecutive columns of row i
+FORCE_INLINE void i8_store8(const I8ThreadArgs *args, int i, int j, __m256i acc, int32_t a_sum) {
+    const QuantParams *q = args->q;
+    int K = args->K;
+    int32_t za = q->a_zero ? q->a_zero[i] : 0;
+    if (za) {
+        // - za * sum_k B[k][j]
+        __m256i bs = _mm256_loadu_si256((const __m256i *)&args->b_sum[j]);
+        acc = _mm256_sub_epi32(acc, _mm256_mullo_epi32(_mm256_set1_epi32(za), bs));
+    }
+    if (q->b_zero) {
+        // - zb * sum_k A[i][k] + K * za * zb
+        __m256i zb = _mm256_loadu_si256((const __m256i *)&q->b_zero[j]);
+        acc = _mm256_sub_epi32(acc, _mm256_mullo_epi32(zb, _mm256_set1_epi32(a_sum - K * za)));
+    }
+
+    size_t idx = (size_t)i * args->N + j;
+    if (q->out == I8_OUT_S32) {
+        _mm256_storeu_si256((__m256i *)&((int32_t *)args->C)[idx], acc);
+        return;
+    }
+
+    __m256 f = _mm256_cvtepi32_ps(acc);
+    if (q->a_scale) f = _mm256_mul_ps(f, _mm256_set1_ps(q->a_scale[i]));
+    if (q->b_scale) f = _mm256_mul_ps(f, _mm256_loadu_ps(&q->b_scale[j]));
+    if (q->out == I8_OUT_F32) {
+        _mm256_storeu_ps(&((float *)args->C)[idx], f);
+        return;
+    }
+
+    // Requantize: round to nearest even, saturate to u8
+    f = _mm256_mul_ps(f, _mm256_set1_ps(1.0f / q->out_scale));
+    __m256i v = _mm256_add_epi32(_mm256_cvtps_epi32(f), _mm256_set1_epi32(q->out_zero));
+    __m128i w = _mm_packs_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+    _mm_storel_epi64((__m128i *)&((uint8_t *)args->C)[idx], _mm_packus_epi16(w, w));
+}
+
+// Scalar version of i8_store8 for edge columns
+FORCE_INLINE void i8_store1(const I8ThreadArgs *args, int i, int j, int32_t acc, int32_t a_sum) {
+    const QuantParams *q = args->q;
+    int32_t za = q->a_zero ? q->a_zero[i] : 0;
+    if (za) acc -= za * args->b_sum[j];
+    if (q->b_zero) acc -= q->b_zero[j] * (a_sum - args->K * za);
+
+    size_t idx = (size_t)i * args->N + j;
+    if (q->out == I8_OUT_S32) {
+        ((int32_t *)args->C)[idx] = acc;
+        return;
+    }
+
+    float f = (float)acc;
+    if (q->a_scale) f *= q->a_scale[i];
+    if (q->b_scale) f *= q->b_scale[j];
+    if (q->out == I8_OUT_F32) {
+        ((float *)args->C)[idx] = f;
+        return;
+    }
+
+    int v = _mm_cvtss_si32(_mm_set_ss(f * (1.0f / q->out_scale))) + q->out_zero;
+    ((uint8_t *)args->C)[idx] = v < 0 ? 0 : v > 255 ? 255 : (uint8_t)v;
+}
+
+// Fold a finished tile into the running partial sums; on the last KC block, apply the epilogue instead
+FORCE_INLINE void i8_finish_tile(const I8ThreadArgs *args, int32_t *tile, int m, int n, int first, int last,
+                                 int32_t *partial, int ldp, int row, int col, const int32_t *a_sum) {
+    for (int r = 0; r < m; ++r) {
+        int32_t *t = &tile[r * I8_NR];
+        int32_t *p = &partial[r * ldp];
+        int c = 0;
+        for (; c + 8 <= n; c += 8) {
+            __m256i acc = _mm256_load_si256((const __m256i *)&t[c]);
+            if (!first) acc = _mm256_add_epi32(acc, _mm256_loadu_si256((const __m256i *)&p[c]));
+            if (last) {
+                i8_store8(args, row + r, col + c, acc, a_sum[r]);
+            } else {
+                _mm256_storeu_si256((__m256i *)&p[c], acc);
+            }
+        }
+        for (; c < n; ++c) {
+            int32_t acc = t[c] + (first ? 0 : p[c]);
+            if (last) {
+                i8_store1(args, row + r, col + c, acc, a_sum[r]);
+            } else {
+                p[c] = acc;
+            }
+        }
+    }
+}
+
+FORCE_INLINE void i8_thread_body(const int vnni, I8ThreadArgs *args) {
+    const uint8_t *A = args->A;
+    const int8_t *B = args->B;
+    int N = args->N, K = args->K;
+    int start_row = args->start_row;
+    int end_row = args->end_row;
+
+    // Packed buffers and int32 partial sums across KC blocks, private to each thread, in one mapping.
+    // At full size (1.6 MB) that is a single 2 MB page, small problems only map what they use.
+    size_t mc = end_row - start_row < I8_MC ? (end_row - start_row + I8_MR - 1) / I8_MR * I8_MR : I8_MC;
+    size_t kc = K < I8_KC ? (K + 3) / 4 * 4 : I8_KC;
+    size_t nc = N < I8_NC ? (N + I8_NR - 1) / I8_NR * I8_NR : I8_NC;
+    size_t ac_bytes = (mc * kc + 63) / 64 * 64, bc_bytes = (kc * nc + 63) / 64 * 64;
+    size_t buf_bytes = ac_bytes + bc_bytes + (K > I8_KC ? mc * I8_NC * sizeof(int32_t) : 0);
+    uint8_t *Ac = (uint8_t *)alloc_pages(buf_bytes >= HUGE_PAGE / 2 ? HUGE_PAGE : buf_bytes);
+    int8_t *Bc = (int8_t *)(Ac + ac_bytes);
+    int32_t *partial = (int32_t *)(Bc + bc_bytes);
+    int32_t *a_sum = (int32_t *)calloc(end_row - start_row + I8_MR, sizeof(int32_t));
+    if (!a_sum) {
+        fprintf(stderr, "Failed to allocate packing buffers\n");
+        exit(1);
+    }
+
+    // Row sums of A, only needed to correct for B's zero points
+    if (args->q->b_zero) {
+        for (int i = start_row; i < end_row; ++i) {
+            int32_t s = 0;
+            for (int k = 0; k < K; ++k) s += A[(size_t)i * K + k];
+            a_sum[i - start_row] = s;
+        }
+    }
+
+    int32_t ALIGN tile[I8_MR * I8_NR];
+
+    for (int i = start_row; i < end_row; i += I8_MC) {
+        int mb = (i + I8_MC <= end_row) ? I8_MC : end_row - i;
+
+        for (int j = 0; j < N; j += I8_NC) {
+            int nb = (j + I8_NC <= N) ? I8_NC : N - j;
+
+            for (int k = 0; k < K; k += I8_KC) {
+                int kb = (k + I8_KC <= K) ? I8_KC : K - k;
+                int KG = (kb + 3) / 4;
+                int first = k == 0;
+                int last = k + kb >= K;
+
+                // Pack
+                pack_a_u8(mb, kb, &A[(size_t)i * K + k], K, Ac);
+                pack_b_s8(kb, nb, &B[(size_t)k * N + j], N, Bc);
+
+                // Compute
+                for (int ii = 0; ii < mb; ii += I8_MR) {
+                    int m = (ii + I8_MR <= mb) ? I8_MR : mb - ii;
+                    for (int jj = 0; jj < nb; jj += I8_NR) {
+                        int n = (jj + I8_NR <= nb) ? I8_NR : nb - jj;
+                        i8_micro_kernel(vnni, KG, &Ac[ii * KG * 4], &Bc[jj * KG * 4], tile);
+                        i8_finish_tile(args, tile, m, n, first, last, &partial[ii * I8_NC + jj], I8_NC,
+                                       i + ii, j + jj, &a_sum[i + ii - start_row]);
+                    }
+                }
+            }
+        }
+    }
+
+    free_pages(Ac, buf_bytes >= HUGE_PAGE / 2 ? HUGE_PAGE : buf_bytes);
+    free(a_sum);
+}
+
+void *i8_thread(void *arg) {
+    I8ThreadArgs *args = (I8ThreadArgs *)arg;
+    switch (args->vnni) {
+        case 1: i8_thread_body(1, args); break;
+        case 2: i8_thread_body(2, args); break;
+        default: i8_thread_body(0, args); break;
+    }
+    return NULL;
+}
+
+// C[M x N] = dequant(A[M x K] B[K x N]), C is int32, float or uint8 depending on q->out
+void matmul_u8s8(const uint8_t *A, const int8_t *B, void *C, int M, int N, int K, const QuantParams *q, int num_threads) {
+    static int vnni = -1;
+    if (vnni < 0) vnni = i8_detect_vnni();
+
+    I8ThreadArgs thread_args[MAX_THREADS];
+    QuantParams plain = {0};
+    if (!q) q = &plain;
+    if (num_threads > MAX_THREADS) num_threads = MAX_THREADS;
+
+    // Column sums of B, only needed to correct for A's zero points
+    int32_t *b_sum = NULL;
+    if (q->a_zero) {
+        b_sum = (int32_t *)calloc(N, sizeof(int32_t));
+        if (!b_sum) {
+            fprintf(stderr, "Memory allocation failed\n");
+            exit(1);
+        }
+        for (int k = 0; k < K; ++k) {
+            for (int j = 0; j < N; ++j) b_sum[j] += B[(size_t)k * N + j];
+        }
+    }
+
+    for (int i = 0; i < num_threads; i++) {
+        thread_args[i].A = A;
+        thread_args[i].B = B;
+        thread_args[i].C = C;
+        thread_args[i].M = M;
+        thread_args[i].N = N;
+        thread_args[i].K = K;
+        // Split on I8_MR boundaries so only the last thread sees a short tile
+        thread_args[i].start_row = (int)((long)(M / I8_MR) * i / num_threads) * I8_MR;
+        thread_args[i].end_row = (i == num_threads - 1) ? M : (int)((long)(M / I8_MR) * (i + 1) / num_threads) * I8_MR;
+        thread_args[i].q = q;
+        thread_args[i].b_sum = b_sum;
+        thread_args[i].vnni = vnni;
+    }
+
+    launch_threads(i8_thread, thread_args, sizeof(I8ThreadArgs), num_threads);
+
+    free(b_sum);
+}
+
+// Random u8 activations or 7-bit s8 weights, with an fp32 copy for the comparison run
+typedef struct {
+    uint8_t *u8;
+    int8_t *s8;
+    float *f;
+    int cols;
+    uint64_t seed;
+} I8FillArgs;
+
+static void i8_fill_rows(void *ctx, int start_row, int end_row) {
+    I8FillArgs *a = (I8FillArgs *)ctx;
+    for (size_t i = (size_t)start_row * a->cols; i < (size_t)end_row * a->cols; i++) {
+        uint64_t r = rng_u64(a->seed, i);
+        if (a->u8) a->f[i] = a->u8[i] = r & 0xff;
+        else a->f[i] = a->s8[i] = (int8_t)((r & 0x7f) - 64);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    int M = 4096, N = 4096, K = 4096;
+    int num_threads = 24; // Adjust based on your CPU
+    if (argc >= 4) {
+        M = atoi(argv[1]);
+        N = atoi(argv[2]);
+        K = atoi(argv[3]);
+    }
+    if (argc >= 5) {
+        num_threads = atoi(argv[4]);
+    }
+    if (M <= 0 || N <= 0 || K <= 0 || num_threads <= 0 || num_threads > MAX_THREADS) {
+        fprintf(stderr, "Usage: %s [M N K [threads (1..%d)]]\n", argv[0], MAX_THREADS);
+        return 1;
+    }
+
+    uint8_t *A = (uint8_t *)alloc_matrix((size_t)M * K + 32);
+    int8_t *B = (int8_t *)alloc_matrix((size_t)K * N + 32);
+    int32_t *C = (int32_t *)alloc_matrix((size_t)M * N * sizeof(int32_t));
+    float *Af = (float *)alloc_matrix((size_t)M * K * sizeof(float));
+    float *Bf = (float *)alloc_matrix((size_t)K * N * sizeof(float));
+    float *Cf = (float *)alloc_matrix((size_t)M * N * sizeof(float));
+
+    // Full range activations, 7-bit weights so the AVX2 path never saturates.
+    // Generated in parallel so row bands are first touched by their workers.
+    uint64_t seed = time(NULL);
+    I8FillArgs fa = {A, NULL, Af, K, seed}, fb = {NULL, B, Bf, N, seed + 1};
+    parallel_rows(M, num_threads, i8_fill_rows, &fa);
+    parallel_rows(K, num_threads, i8_fill_rows, &fb);
+    init_zero(Cf, M, (size_t)N * sizeof(float), num_threads);
+
+    Telemetry tel_i8, tel_f32;
+    telemetry_start(&tel_i8, num_threads);
+    matmul_u8s8(A, B, C, M, N, K, NULL, num_threads);
+    double i8_time = telemetry_stop(&tel_i8);
+
+    telemetry_start(&tel_f32, num_threads);
+    matmul(Af, Bf, Cf, M, N, K, num_threads);
+    double f32_time = telemetry_stop(&tel_f32);
+
+    // Spot check a few rows against a scalar reference
+    int errors = 0;
+    for (int i = 0; i < M; i += (M > 8 ? M / 8 : 1)) {
+        for (int j = 0; j < N; j++) {
+            int32_t ref = 0;
+            for (int k = 0; k < K; k++) ref += (int32_t)A[(size_t)i * K + k] * B[(size_t)k * N + j];
+            if (ref != C[(size_t)i * N + j]) errors++;
+        }
+    }
+
+    double ops = 2.0 * M * N * K;
+    printf("Kernel: %s\n", i8_detect_vnni() == 1 ? "AVX-VNNI" : i8_detect_vnni() == 2 ? "AVX512-VNNI" : "AVX2");
+    printf("int8 time: %.6f seconds, %.2f GOPS\n", i8_time, ops / (i8_time * 1e9));
+    bench_record(&tel_i8, "matmul_u8s8", M, N, K, "u8s8", num_threads, i8_time, ops);
+    printf("fp32 time: %.6f seconds, %.2f GFLOPS\n", f32_time, ops / (f32_time * 1e9));
+    bench_record(&tel_f32, "matmul", M, N, K, "f32", num_threads, f32_time, ops);
+    printf("Speedup: %.2fx\n", f32_time / i8_time);
+    printf("Mismatches: %d\n", errors);
+
+    free_matrix(A, (size_t)M * K + 32);
+    free_matrix(B, (size_t)K * N + 32);
+    free_matrix(C, (size_t)M * N * sizeof(int32_t));
+    free_matrix(Af, (size_t)M * K * sizeof(float));
+    free_matrix(Bf, (size_t)K * N * sizeof(float));
+    free_matrix(Cf, (size_t)M * N * sizeof(float));
+    return errors != 0;
+}
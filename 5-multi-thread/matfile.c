@@ -0,0 +1,139 @@
+/*
+Matrix file tool (format in matfile.h)
+
+- gen: random matrix straight into a mapped file, filled in parallel from o5's counter-based RNG
+- info: print the header
+- diff: compare two files element by element, exit status 1 when they differ by more than tol
+
+Usage: gcc matfile.c -O3 -mavx2 -mfma -mf16c
+       ./a.out gen rows cols [f32|f16|bf16|f64|s8|u8|s32] out.mat [seed] [col]
+       ./a.out info file.mat
+       ./a.out diff a.mat b.mat [tol]
+"col" writes the matrix column-major.
+*/
+
+#define O5_NO_MAIN
+#include "o5.c"
+
+// Element (i, j) of any dtype, widened to double
+double mat_get(const Matrix *m, long i, long j) {
+    long at = m->layout == MAT_ROW_MAJOR ? i * m->ld + j : j * m->ld + i;
+    switch (m->dtype) {
+        case MAT_F32: return ((const float *)m->data)[at];
+        case MAT_F16: return half_to_float(((const uint16_t *)m->data)[at]);
+        case MAT_BF16: return bf16_to_float(((const uint16_t *)m->data)[at]);
+        case MAT_F64: return ((const double *)m->data)[at];
+        case MAT_S8: return ((const int8_t *)m->data)[at];
+        case MAT_U8: return ((const uint8_t *)m->data)[at];
+        default: return ((const int32_t *)m->data)[at];
+    }
+}
+
+typedef struct {
+    Matrix *m;
+    long inner; // elements per row (or column, when col-major)
+    uint64_t seed;
+} GenArgs;
+
+// Element i only depends on (seed, i) through o5's counter-based RNG, so bands fill in parallel
+static void gen_rows(void *ctx, int start, int end) {
+    GenArgs *g = (GenArgs *)ctx;
+    for (size_t i = (size_t)start * g->inner; i < (size_t)end * g->inner; i++) {
+        uint64_t r = rng_u64(g->seed, i);
+        float f = (float)(r >> 40) / (float)(1 << 24); // [0, 1)
+        void *data = g->m->data;
+        switch (g->m->dtype) {
+            case MAT_F32: ((float *)data)[i] = f; break;
+            case MAT_F16: ((uint16_t *)data)[i] = float_to_half(f); break;
+            case MAT_BF16: ((uint16_t *)data)[i] = float_to_bf16(f); break;
+            case MAT_F64: ((double *)data)[i] = (double)(r >> 11) / (double)(1ULL << 53); break;
+            case MAT_S8: ((int8_t *)data)[i] = (int8_t)((r >> 56) & 0x7f) - 64; break; // 7 bits, see int8.c
+            case MAT_U8: ((uint8_t *)data)[i] = (uint8_t)(r >> 56); break;
+            default: ((int32_t *)data)[i] = (int32_t)(r >> 54) - 512; break;
+        }
+    }
+}
+
+static int gen(int rows, int cols, int dtype, const char *path, uint64_t seed, int col_major) {
+    Matrix *m = mat_create(path, rows, cols, dtype);
+    if (!m) return 1;
+    if (col_major) {
+        // Same element count, only the header changes
+        MatHeader *h = (MatHeader *)m->map;
+        h->layout = MAT_COL_MAJOR;
+        h->ld = rows;
+    }
+
+    GenArgs g = {m, col_major ? rows : cols, seed};
+    int threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    parallel_rows(col_major ? cols : rows, threads > 0 ? threads : 1, gen_rows, &g);
+    mat_free(m);
+    return 0;
+}
+
+static int info(const char *path) {
+    Matrix *m = mat_load(path);
+    if (!m) return 1;
+    MatHeader h;
+    memcpy(&h, m->map, sizeof(h));
+    printf("%s: %d x %d %s, %s, ld %ld, data at %llu (align %llu), %zu bytes\n", path, m->rows, m->cols,
+           mat_dtype_names[m->dtype], m->layout == MAT_ROW_MAJOR ? "row-major" : "col-major", m->ld,
+           (unsigned long long)h.data_offset, (unsigned long long)h.align, m->map_size);
+    mat_free(m);
+    return 0;
+}
+
+static int diff(const char *a_path, const char *b_path, double tol) {
+    Matrix *a = mat_load(a_path);
+    Matrix *b = mat_load(b_path);
+    if (!a || !b) return 2;
+    if (a->rows != b->rows || a->cols != b->cols) {
+        fprintf(stderr, "Shapes differ: %d x %d vs %d x %d\n", a->rows, a->cols, b->rows, b->cols);
+        return 2;
+    }
+
+    double max_abs = 0.0, max_rel = 0.0;
+    long bad = 0, worst_i = 0, worst_j = 0;
+    for (long i = 0; i < a->rows; i++) {
+        for (long j = 0; j < a->cols; j++) {
+            double x = mat_get(a, i, j), y = mat_get(b, i, j);
+            double err = x > y ? x - y : y - x;
+            double mag = x < 0 ? -x : x;
+            double rel = err / (mag > 1e-30 ? mag : 1.0);
+            if (err > max_abs) max_abs = err;
+            if (rel > max_rel) {
+                max_rel = rel;
+                worst_i = i;
+                worst_j = j;
+            }
+            if (rel > tol || err != err) bad++;
+        }
+    }
+
+    printf("Max abs error: %.3e\n", max_abs);
+    printf("Max relative error: %.3e at (%ld, %ld)\n", max_rel, worst_i, worst_j);
+    printf("Over tolerance %.1e: %ld of %ld\n", tol, bad, (long)a->rows * a->cols);
+    mat_free(a);
+    mat_free(b);
+    return bad ? 1 : 0;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc >= 6 && strcmp(argv[1], "gen") == 0) {
+        int rows = atoi(argv[2]), cols = atoi(argv[3]);
+        int dtype = mat_dtype_from_name(argv[4]);
+        if (rows > 0 && cols > 0 && dtype >= 0) {
+            uint64_t seed = argc >= 7 ? strtoull(argv[6], NULL, 10) : 0;
+            return gen(rows, cols, dtype, argv[5], seed, argc >= 8 && strcmp(argv[7], "col") == 0);
+        }
+    } else if (argc == 3 && strcmp(argv[1], "info") == 0) {
+        return info(argv[2]);
+    } else if (argc >= 4 && strcmp(argv[1], "diff") == 0) {
+        return diff(argv[2], argv[3], argc >= 5 ? atof(argv[4]) : 1e-3);
+    }
+
+    fprintf(stderr, "Usage: %s gen rows cols [f32|f16|bf16|f64|s8|u8|s32] out.mat [seed] [col]\n", argv[0]);
+    fprintf(stderr, "       %s info file.mat\n", argv[0]);
+    fprintf(stderr, "       %s diff a.mat b.mat [tol]\n", argv[0]);
+    return 2;
+}
@@ -0,0 +1,235 @@
+/*
+Binary matrix files
+
+A page sized header followed by the elements, so the data starts page aligned and a file can be
+mmapped and used in place: loading a multi-GB input costs nothing until the pages are touched,
+and an output created with mat_create is written straight into the page cache.
+
+Header (little endian, fixed width fields):
+    magic "MAT1", version, dtype, layout, rows, cols, ld (elements between rows / columns),
+    align (byte alignment of the data), data_offset (bytes from the start of the file)
+
+Shared by o5.c (harness and library), ooc.c and the matfile.c tool.
+*/
+
+#ifndef MATFILE_H
+#define MATFILE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define MAT_MAGIC 0x3154414d // "MAT1"
+#define MAT_VERSION 1
+#define MAT_HEADER 4096
+
+// Element types, the first three use the same codes as o5's DTYPE_*
+#define MAT_F32 0
+#define MAT_F16 1
+#define MAT_BF16 2
+#define MAT_F64 3
+#define MAT_S8 4
+#define MAT_U8 5
+#define MAT_S32 6
+
+// Layouts
+#define MAT_ROW_MAJOR 0 // element (i, j) at i * ld + j
+#define MAT_COL_MAJOR 1 // element (i, j) at j * ld + i
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t dtype;
+    uint32_t layout;
+    uint64_t rows, cols, ld;
+    uint64_t align;
+    uint64_t data_offset;
+} MatHeader;
+
+typedef struct {
+    int rows, cols;
+    long ld;
+    int dtype, layout;
+    void *data;      // first element, inside the mapping
+    void *map;       // whole file mapping
+    size_t map_size;
+} Matrix;
+
+static const char *mat_dtype_names[] = {"f32", "f16", "bf16", "f64", "s8", "u8", "s32"};
+
+static inline int mat_dtype_size(int dtype) {
+    switch (dtype) {
+        case MAT_F32: case MAT_S32: return 4;
+        case MAT_F16: case MAT_BF16: return 2;
+        case MAT_F64: return 8;
+        case MAT_S8: case MAT_U8: return 1;
+        default: return 0;
+    }
+}
+
+// dtype code for a name like "f32", -1 if unknown
+static inline int mat_dtype_from_name(const char *name) {
+    for (int i = 0; i < (int)(sizeof(mat_dtype_names) / sizeof(mat_dtype_names[0])); i++) {
+        if (strcmp(name, mat_dtype_names[i]) == 0) return i;
+    }
+    return -1;
+}
+
+// Bytes of element data, from the first element to the end of the last row / column
+static inline size_t mat_data_bytes(const MatHeader *h) {
+    uint64_t outer = h->layout == MAT_ROW_MAJOR ? h->rows : h->cols;
+    uint64_t inner = h->layout == MAT_ROW_MAJOR ? h->cols : h->rows;
+    if (outer == 0) return 0;
+    return ((outer - 1) * h->ld + inner) * mat_dtype_size(h->dtype);
+}
+
+// Header fields are untrusted: ld and the extent are bounded by the file before anything is multiplied, so
+// mat_data_bytes cannot wrap
+static inline int mat_check_header(const MatHeader *h, size_t file_size) {
+    uint64_t outer = h->layout == MAT_ROW_MAJOR ? h->rows : h->cols;
+    uint64_t inner = h->layout == MAT_ROW_MAJOR ? h->cols : h->rows;
+    uint64_t elem = mat_dtype_size(h->dtype);
+    if (h->magic != MAT_MAGIC || h->version != MAT_VERSION || elem == 0) return 0;
+    if (h->layout != MAT_ROW_MAJOR && h->layout != MAT_COL_MAJOR) return 0;
+    if (h->rows > INT32_MAX || h->cols > INT32_MAX) return 0;
+    if (h->data_offset < sizeof(MatHeader) || h->data_offset > file_size) return 0;
+    if (h->align == 0 || h->align % elem != 0 || h->data_offset % h->align != 0) return 0;
+
+    uint64_t avail = (file_size - h->data_offset) / elem; // elements after the data offset
+    if (h->ld < inner) return 0;
+    if (outer == 0) return 1;
+    if (h->ld > avail) return 0;
+    if (h->ld == 0) return 1; // inner == 0 too
+    return outer - 1 <= (avail - inner) / h->ld && mat_data_bytes(h) <= file_size - h->data_offset;
+}
+
+static inline Matrix *mat_map(const char *path, int writable) {
+    int fd = open(path, writable ? O_RDWR : O_RDONLY);
+    if (fd < 0) {
+        perror(path);
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(MatHeader)) {
+        fprintf(stderr, "%s: not a matrix file\n", path);
+        close(fd);
+        return NULL;
+    }
+    void *map = mmap(NULL, st.st_size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror(path);
+        return NULL;
+    }
+
+    MatHeader h;
+    memcpy(&h, map, sizeof(h));
+    if (!mat_check_header(&h, st.st_size)) {
+        fprintf(stderr, "%s: bad matrix header\n", path);
+        munmap(map, st.st_size);
+        return NULL;
+    }
+
+    Matrix *m = (Matrix *)calloc(1, sizeof(Matrix));
+    if (!m) {
+        fprintf(stderr, "Failed to allocate matrix\n");
+        exit(1);
+    }
+    m->rows = (int)h.rows;
+    m->cols = (int)h.cols;
+    m->ld = (long)h.ld;
+    m->dtype = (int)h.dtype;
+    m->layout = (int)h.layout;
+    m->data = (char *)map + h.data_offset;
+    m->map = map;
+    m->map_size = st.st_size;
+    return m;
+}
+
+// Map a matrix file read only, zero copy. NULL (with a message) on error.
+static inline Matrix *mat_load(const char *path) {
+    return mat_map(path, 0);
+}
+
+// Create a dense row-major rows x cols file and map it writable, for outputs.
+// Whatever is stored through m->data lands in the file, no separate save needed.
+static inline Matrix *mat_create(const char *path, int rows, int cols, int dtype) {
+    MatHeader h = {MAT_MAGIC, MAT_VERSION, (uint32_t)dtype, MAT_ROW_MAJOR, (uint64_t)rows, (uint64_t)cols, (uint64_t)cols,
+                   MAT_HEADER, MAT_HEADER};
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror(path);
+        return NULL;
+    }
+    if (ftruncate(fd, (off_t)(MAT_HEADER + mat_data_bytes(&h))) != 0 || pwrite(fd, &h, sizeof(h), 0) != (ssize_t)sizeof(h)) {
+        perror(path);
+        close(fd);
+        return NULL;
+    }
+    close(fd);
+    return mat_map(path, 1);
+}
+
+// Write rows x cols elements (row-major, row length ld in memory) as a dense row-major file
+static inline int mat_save(const char *path, int rows, int cols, long ld, int dtype, const void *data) {
+    MatHeader h = {MAT_MAGIC, MAT_VERSION, (uint32_t)dtype, MAT_ROW_MAJOR, (uint64_t)rows, (uint64_t)cols, (uint64_t)cols,
+                   MAT_HEADER, MAT_HEADER};
+    char header[MAT_HEADER] = {0};
+    memcpy(header, &h, sizeof(h));
+    size_t row_bytes = (size_t)cols * mat_dtype_size(dtype);
+
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+    int ok = fwrite(header, 1, MAT_HEADER, f) == MAT_HEADER;
+    for (int i = 0; ok && i < rows; i++) {
+        ok = fwrite((const char *)data + (size_t)i * ld * mat_dtype_size(dtype), 1, row_bytes, f) == row_bytes;
+    }
+    if (!ok) {
+        perror(path);
+        fclose(f);
+        return -1;
+    }
+    return fclose(f) == 0 ? 0 : -1;
+}
+
+static inline void mat_free(Matrix *m) {
+    if (!m) return;
+    munmap(m->map, m->map_size);
+    free(m);
+}
+
+// Dense row-major view of m (ld == cols). The mapping itself when it already is one, otherwise
+// a repacked copy returned through *copy for the caller to free.
+static inline const void *mat_dense(const Matrix *m, void **copy) {
+    *copy = NULL;
+    if (m->layout == MAT_ROW_MAJOR && m->ld == m->cols) return m->data;
+
+    int es = mat_dtype_size(m->dtype);
+    char *dst = (char *)malloc((size_t)m->rows * m->cols * es);
+    if (!dst) {
+        fprintf(stderr, "Failed to allocate matrix copy\n");
+        exit(1);
+    }
+    const char *src = (const char *)m->data;
+    for (long i = 0; i < m->rows; i++) {
+        if (m->layout == MAT_ROW_MAJOR) {
+            memcpy(&dst[i * m->cols * es], &src[i * m->ld * es], (size_t)m->cols * es);
+            continue;
+        }
+        for (long j = 0; j < m->cols; j++) {
+            memcpy(&dst[(i * m->cols + j) * es], &src[(j * m->ld + i) * es], es);
+        }
+    }
+    *copy = dst;
+    return dst;
+}
+
+#endif
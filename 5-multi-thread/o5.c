@@ -7,20 +7,60 @@ Tricks used
 - microkenrels for loop unrolling
 - data packing cache friendliness
 - tuned precisely for 5900X
+- dedicated GEMV / small-M kernels for skinny (memory bound) shapes
+- pre-packed B reused across calls (sgemm_pack_b -> sgemm_compute_packed)
+- fp16 / bf16 inputs widened to fp32 while packing, fp32 accumulate
+- fused epilogue (scale, bias, ReLU / GELU, residual) applied at the micro-kernel's last store
+- operands initialized in parallel, each row band first touched by the thread that computes it
+- operands and packing buffers on 2 MB pages (hugetlbfs, else THP), 4 KB fallback
+- beta = 0 into a C larger than L3: finished rows leave through non-temporal stores, no read for ownership
+- async submission (sgemm_async), and an optional pack helper per worker that packs the next panels during compute
+- clock, package power and throttling sampled during the measured runs and reported next to the result
+- workers pinned by topology (sysfs: SMT siblings, L3 domains); each L3 domain packs one B block shared by its
+  workers and owns its share of the columns, so B is packed once per CCD, not once per thread
+- split-K for small M x N with long K: private partial Cs, reduced in a fixed pairwise order (bitwise reproducible)
 
 Perf: 625 GFLOPS
 - hot zones are still on adds, so will need to be unrolled more
+
+Usage: ./a.out [M N K [threads [f32|f16|bf16 [all|plain]]]]   (plain: only the matmul_ex run, for sweeps)
+       ./a.out file A.mat B.mat [C.mat [threads]]   (matfile.h inputs, C written as f32)
+fp16 conversion uses F16C when built with -mf16c, a scalar fallback otherwise
+O5_NUMA=interleave spreads A, B and C over all NUMA nodes instead of first touch
+O5_PAGES=4k keeps everything on 4 KB pages, for comparison
+O5_STREAM=0 / O5_STREAM=1 forces sgemm_ex's streaming stores off / on, whatever the size of C
+O5_PIPELINE=1 gives every worker a pack helper thread (worth it with idle SMT siblings, not on a full box)
+O5_SPLITK=n runs the blocked path as n K slices (1 = off), instead of only for small M x N with long K
+O5_RESULTS=path appends each measured result as a JSON line (default results.jsonl, none = off), see results.py
+O5_PIN=cores (default) pins worker i to one hardware thread per core first, round robin over the L3 domains,
+       then the SMT siblings; O5_PIN=compact fills both threads of a core first; O5_PIN=none leaves threads unpinned.
+       Placement covers the process's affinity mask: processes sharing a box need their own (placement_slice)
+O5_THREADS_PER_CORE=1 keeps off the SMT siblings (and caps the worker count at the core count), 2 allows them
 */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // sched_getaffinity, pthread_attr_setaffinity_np
+#endif
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
+#include <sched.h>
 #include <pthread.h>
 #include <sys/time.h>
 #include <immintrin.h>
 #include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include "matfile.h"
 
 #define MAX_THREADS 24
+#define MAX_CPUS 256
+#define MAX_DOMAINS 16
 #define CACHE_LINE_SIZE 64
 #define L1_CACHE_SIZE (32 * 1024)
 #define L2_CACHE_SIZE (512 * 1024)
@@ -29,84 +69,426 @@ Perf: 625 GFLOPS
 // Micro-kernel size
 #define MR 8
 #define NR 8
+// With MR == NR the panels of pack_a and pack_b have the same layout, so packing B^T with pack_a (or A^T with
+// pack_b) gives the other operand's panels: einsum.c and blas3.c get transposed operands at no cost
+_Static_assert(MR == NR, "transposed packing reuses pack_a / pack_b for each other");
 
 // Packing buffer size
 #define MC 128
 #define KC 256
 #define NC 4096
 
+// Skinny shapes: N == 1 goes to the GEMV kernel, M <= SMALL_M to the small-M kernel.
+// Both are memory bound, so packing has nothing to amortize against.
+#define GEMV_MAX_N 1
+#define SMALL_M 4
+#define SMALL_M_KB 16 // rows of B streamed side by side per sweep in the small-M kernel
+#define SKINNY_MIN_WORK 64 // rows (GEMV) or columns (small-M) per thread before adding another
+
+// Streaming stores (sgemm_ex with beta = 0): a C this large is evicted before it is read again anyway,
+// so each thread accumulates row band x NC_STREAM chunks in an L2 scratch and streams finished rows out
+#define STREAM_MIN_BYTES (2 * L3_CACHE_SIZE)
+#define NC_STREAM 256
+// Split-K (blocked path, C with fewer MC x NC blocks than threads): each K slice at least this long, so the
+// reduction stays small next to the GEMM, and all partial Cs together at most SPLITK_MAX_BYTES
+#define SPLITK_MIN_K (8 * KC)
+#define SPLITK_MAX_BYTES (64 << 20)
+
+// Software prefetch distances, 0 disables. Guarded so a sweep can override them with -D. The values are untuned
+// placeholders: no measurement yet shows them beating any other setting (see tune_prefetch.py).
+#ifndef PF_A_DIST
+#define PF_A_DIST 16 // k steps ahead in the packed A stream (MR floats per step), runs on into the next micro-panel
+#endif
+#ifndef PF_B_DIST
+#define PF_B_DIST 16 // k steps ahead in the packed B stream (NR floats per step)
+#endif
+#ifndef PF_C
+#define PF_C 1 // touch the C tile before the k loop so the accumulate-store does not miss
+#endif
+#ifndef PF_PACK_DIST
+#define PF_PACK_DIST 8 // source rows (pack_b) or columns in cache lines (pack_a) ahead while packing
+#endif
+
+// Operand allocation: 2 MB pages when available (O5_PAGES=4k to disable), placed by first touch
+// or interleaved over NUMA nodes (O5_NUMA)
+#define SMALL_PAGE 4096
+#define HUGE_PAGE (2 * 1024 * 1024)
+#define PLACE_FIRST_TOUCH 0
+#define PLACE_INTERLEAVE 1
+
 // Align to cache line size
 #define ALIGN __attribute__((aligned(CACHE_LINE_SIZE)))
 
+// Element types for A and B. C and all of the arithmetic stay fp32, 16-bit inputs are
+// widened on the way into the packed panels (or while streaming, in the skinny kernels).
+#define DTYPE_F32 0
+#define DTYPE_F16 1  // IEEE half
+#define DTYPE_BF16 2 // top 16 bits of an fp32
+
 typedef struct {
-    float *A;
-    float *B;
+    const void *A;
+    const void *B;
     float *C;
     int M, N, K;
+    int a_dtype, b_dtype;
     int start_row;
     int end_row;
+    int start_col;
+    int end_col;
+    const float *Bp; // pre-packed B (see sgemm_pack_b), NULL to pack on the fly
+    int Np;          // N rounded up to NR, row length of a KC block in Bp
+    const struct Epilogue *ep; // NULL for a plain C += A B
 } ThreadArgs;
 
+// Pre-packed B: every KC x NC block laid out exactly as pack_b leaves it in Bc,
+// so steady state calls go straight to compute
+typedef struct {
+    int K, N;
+    int Np;
+    float *data;
+    size_t bytes;
+    void *map;       // non-NULL when data lives in an mmapped file
+    size_t map_size;
+} PackedB;
+
 // Portable way to force inline
 #define FORCE_INLINE __attribute__((always_inline)) inline
 
-// Packed buffers
-static float ALIGN Ac[MC * KC];
-static float ALIGN Bc[KC * NC];
+FORCE_INLINE size_t dtype_size(int dtype) {
+    return dtype == DTYPE_F32 ? sizeof(float) : sizeof(uint16_t);
+}
+
+FORCE_INLINE const void *elem_at(int dtype, const void *p, size_t i) {
+    return (const char *)p + i * dtype_size(dtype);
+}
+
+FORCE_INLINE float half_to_float(uint16_t h) {
+#ifdef __F16C__
+    return _cvtsh_ss(h);
+#else
+    uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+    uint32_t exp = (h >> 10) & 0x1f;
+    uint32_t mant = h & 0x3ff;
+    uint32_t bits;
+    if (exp == 0) {
+        // zero or subnormal: mant * 2^-24
+        float f = (float)mant * (1.0f / 16777216.0f);
+        memcpy(&bits, &f, sizeof(bits));
+        bits |= sign;
+    } else if (exp == 0x1f) {
+        bits = sign | 0x7f800000 | (mant << 13);
+    } else {
+        bits = sign | ((exp + 112) << 23) | (mant << 13);
+    }
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+#endif
+}
+
+FORCE_INLINE float bf16_to_float(uint16_t h) {
+    uint32_t bits = (uint32_t)h << 16;
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+// Round to nearest even
+uint16_t float_to_half(float f) {
+#ifdef __F16C__
+    return _cvtss_sh(f, _MM_FROUND_TO_NEAREST_INT);
+#else
+    uint32_t x;
+    memcpy(&x, &f, sizeof(x));
+    uint32_t sign = (x >> 16) & 0x8000;
+    uint32_t ax = x & 0x7fffffff;
+    if (ax > 0x7f800000) return sign | 0x7e00;   // nan
+    if (ax >= 0x477ff000) return sign | 0x7c00;  // rounds to inf
+    if (ax < 0x38800000) {
+        // half subnormal: round(f * 2^24), the magic add rounds to nearest even
+        float v;
+        memcpy(&v, &ax, sizeof(v));
+        v = (v * 16777216.0f + 8388608.0f) - 8388608.0f;
+        return sign | (uint16_t)v;
+    }
+    // rebias the exponent (127 -> 15) and round on the 13 dropped bits
+    return sign | ((ax - 0x38000000 + 0xfff + ((ax >> 13) & 1)) >> 13);
+#endif
+}
+
+uint16_t float_to_bf16(float f) {
+    uint32_t x;
+    memcpy(&x, &f, sizeof(x));
+    if ((x & 0x7fffffff) > 0x7f800000) return (x >> 16) | 0x40; // keep nan quiet
+    return (x + 0x7fff + ((x >> 16) & 1)) >> 16;
+}
+
+// One element of a dtype array as fp32. dtype is a compile time constant at every call site.
+FORCE_INLINE float load1(const int dtype, const void *p, size_t i) {
+    if (dtype == DTYPE_F16) return half_to_float(((const uint16_t *)p)[i]);
+    if (dtype == DTYPE_BF16) return bf16_to_float(((const uint16_t *)p)[i]);
+    return ((const float *)p)[i];
+}
+
+// Eight consecutive elements as fp32
+FORCE_INLINE __m256 load8(const int dtype, const void *p, size_t i) {
+    if (dtype == DTYPE_F16) {
+#ifdef __F16C__
+        return _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)((const uint16_t *)p + i)));
+#else
+        const uint16_t *h = (const uint16_t *)p + i;
+        return _mm256_setr_ps(half_to_float(h[0]), half_to_float(h[1]), half_to_float(h[2]), half_to_float(h[3]),
+                              half_to_float(h[4]), half_to_float(h[5]), half_to_float(h[6]), half_to_float(h[7]));
+#endif
+    }
+    if (dtype == DTYPE_BF16) {
+        __m256i w = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)((const uint16_t *)p + i)));
+        return _mm256_castsi256_ps(_mm256_slli_epi32(w, 16));
+    }
+    return _mm256_loadu_ps((const float *)p + i);
+}
+
+void convert_to_f32(int dtype, const void *src, float *dst, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        switch (dtype) {
+            case DTYPE_F16: dst[i] = load1(DTYPE_F16, src, i); break;
+            case DTYPE_BF16: dst[i] = load1(DTYPE_BF16, src, i); break;
+            default: dst[i] = load1(DTYPE_F32, src, i); break;
+        }
+    }
+}
+
+void convert_from_f32(int dtype, const float *src, void *dst, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        switch (dtype) {
+            case DTYPE_F16: ((uint16_t *)dst)[i] = float_to_half(src[i]); break;
+            case DTYPE_BF16: ((uint16_t *)dst)[i] = float_to_bf16(src[i]); break;
+            default: ((float *)dst)[i] = src[i]; break;
+        }
+    }
+}
 
-// Function to pack A
-FORCE_INLINE void pack_a(int K, const float *A, int lda, float *A_to) {
-    for (int i = 0; i < MR; ++i) {
-        for (int j = 0; j < K; ++j) {
-            A_to[i * K + j] = A[i * lda + j];
+// Function to pack A into MR-row micro-panels, k-major inside a panel, zero padded
+FORCE_INLINE void pack_a_t(const int dtype, int M, int K, const void *A, int lda, float *A_to) {
+    for (int i = 0; i < M; i += MR) {
+        int m = (i + MR <= M) ? MR : M - i;
+        for (int k = 0; k < K; ++k) {
+            // m row streams, one line each per 64 bytes of k
+            if (PF_PACK_DIST && k % (CACHE_LINE_SIZE / dtype_size(dtype)) == 0) {
+                for (int r = 0; r < m; ++r) {
+                    _mm_prefetch((const char *)elem_at(dtype, A, (size_t)(i + r) * lda + k) + PF_PACK_DIST * CACHE_LINE_SIZE, _MM_HINT_T0);
+                }
+            }
+            for (int r = 0; r < m; ++r) {
+                A_to[k * MR + r] = load1(dtype, A, (size_t)(i + r) * lda + k);
+            }
+            for (int r = m; r < MR; ++r) {
+                A_to[k * MR + r] = 0.0f;
+            }
         }
+        A_to += MR * K;
     }
 }
 
-// Function to pack B
-FORCE_INLINE void pack_b(int K, int N, const float *B, int ldb, float *B_to) {
-    for (int i = 0; i < K; ++i) {
-        for (int j = 0; j < NR; ++j) {
-            B_to[i * NR + j] = B[i * ldb + j];
+// Function to pack B into NR-column micro-panels, zero padded
+FORCE_INLINE void pack_b_t(const int dtype, int K, int N, const void *B, int ldb, float *B_to) {
+    for (int j = 0; j < N; j += NR) {
+        int n = (j + NR <= N) ? NR : N - j;
+        if (n == NR) {
+            for (int k = 0; k < K; ++k) {
+                // Walking down B crosses a page every row or so, which stops the hardware prefetcher
+                if (PF_PACK_DIST) _mm_prefetch((const char *)elem_at(dtype, B, (size_t)(k + PF_PACK_DIST) * ldb + j), _MM_HINT_T0);
+                _mm256_store_ps(&B_to[k * NR], load8(dtype, B, (size_t)k * ldb + j));
+            }
+        } else {
+            for (int k = 0; k < K; ++k) {
+                for (int c = 0; c < n; ++c) {
+                    B_to[k * NR + c] = load1(dtype, B, (size_t)k * ldb + j + c);
+                }
+                for (int c = n; c < NR; ++c) {
+                    B_to[k * NR + c] = 0.0f;
+                }
+            }
         }
+        B_to += NR * K;
+    }
+}
+
+void pack_a(int dtype, int M, int K, const void *A, int lda, float *A_to) {
+    switch (dtype) {
+        case DTYPE_F16: pack_a_t(DTYPE_F16, M, K, A, lda, A_to); break;
+        case DTYPE_BF16: pack_a_t(DTYPE_BF16, M, K, A, lda, A_to); break;
+        default: pack_a_t(DTYPE_F32, M, K, A, lda, A_to); break;
+    }
+}
+
+void pack_b(int dtype, int K, int N, const void *B, int ldb, float *B_to) {
+    switch (dtype) {
+        case DTYPE_F16: pack_b_t(DTYPE_F16, K, N, B, ldb, B_to); break;
+        case DTYPE_BF16: pack_b_t(DTYPE_BF16, K, N, B, ldb, B_to); break;
+        default: pack_b_t(DTYPE_F32, K, N, B, ldb, B_to); break;
     }
 }
 
-// Micro-kernel
-FORCE_INLINE void micro_kernel(int K, const float *A, const float *B, float *C, int ldc) {
+// Activations for the epilogue
+#define ACT_NONE 0
+#define ACT_RELU 1
+#define ACT_GELU 2 // tanh approximation
+
+// Applied to each C[i][j] when its last KC block is stored, while the tile is still in registers:
+// C = act(scale * C + bias[j] + row_bias[i]) + residual[i * ldr + j]
+typedef struct Epilogue {
+    float scale;           // 1 for none
+    const float *bias;     // per column, NULL for none
+    int act;
+    const float *residual; // M x ldr, NULL for none
+    int ldr;
+    const float *row_bias; // per row (channels of an NCHW convolution), NULL for none
+} Epilogue;
+
+// e^x, Cephes style: x = n ln2 + r, polynomial for e^r, 2^n through the exponent bits
+FORCE_INLINE __m256 exp256_ps(__m256 x) {
+    x = _mm256_min_ps(x, _mm256_set1_ps(88.3762626647949f));
+    x = _mm256_max_ps(x, _mm256_set1_ps(-88.3762626647949f));
+
+    __m256 fx = _mm256_floor_ps(_mm256_fmadd_ps(x, _mm256_set1_ps(1.44269504088896341f), _mm256_set1_ps(0.5f)));
+    x = _mm256_fnmadd_ps(fx, _mm256_set1_ps(0.693359375f), x);
+    x = _mm256_fnmadd_ps(fx, _mm256_set1_ps(-2.12194440e-4f), x);
+
+    __m256 y = _mm256_set1_ps(1.9875691500e-4f);
+    y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(1.3981999507e-3f));
+    y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(8.3334519073e-3f));
+    y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(4.1665795894e-2f));
+    y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(1.6666665459e-1f));
+    y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(5.0000001201e-1f));
+    y = _mm256_fmadd_ps(y, _mm256_mul_ps(x, x), _mm256_add_ps(x, _mm256_set1_ps(1.0f)));
+
+    __m256i n = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvttps_epi32(fx), _mm256_set1_epi32(127)), 23);
+    return _mm256_mul_ps(y, _mm256_castsi256_ps(n));
+}
+
+// gelu(x) = 0.5 x (1 + tanh(sqrt(2 / pi) (x + 0.044715 x^3))), tanh(u) = 1 - 2 / (e^2u + 1)
+FORCE_INLINE __m256 gelu256_ps(__m256 x) {
+    __m256 x3 = _mm256_mul_ps(_mm256_mul_ps(x, x), x);
+    __m256 u = _mm256_mul_ps(_mm256_set1_ps(0.7978845608f), _mm256_fmadd_ps(_mm256_set1_ps(0.044715f), x3, x));
+    __m256 e = exp256_ps(_mm256_add_ps(u, u));
+    __m256 t = _mm256_sub_ps(_mm256_set1_ps(1.0f), _mm256_div_ps(_mm256_set1_ps(2.0f), _mm256_add_ps(e, _mm256_set1_ps(1.0f))));
+    return _mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(0.5f), x), _mm256_add_ps(_mm256_set1_ps(1.0f), t));
+}
+
+FORCE_INLINE __m256 act256_ps(int act, __m256 v) {
+    if (act == ACT_RELU) return _mm256_max_ps(v, _mm256_setzero_ps());
+    if (act == ACT_GELU) return gelu256_ps(v);
+    return v;
+}
+
+// Epilogue on 8 consecutive columns j..j+7 of row i
+FORCE_INLINE __m256 epilogue8(const Epilogue *ep, __m256 v, int i, int j) {
+    if (ep->scale != 1.0f) v = _mm256_mul_ps(v, _mm256_set1_ps(ep->scale));
+    if (ep->bias) v = _mm256_add_ps(v, _mm256_loadu_ps(&ep->bias[j]));
+    if (ep->row_bias) v = _mm256_add_ps(v, _mm256_set1_ps(ep->row_bias[i]));
+    v = act256_ps(ep->act, v);
+    if (ep->residual) v = _mm256_add_ps(v, _mm256_loadu_ps(&ep->residual[(size_t)i * ep->ldr + j]));
+    return v;
+}
+
+// Epilogue on a single element, for edge tiles
+FORCE_INLINE float epilogue1(const Epilogue *ep, float v, int i, int j) {
+    v *= ep->scale;
+    if (ep->bias) v += ep->bias[j];
+    if (ep->row_bias) v += ep->row_bias[i];
+    if (ep->act != ACT_NONE) v = _mm256_cvtss_f32(act256_ps(ep->act, _mm256_set1_ps(v)));
+    if (ep->residual) v += ep->residual[(size_t)i * ep->ldr + j];
+    return v;
+}
+
+// Micro-kernel over the first m rows of a panel: C[m x NR] += A panel * B panel.
+// m is a compile time constant at every call site so the accumulators stay in registers.
+// ep is non-NULL on the last KC block only, the tile at C sits at (row, col) of the full output.
+FORCE_INLINE void micro_kernel_rows(const int m, int K, const float *A, const float *B, float *C, int ldc,
+                                    const Epilogue *ep, int row, int col) {
     __m256 c[MR];
-    for (int i = 0; i < MR; ++i) {
+    for (int i = 0; i < m; ++i) {
         c[i] = _mm256_setzero_ps();
+        // The tile is only read back after the k loop, plenty of time for it to arrive
+        if (PF_C) {
+            _mm_prefetch((const char *)&C[i * ldc], _MM_HINT_T0);
+            _mm_prefetch((const char *)&C[i * ldc + NR - 1], _MM_HINT_T0);
+        }
     }
 
-    for (int k = 0; k < K; ++k) {
+    int k = 0;
+    if (2 * m <= MR) {
+        // Too few rows to hide the FMA latency: run odd k into a second set of accumulators
+        __m256 d[MR];
+        for (int i = 0; i < m; ++i) {
+            d[i] = _mm256_setzero_ps();
+        }
+        for (; k + 2 <= K; k += 2) {
+            if (PF_A_DIST) _mm_prefetch((const char *)&A[(k + PF_A_DIST) * MR], _MM_HINT_T0);
+            if (PF_B_DIST) _mm_prefetch((const char *)&B[(k + PF_B_DIST) * NR], _MM_HINT_T0);
+            __m256 b0 = _mm256_load_ps(&B[k * NR]);
+            __m256 b1 = _mm256_load_ps(&B[(k + 1) * NR]);
+            for (int i = 0; i < m; ++i) {
+                c[i] = _mm256_fmadd_ps(_mm256_broadcast_ss(&A[k * MR + i]), b0, c[i]);
+                d[i] = _mm256_fmadd_ps(_mm256_broadcast_ss(&A[(k + 1) * MR + i]), b1, d[i]);
+            }
+        }
+        for (int i = 0; i < m; ++i) {
+            c[i] = _mm256_add_ps(c[i], d[i]);
+        }
+    }
+
+    for (; k < K; ++k) {
+        // One prefetch per 64-byte line: each k step is 32 bytes of A and of B
+        if (PF_A_DIST && k % 2 == 0) _mm_prefetch((const char *)&A[(k + PF_A_DIST) * MR], _MM_HINT_T0);
+        if (PF_B_DIST && k % 2 == 0) _mm_prefetch((const char *)&B[(k + PF_B_DIST) * NR], _MM_HINT_T0);
         __m256 b = _mm256_load_ps(&B[k * NR]);
-        for (int i = 0; i < MR; ++i) {
-            __m256 a = _mm256_set1_ps(A[i * K + k]);
+        for (int i = 0; i < m; ++i) {
+            __m256 a = _mm256_broadcast_ss(&A[k * MR + i]);
             c[i] = _mm256_fmadd_ps(a, b, c[i]);
         }
     }
 
-    for (int i = 0; i < MR; ++i) {
-        _mm256_store_ps(&C[i * ldc], c[i]);
+    for (int i = 0; i < m; ++i) {
+        __m256 v = _mm256_add_ps(_mm256_loadu_ps(&C[i * ldc]), c[i]);
+        if (ep) v = epilogue8(ep, v, row + i, col);
+        _mm256_storeu_ps(&C[i * ldc], v);
     }
 }
 
-// Function to handle edge cases
-FORCE_INLINE void edge_case_micro_kernel(int M, int N, int K, const float *A, const float *B, float *C, int ldc) {
+// Micro-kernel: C[MR x NR] += A panel * B panel
+FORCE_INLINE void micro_kernel(int K, const float *A, const float *B, float *C, int ldc, const Epilogue *ep, int row, int col) {
+    micro_kernel_rows(MR, K, A, B, C, ldc, ep, row, col);
+}
+
+// Function to handle edge cases: panels are zero padded, so run the full tile and store M x N of it.
+// Short full-width tiles (small M against a pre-packed B) only compute the rows they need.
+FORCE_INLINE void edge_case_micro_kernel(int M, int N, int K, const float *A, const float *B, float *C, int ldc,
+                                         const Epilogue *ep, int row, int col) {
+    if (N == NR && M <= SMALL_M) {
+        switch (M) {
+            case 1: micro_kernel_rows(1, K, A, B, C, ldc, ep, row, col); break;
+            case 2: micro_kernel_rows(2, K, A, B, C, ldc, ep, row, col); break;
+            case 3: micro_kernel_rows(3, K, A, B, C, ldc, ep, row, col); break;
+            default: micro_kernel_rows(4, K, A, B, C, ldc, ep, row, col); break;
+        }
+        return;
+    }
+
+    float ALIGN tile[MR * NR] = {0};
+    micro_kernel(K, A, B, tile, NR, NULL, 0, 0);
     for (int i = 0; i < M; ++i) {
         for (int j = 0; j < N; ++j) {
-            float sum = 0.0f;
-            for (int k = 0; k < K; ++k) {
-                sum += A[i * K + k] * B[k * N + j];
-            }
-            C[i * ldc + j] += sum;
+            float v = C[i * ldc + j] + tile[i * NR + j];
+            C[i * ldc + j] = ep ? epilogue1(ep, v, row + i, col + j) : v;
         }
     }
 }
 
-// Main computation kernel
-void compute_kernel(int M, int N, int K, const float *A, const float *B, float *C, int ldc) {
+// Main computation kernel. C sits at (row, col) of the full output, ep is only passed on the last KC block.
+void compute_kernel(int M, int N, int K, const float *A, const float *B, float *C, int ldc,
+                    const Epilogue *ep, int row, int col) {
     int mb = (M + MR - 1) / MR;
     int nb = (N + NR - 1) / NR;
 
@@ -117,113 +499,1986 @@ void compute_kernel(int M, int N, int K, const float *A, const float *B, float *
             int n = (j != nb - 1 || N % NR == 0) ? NR : N % NR;
 
             if (m == MR && n == NR) {
-                micro_kernel(K, &A[i * MR * K], &B[j * NR], &C[i * MR * ldc + j * NR], ldc);
+                micro_kernel(K, &A[i * MR * K], &B[j * NR * K], &C[i * MR * ldc + j * NR], ldc,
+                             ep, row + i * MR, col + j * NR);
             } else {
-                edge_case_micro_kernel(m, n, K, &A[i * MR * K], &B[j * NR], &C[i * MR * ldc + j * NR], ldc);
+                edge_case_micro_kernel(m, n, K, &A[i * MR * K], &B[j * NR * K], &C[i * MR * ldc + j * NR], ldc,
+                                       ep, row + i * MR, col + j * NR);
             }
         }
     }
 }
 
+// Bytes handed out per page size, for page_report()
+static size_t pages_hugetlb, pages_thp, pages_small;
+
+int numa_placement() {
+    const char *policy = getenv("O5_NUMA");
+    return policy && strcmp(policy, "interleave") == 0 ? PLACE_INTERLEAVE : PLACE_FIRST_TOUCH;
+}
+
+// Interleave [p, p + bytes) page by page over the online NUMA nodes. Nothing to do on one node.
+static void interleave_pages(void *p, size_t bytes) {
+    unsigned long mask = 0;
+    FILE *f = fopen("/sys/devices/system/node/online", "r");
+    if (f) {
+        // e.g. "0-1" or "0,2-3"
+        int lo, hi;
+        char sep;
+        while (fscanf(f, "%d", &lo) == 1) {
+            hi = lo;
+            if (fscanf(f, "%c", &sep) == 1 && sep == '-' && fscanf(f, "%d", &hi) == 1) fscanf(f, "%c", &sep);
+            for (int n = lo; n <= hi && n < 64; n++) mask |= 1UL << n;
+        }
+        fclose(f);
+    }
+    if ((mask & (mask - 1)) == 0) return;
+    if (syscall(SYS_mbind, p, bytes, MPOL_INTERLEAVE, &mask, 65, MPOL_MF_MOVE) != 0) {
+        perror("mbind");
+    }
+}
+
+// Mapping size for a request: whole 2 MB pages from one huge page up, 4 KB pages below
+FORCE_INLINE size_t pages_map_size(size_t bytes) {
+    size_t page = bytes >= HUGE_PAGE ? HUGE_PAGE : SMALL_PAGE;
+    return bytes ? (bytes + page - 1) / page * page : SMALL_PAGE;
+}
+
+// Page aligned anonymous memory, free with free_pages(p, bytes). From one huge page up it tries, in order:
+// explicit 2 MB pages from the hugetlbfs pool (MAP_HUGETLB), transparent huge pages (2 MB aligned mapping
+// + MADV_HUGEPAGE), then plain 4 KB pages. O5_PAGES=4k skips both huge page attempts.
+void *alloc_pages(size_t bytes) {
+    size_t size = pages_map_size(bytes);
+    const char *pages = getenv("O5_PAGES");
+    int huge = size >= HUGE_PAGE && !(pages && strcmp(pages, "4k") == 0);
+    void *p = MAP_FAILED;
+
+    if (huge) {
+        p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (21 << MAP_HUGE_SHIFT), -1, 0);
+        if (p != MAP_FAILED) __atomic_add_fetch(&pages_hugetlb, size, __ATOMIC_RELAXED);
+    }
+    if (p == MAP_FAILED && huge) {
+        // Over-map by one huge page and trim, THP only backs 2 MB aligned ranges
+        char *raw = (char *)mmap(NULL, size + HUGE_PAGE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (raw != MAP_FAILED) {
+            char *aligned = (char *)(((uintptr_t)raw + HUGE_PAGE - 1) & ~(uintptr_t)(HUGE_PAGE - 1));
+            if (aligned > raw) munmap(raw, aligned - raw);
+            munmap(aligned + size, raw + HUGE_PAGE - aligned);
+            p = aligned;
+            if (madvise(p, size, MADV_HUGEPAGE) == 0) __atomic_add_fetch(&pages_thp, size, __ATOMIC_RELAXED);
+            else __atomic_add_fetch(&pages_small, size, __ATOMIC_RELAXED);
+        }
+    }
+    if (p == MAP_FAILED) {
+        p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) {
+            fprintf(stderr, "Memory allocation failed\n");
+            exit(1);
+        }
+        __atomic_add_fetch(&pages_small, size, __ATOMIC_RELAXED);
+    }
+    return p;
+}
+
+void free_pages(void *p, size_t bytes) {
+    if (p) munmap(p, pages_map_size(bytes));
+}
+
+// Buffer for a large operand: alloc_pages placed according to numa_placement(). Nothing is touched here,
+// so with first touch the pages land wherever init_uniform / init_zero's threads first write them.
+void *alloc_matrix(size_t bytes) {
+    void *p = alloc_pages(bytes);
+    if (numa_placement() == PLACE_INTERLEAVE) interleave_pages(p, pages_map_size(bytes));
+    return p;
+}
+
+void free_matrix(void *p, size_t bytes) {
+    free_pages(p, bytes);
+}
+
+// Which page sizes the allocations so far got. THP is only a request, AnonHugePages is what the kernel backed.
+void page_report() {
+    long anon_huge_kb = 0;
+    char line[256];
+    FILE *f = fopen("/proc/self/smaps_rollup", "r");
+    while (f && fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "AnonHugePages: %ld kB", &anon_huge_kb) == 1) break;
+    }
+    if (f) fclose(f);
+    printf("Pages: %.1f MB hugetlbfs 2 MB, %.1f MB THP (%.1f MB currently backed by 2 MB), %.1f MB 4 KB\n",
+           pages_hugetlb / 1048576.0, pages_thp / 1048576.0, anon_huge_kb / 1024.0, pages_small / 1048576.0);
+}
+
 void *matmul_thread(void *arg) {
     ThreadArgs *args = (ThreadArgs *)arg;
-    float *A = args->A;
-    float *B = args->B;
+    const void *A = args->A;
+    const void *B = args->B;
     float *C = args->C;
-    int M = args->M, N = args->N, K = args->K;
+    int N = args->N, K = args->K;
     int start_row = args->start_row;
     int end_row = args->end_row;
+    int start_col = args->start_col;
+    int end_col = args->end_col;
+
+    // Packed buffers, private to each thread and sharing one mapping, so the default sizes (4.1 MB) sit
+    // on three 2 MB pages. Sized to the call, small problems do not fault in whole huge pages.
+    int kc = K < KC ? K : KC;
+    int mc = end_row - start_row < MC ? (end_row - start_row + MR - 1) / MR * MR : MC;
+    int nc = end_col - start_col < NC ? (end_col - start_col + NR - 1) / NR * NR : NC;
+    size_t ac_size = ((size_t)mc * kc + 15) / 16 * 16; // Bc starts on a cache line
+    size_t buf_bytes = (ac_size + (args->Bp ? 0 : (size_t)kc * nc)) * sizeof(float);
+    float *Ac = (float *)alloc_pages(buf_bytes);
+    float *Bc = args->Bp ? NULL : Ac + ac_size;
 
     for (int i = start_row; i < end_row; i += MC) {
         int mb = (i + MC <= end_row) ? MC : end_row - i;
 
         for (int k = 0; k < K; k += KC) {
             int kb = (k + KC <= K) ? KC : K - k;
+            const Epilogue *ep = (k + kb >= K) ? args->ep : NULL;
 
             // Pack A
-            pack_a(kb, &A[i * K + k], K, Ac);
+            pack_a(args->a_dtype, mb, kb, elem_at(args->a_dtype, A, (size_t)i * K + k), K, Ac);
 
-            for (int j = 0; j < N; j += NC) {
-                int nb = (j + NC <= N) ? NC : N - j;
+            for (int j = start_col; j < end_col; j += NC) {
+                int nb = (j + NC <= end_col) ? NC : end_col - j;
+
+                if (args->Bp) {
+                    // Already packed: panel j of block k starts kb * j floats into the block
+                    compute_kernel(mb, nb, kb, Ac, &args->Bp[(size_t)k * args->Np + (size_t)kb * j], &C[i * N + j], N, ep, i, j);
+                    continue;
+                }
 
                 // Pack B
-                pack_b(kb, nb, &B[k * N + j], N, Bc);
+                pack_b(args->b_dtype, kb, nb, elem_at(args->b_dtype, B, (size_t)k * N + j), N, Bc);
 
                 // Compute
-                compute_kernel(mb, nb, kb, Ac, Bc, &C[i * N + j], N);
+                compute_kernel(mb, nb, kb, Ac, Bc, &C[i * N + j], N, ep, i, j);
             }
         }
     }
 
+    free_pages(Ac, buf_bytes);
     return NULL;
 }
 
-void matmul(float *A, float *B, float *C, int M, int N, int K, int num_threads) {
-    pthread_t threads[MAX_THREADS];
-    ThreadArgs thread_args[MAX_THREADS];
+// Copy m x n finished floats to C with non-temporal stores, plain stores up to the first 32 byte boundary
+// of each row and for the tail
+FORCE_INLINE void stream_rows(int m, int n, const float *S, int lds, float *C, int ldc) {
+    for (int i = 0; i < m; ++i) {
+        const float *s = &S[(size_t)i * lds];
+        float *c = &C[(size_t)i * ldc];
+        int j = 0;
+        for (; j < n && ((uintptr_t)&c[j] & 31); ++j) c[j] = s[j];
+        for (; j + 8 <= n; j += 8) _mm256_stream_ps(&c[j], _mm256_loadu_ps(&s[j]));
+        for (; j < n; ++j) c[j] = s[j];
+    }
+}
 
-    for (int i = 0; i < num_threads; i++) {
-        thread_args[i].A = A;
-        thread_args[i].B = B;
-        thread_args[i].C = C;
-        thread_args[i].M = M;
-        thread_args[i].N = N;
-        thread_args[i].K = K;
-        thread_args[i].start_row = (M * i) / num_threads;
-        thread_args[i].end_row = (M * (i + 1)) / num_threads;
+// C = A B (+ epilogue) for a write-only C. The whole K of the row band's A is packed once per MC block,
+// then every NC_STREAM column chunk runs its full K against a zeroed scratch that stays in L2, and is
+// written to C exactly once without reading it.
+void *matmul_stream_thread(void *arg) {
+    ThreadArgs *args = (ThreadArgs *)arg;
+    const void *A = args->A;
+    const void *B = args->B;
+    float *C = args->C;
+    int N = args->N;
+    int K = args->K;
+    int start_row = args->start_row;
+    int end_row = args->end_row;
 
-        if (pthread_create(&threads[i], NULL, matmul_thread, &thread_args[i]) != 0) {
-            fprintf(stderr, "Failed to create thread %d\n", i);
-            exit(1);
+    int kc = K < KC ? K : KC;
+    int mc = end_row - start_row < MC ? (end_row - start_row + MR - 1) / MR * MR : MC;
+    size_t ac_size = ((size_t)mc * K + 15) / 16 * 16;
+    size_t bc_size = (size_t)kc * NC_STREAM;
+    size_t buf_bytes = (ac_size + bc_size + (size_t)mc * NC_STREAM) * sizeof(float);
+    float *Ac = (float *)alloc_pages(buf_bytes);
+    float *Bc = Ac + ac_size;
+    float *S = Bc + bc_size;
+
+    for (int i = start_row; i < end_row; i += MC) {
+        int mb = (i + MC <= end_row) ? MC : end_row - i;
+        int mr = (mb + MR - 1) / MR * MR; // packed rows, block k starts mr * k into Ac
+
+        for (int k = 0; k < K; k += KC) {
+            int kb = (k + KC <= K) ? KC : K - k;
+            pack_a(args->a_dtype, mb, kb, elem_at(args->a_dtype, A, (size_t)i * K + k), K, &Ac[(size_t)mr * k]);
+        }
+
+        for (int j = 0; j < N; j += NC_STREAM) {
+            int nb = (j + NC_STREAM <= N) ? NC_STREAM : N - j;
+            memset(S, 0, (size_t)mb * NC_STREAM * sizeof(float));
+
+            for (int k = 0; k < K; k += KC) {
+                int kb = (k + KC <= K) ? KC : K - k;
+                pack_b(args->b_dtype, kb, nb, elem_at(args->b_dtype, B, (size_t)k * N + j), N, Bc);
+                compute_kernel(mb, nb, kb, &Ac[(size_t)mr * k], Bc, S, NC_STREAM, (k + kb >= K) ? args->ep : NULL, i, j);
+            }
+
+            stream_rows(mb, nb, S, NC_STREAM, &C[(size_t)i * N + j], N);
         }
     }
 
-    for (int i = 0; i < num_threads; i++) {
-        if (pthread_join(threads[i], NULL) != 0) {
-            fprintf(stderr, "Failed to join thread %d\n", i);
-            exit(1);
+    // Streaming stores are weakly ordered: drain them before the join publishes C
+    _mm_sfence();
+    free_pages(Ac, buf_bytes);
+    return NULL;
+}
+
+// One (i, k, j) block of matmul_thread's loop, as handed from the pack helper to the worker
+typedef struct {
+    int i, k, j;
+    int mb, kb, nb;
+    const float *a, *b;
+} PackStep;
+
+typedef struct {
+    ThreadArgs *args;
+    float *Ac[2], *Bc[2];
+    PackStep step[2];  // step t in step[t % 2]
+    int steps;
+    int filled;        // steps packed
+    int consumed;      // steps computed
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} PackPipe;
+
+// Packs steps in matmul_thread's order. A goes to the other A buffer only when (i, k) changes, B every step
+// (unless pre-packed), and never more than one step ahead of the worker.
+void *pack_helper_thread(void *arg) {
+    PackPipe *p = (PackPipe *)arg;
+    ThreadArgs *args = p->args;
+    int N = args->N, K = args->K;
+    int t = 0, a_slot = 1;
+    const float *a = NULL;
+
+    for (int i = args->start_row; i < args->end_row; i += MC) {
+        int mb = (i + MC <= args->end_row) ? MC : args->end_row - i;
+        for (int k = 0; k < K; k += KC) {
+            int kb = (k + KC <= K) ? KC : K - k;
+            for (int j = args->start_col; j < args->end_col; j += NC, t++) {
+                int nb = (j + NC <= args->end_col) ? NC : args->end_col - j;
+
+                // Buffers of step t - 2 are free once the worker is done with it
+                pthread_mutex_lock(&p->lock);
+                while (p->consumed < t - 1) pthread_cond_wait(&p->cond, &p->lock);
+                pthread_mutex_unlock(&p->lock);
+
+                if (j == args->start_col) {
+                    a_slot ^= 1;
+                    pack_a(args->a_dtype, mb, kb, elem_at(args->a_dtype, args->A, (size_t)i * K + k), K, p->Ac[a_slot]);
+                    a = p->Ac[a_slot];
+                }
+                const float *b;
+                if (args->Bp) {
+                    b = &args->Bp[(size_t)k * args->Np + (size_t)kb * j];
+                } else {
+                    pack_b(args->b_dtype, kb, nb, elem_at(args->b_dtype, args->B, (size_t)k * N + j), N, p->Bc[t % 2]);
+                    b = p->Bc[t % 2];
+                }
+
+                pthread_mutex_lock(&p->lock);
+                p->step[t % 2] = (PackStep){i, k, j, mb, kb, nb, a, b};
+                p->filled = t + 1;
+                pthread_cond_broadcast(&p->cond);
+                pthread_mutex_unlock(&p->lock);
+            }
         }
     }
+    return NULL;
 }
 
-double get_time() {
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    return tv.tv_sec + tv.tv_usec * 1e-6;
+static void pack_helper_affinity(pthread_attr_t *attr); // with the topology code below
+
+// matmul_thread with packing moved to a helper thread, double buffered: the worker only computes
+void *matmul_pipeline_thread(void *arg) {
+    ThreadArgs *args = (ThreadArgs *)arg;
+    int rows = args->end_row - args->start_row, cols = args->end_col - args->start_col;
+    if (rows <= 0 || cols <= 0) return NULL;
+
+    int kc = args->K < KC ? args->K : KC;
+    int mc = rows < MC ? (rows + MR - 1) / MR * MR : MC;
+    int nc = cols < NC ? (cols + NR - 1) / NR * NR : NC;
+    size_t ac_size = ((size_t)mc * kc + 15) / 16 * 16;
+    size_t bc_size = args->Bp ? 0 : ((size_t)kc * nc + 15) / 16 * 16;
+    size_t buf_bytes = 2 * (ac_size + bc_size) * sizeof(float);
+
+    PackPipe p;
+    memset(&p, 0, sizeof(p));
+    p.args = args;
+    p.Ac[0] = (float *)alloc_pages(buf_bytes);
+    p.Ac[1] = p.Ac[0] + ac_size;
+    p.Bc[0] = p.Ac[1] + ac_size;
+    p.Bc[1] = p.Bc[0] + bc_size;
+    p.steps = (rows + MC - 1) / MC * ((args->K + KC - 1) / KC) * ((cols + NC - 1) / NC);
+    pthread_mutex_init(&p.lock, NULL);
+    pthread_cond_init(&p.cond, NULL);
+
+    pthread_t helper;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pack_helper_affinity(&attr);
+    int err = pthread_create(&helper, &attr, pack_helper_thread, &p);
+    pthread_attr_destroy(&attr);
+    if (err != 0) {
+        fprintf(stderr, "Failed to create pack helper\n");
+        exit(1);
+    }
+
+    for (int t = 0; t < p.steps; t++) {
+        pthread_mutex_lock(&p.lock);
+        while (p.filled <= t) pthread_cond_wait(&p.cond, &p.lock);
+        PackStep s = p.step[t % 2];
+        pthread_mutex_unlock(&p.lock);
+
+        const Epilogue *ep = (s.k + s.kb >= args->K) ? args->ep : NULL;
+        compute_kernel(s.mb, s.nb, s.kb, s.a, s.b, &args->C[(size_t)s.i * args->N + s.j], args->N, ep, s.i, s.j);
+
+        pthread_mutex_lock(&p.lock);
+        p.consumed = t + 1;
+        pthread_cond_broadcast(&p.cond);
+        pthread_mutex_unlock(&p.lock);
+    }
+
+    pthread_join(helper, NULL);
+    pthread_mutex_destroy(&p.lock);
+    pthread_cond_destroy(&p.cond);
+    free_pages(p.Ac[0], buf_bytes);
+    return NULL;
 }
 
-int main() {
-    int M = 4096, N = 4096, K = 4096;
-    //int M = 512, N = 512, K = 512;
-    float *A = (float *)aligned_alloc(32, M * K * sizeof(float));
-    float *B = (float *)aligned_alloc(32, K * N * sizeof(float));
-    float *C = (float *)aligned_alloc(32, M * N * sizeof(float));
-    if (!A || !B || !C) {
-        fprintf(stderr, "Memory allocation failed\n");
-        return 1;
+// O5_PIPELINE=1 selects matmul_pipeline_thread for the blocked path
+int pipeline_packing() {
+    const char *env = getenv("O5_PIPELINE");
+    return env && atoi(env) != 0;
+}
+
+// Horizontal sum of the 8 lanes
+FORCE_INLINE float hsum(__m256 v) {
+    __m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_movehdup_ps(s));
+    return _mm_cvtss_f32(s);
+}
+
+// GEMV (N == 1): y += A x, A streamed once, four rows at a time with two accumulators per row.
+// x is always fp32 (the dispatcher widens it), A is read in its storage type.
+FORCE_INLINE void gemv_rows(const int dtype, int start_row, int end_row, int K, const void *A, const float *x, float *y,
+                            const Epilogue *ep) {
+    int i = start_row;
+
+    for (; i + 4 <= end_row; i += 4) {
+        const void *a0 = elem_at(dtype, A, (size_t)(i + 0) * K);
+        const void *a1 = elem_at(dtype, A, (size_t)(i + 1) * K);
+        const void *a2 = elem_at(dtype, A, (size_t)(i + 2) * K);
+        const void *a3 = elem_at(dtype, A, (size_t)(i + 3) * K);
+        __m256 s00 = _mm256_setzero_ps(), s01 = _mm256_setzero_ps();
+        __m256 s10 = _mm256_setzero_ps(), s11 = _mm256_setzero_ps();
+        __m256 s20 = _mm256_setzero_ps(), s21 = _mm256_setzero_ps();
+        __m256 s30 = _mm256_setzero_ps(), s31 = _mm256_setzero_ps();
+
+        int k = 0;
+        for (; k + 16 <= K; k += 16) {
+            __m256 x0 = _mm256_loadu_ps(&x[k]);
+            __m256 x1 = _mm256_loadu_ps(&x[k + 8]);
+            s00 = _mm256_fmadd_ps(load8(dtype, a0, k), x0, s00);
+            s01 = _mm256_fmadd_ps(load8(dtype, a0, k + 8), x1, s01);
+            s10 = _mm256_fmadd_ps(load8(dtype, a1, k), x0, s10);
+            s11 = _mm256_fmadd_ps(load8(dtype, a1, k + 8), x1, s11);
+            s20 = _mm256_fmadd_ps(load8(dtype, a2, k), x0, s20);
+            s21 = _mm256_fmadd_ps(load8(dtype, a2, k + 8), x1, s21);
+            s30 = _mm256_fmadd_ps(load8(dtype, a3, k), x0, s30);
+            s31 = _mm256_fmadd_ps(load8(dtype, a3, k + 8), x1, s31);
+        }
+
+        float r0 = hsum(_mm256_add_ps(s00, s01));
+        float r1 = hsum(_mm256_add_ps(s10, s11));
+        float r2 = hsum(_mm256_add_ps(s20, s21));
+        float r3 = hsum(_mm256_add_ps(s30, s31));
+        for (; k < K; ++k) {
+            r0 += load1(dtype, a0, k) * x[k];
+            r1 += load1(dtype, a1, k) * x[k];
+            r2 += load1(dtype, a2, k) * x[k];
+            r3 += load1(dtype, a3, k) * x[k];
+        }
+        y[i + 0] += r0;
+        y[i + 1] += r1;
+        y[i + 2] += r2;
+        y[i + 3] += r3;
+        if (ep) {
+            for (int r = 0; r < 4; ++r) y[i + r] = epilogue1(ep, y[i + r], i + r, 0);
+        }
+    }
+
+    // Leftover rows
+    for (; i < end_row; ++i) {
+        const void *a = elem_at(dtype, A, (size_t)i * K);
+        __m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps();
+        int k = 0;
+        for (; k + 16 <= K; k += 16) {
+            s0 = _mm256_fmadd_ps(load8(dtype, a, k), _mm256_loadu_ps(&x[k]), s0);
+            s1 = _mm256_fmadd_ps(load8(dtype, a, k + 8), _mm256_loadu_ps(&x[k + 8]), s1);
+        }
+        float r = hsum(_mm256_add_ps(s0, s1));
+        for (; k < K; ++k) {
+            r += load1(dtype, a, k) * x[k];
+        }
+        y[i] += r;
+        if (ep) y[i] = epilogue1(ep, y[i], i, 0);
     }
+}
 
-    // Initialize matrices with random values
-    srand(time(NULL));
-    for (int i = 0; i < M * K; i++) A[i] = (float)rand() / RAND_MAX;
-    for (int i = 0; i < K * N; i++) B[i] = (float)rand() / RAND_MAX;
-    memset(C, 0, M * N * sizeof(float));
+void *gemv_thread(void *arg) {
+    ThreadArgs *args = (ThreadArgs *)arg;
+    const float *x = (const float *)args->B;
 
-    int num_threads = 24; // Adjust based on your CPU
+    switch (args->a_dtype) {
+        case DTYPE_F16: gemv_rows(DTYPE_F16, args->start_row, args->end_row, args->K, args->A, x, args->C, args->ep); break;
+        case DTYPE_BF16: gemv_rows(DTYPE_BF16, args->start_row, args->end_row, args->K, args->A, x, args->C, args->ep); break;
+        default: gemv_rows(DTYPE_F32, args->start_row, args->end_row, args->K, args->A, x, args->C, args->ep); break;
+    }
+    return NULL;
+}
 
-    double start_time = get_time();
-    matmul(A, B, C, M, N, K, num_threads);
-    double end_time = get_time();
+// Small-M strip: C[m x 16] += A[m x K] B[K x 16]
+// m is a compile time constant at every call site so the accumulators stay in registers.
+FORCE_INLINE void small_m_strip(const int m, const int dtype, int K, int lda, const float *A, const void *B, int ldb, float *C, int ldc) {
+    __m256 c0[SMALL_M], c1[SMALL_M];
+    for (int i = 0; i < m; ++i) {
+        c0[i] = _mm256_setzero_ps();
+        c1[i] = _mm256_setzero_ps();
+    }
 
-    double elapsed_time = end_time - start_time;
-    double flops = 2.0 * M * N * K;
-    double gflops = flops / (elapsed_time * 1e9);
+    for (int k = 0; k < K; ++k) {
+        __m256 b0 = load8(dtype, B, (size_t)k * ldb);
+        __m256 b1 = load8(dtype, B, (size_t)k * ldb + 8);
+        for (int i = 0; i < m; ++i) {
+            __m256 a = _mm256_broadcast_ss(&A[i * lda + k]);
+            c0[i] = _mm256_fmadd_ps(a, b0, c0[i]);
+            c1[i] = _mm256_fmadd_ps(a, b1, c1[i]);
+        }
+    }
 
-    printf("Time: %.6f seconds\n", elapsed_time);
-    printf("Performance: %.2f GFLOPS\n", gflops);
+    for (int i = 0; i < m; ++i) {
+        _mm256_storeu_ps(&C[i * ldc], _mm256_add_ps(_mm256_loadu_ps(&C[i * ldc]), c0[i]));
+        _mm256_storeu_ps(&C[i * ldc + 8], _mm256_add_ps(_mm256_loadu_ps(&C[i * ldc + 8]), c1[i]));
+    }
+}
+
+// Small-M (M <= SMALL_M): each thread owns a band of columns and streams its part of B once,
+// SMALL_M_KB rows at a time. A is always fp32 (the dispatcher widens it), B is read in its storage type.
+FORCE_INLINE void small_m_band(const int dtype, int M, int N, int K, int start_col, int end_col, const float *A, const void *B, float *C,
+                               const Epilogue *ep) {
+    int j;
+
+    // SMALL_M_KB rows of B are streamed side by side across the band, few enough for the prefetcher to track
+    int band_end = start_col + (end_col - start_col) / 16 * 16;
+    for (int k = 0; k < K; k += SMALL_M_KB) {
+        int kb = (k + SMALL_M_KB <= K) ? SMALL_M_KB : K - k;
+        for (j = start_col; j < band_end; j += 16) {
+            const void *b = elem_at(dtype, B, (size_t)k * N + j);
+            switch (M) {
+                case 1: small_m_strip(1, dtype, kb, K, &A[k], b, N, &C[j], N); break;
+                case 2: small_m_strip(2, dtype, kb, K, &A[k], b, N, &C[j], N); break;
+                case 3: small_m_strip(3, dtype, kb, K, &A[k], b, N, &C[j], N); break;
+                default: small_m_strip(4, dtype, kb, K, &A[k], b, N, &C[j], N); break;
+            }
+        }
+    }
+
+    // Leftover columns
+    for (j = band_end; j < end_col; ++j) {
+        for (int i = 0; i < M; ++i) {
+            float sum = 0.0f;
+            for (int k = 0; k < K; ++k) {
+                sum += A[i * K + k] * load1(dtype, B, (size_t)k * N + j);
+            }
+            C[i * N + j] += sum;
+        }
+    }
+
+    // The band is only complete after the last k sweep, it is still in cache for the epilogue
+    if (ep) {
+        for (int i = 0; i < M; ++i) {
+            for (j = start_col; j + 8 <= end_col; j += 8) {
+                _mm256_storeu_ps(&C[i * N + j], epilogue8(ep, _mm256_loadu_ps(&C[i * N + j]), i, j));
+            }
+            for (; j < end_col; ++j) {
+                C[i * N + j] = epilogue1(ep, C[i * N + j], i, j);
+            }
+        }
+    }
+}
+
+void *small_m_thread(void *arg) {
+    ThreadArgs *args = (ThreadArgs *)arg;
+    const float *A = (const float *)args->A;
+
+    switch (args->b_dtype) {
+        case DTYPE_F16: small_m_band(DTYPE_F16, args->M, args->N, args->K, args->start_col, args->end_col, A, args->B, args->C, args->ep); break;
+        case DTYPE_BF16: small_m_band(DTYPE_BF16, args->M, args->N, args->K, args->start_col, args->end_col, A, args->B, args->C, args->ep); break;
+        default: small_m_band(DTYPE_F32, args->M, args->N, args->K, args->start_col, args->end_col, A, args->B, args->C, args->ep); break;
+    }
+    return NULL;
+}
+
+// Hardware threads the process may run on, from sysfs: the core (lowest SMT sibling) and L3 domain (lowest CPU
+// sharing the L3) of each. Without the sysfs files every CPU is its own core in one domain.
+typedef struct {
+    int cpu;
+    int domain; // dense index of its L3 domain
+    int slot;   // index of its core within the domain
+    int smt;    // index among the allowed threads of its core
+} HwThread;
+
+static HwThread hw_threads[MAX_CPUS];
+static int hw_count, hw_domains;
+static pthread_once_t hw_once = PTHREAD_ONCE_INIT;
+
+static int sysfs_first_int(int cpu, const char *file) {
+    char path[128];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/%s", cpu, file);
+    FILE *f = fopen(path, "r");
+    int v = -1;
+    if (f && fscanf(f, "%d", &v) != 1) v = -1;
+    if (f) fclose(f);
+    return v;
+}
+
+static void hw_topology_init(void) {
+    cpu_set_t allowed;
+    int core[MAX_CPUS], l3[MAX_CPUS];
+    // The process's mask (the main thread's), not that of whichever pinned worker gets here first
+    if (sched_getaffinity(getpid(), sizeof(allowed), &allowed) != 0) {
+        CPU_ZERO(&allowed);
+        for (int c = 0; c < sysconf(_SC_NPROCESSORS_ONLN) && c < MAX_CPUS; c++) CPU_SET(c, &allowed);
+    }
+    for (int c = 0; c < CPU_SETSIZE && hw_count < MAX_CPUS; c++) {
+        if (!CPU_ISSET(c, &allowed)) continue;
+        int n = hw_count++;
+        hw_threads[n].cpu = c;
+        core[n] = sysfs_first_int(c, "topology/thread_siblings_list");
+        l3[n] = sysfs_first_int(c, "cache/index3/shared_cpu_list");
+        if (core[n] < 0) core[n] = c;
+        if (l3[n] < 0) l3[n] = 0;
+    }
+
+    for (int i = 0; i < hw_count; i++) {
+        // Domains numbered by their lowest CPU, cores within a domain likewise
+        int domain = 0, slot = 0, smt = 0;
+        for (int j = 0; j < hw_count; j++) {
+            int first_of_domain = 1, first_of_core = 1;
+            for (int q = 0; q < j; q++) {
+                if (l3[q] == l3[j]) first_of_domain = 0;
+                if (core[q] == core[j]) first_of_core = 0;
+            }
+            if (first_of_domain && l3[j] < l3[i]) domain++;
+            if (first_of_core && l3[j] == l3[i] && core[j] < core[i]) slot++;
+            if (j < i && core[j] == core[i]) smt++;
+        }
+        hw_threads[i].domain = domain;
+        hw_threads[i].slot = slot;
+        hw_threads[i].smt = smt;
+        if (domain + 1 > hw_domains) hw_domains = domain + 1;
+    }
+    if (hw_domains > MAX_DOMAINS) {
+        for (int i = 0; i < hw_count; i++) hw_threads[i].domain %= MAX_DOMAINS;
+        hw_domains = MAX_DOMAINS;
+    }
+}
+
+static int by_core_first(const void *a, const void *b) {
+    const HwThread *x = (const HwThread *)a, *y = (const HwThread *)b;
+    if (x->smt != y->smt) return x->smt - y->smt;
+    if (x->slot != y->slot) return x->slot - y->slot;
+    return x->domain - y->domain;
+}
+
+static int by_compact(const void *a, const void *b) {
+    const HwThread *x = (const HwThread *)a, *y = (const HwThread *)b;
+    if (x->domain != y->domain) return x->domain - y->domain;
+    if (x->slot != y->slot) return x->slot - y->slot;
+    return x->smt - y->smt;
+}
+
+// Hardware threads in the order workers are placed on them under O5_PIN / O5_THREADS_PER_CORE. Worker i runs
+// on order[i % n]. Returns n, 0 when pinning is off.
+int worker_placement(HwThread *order) {
+    pthread_once(&hw_once, hw_topology_init);
+    const char *pin = getenv("O5_PIN");
+    if (pin && strcmp(pin, "none") == 0) return 0;
+    const char *tpc_env = getenv("O5_THREADS_PER_CORE");
+    int tpc = tpc_env && atoi(tpc_env) > 0 ? atoi(tpc_env) : MAX_CPUS;
+
+    int n = 0;
+    for (int i = 0; i < hw_count; i++) {
+        if (hw_threads[i].smt < tpc) order[n++] = hw_threads[i];
+    }
+    qsort(order, n, sizeof(HwThread), pin && strcmp(pin, "compact") == 0 ? by_compact : by_core_first);
+    return n;
+}
+
+// A pinned worker's pack helper would inherit its single CPU and only time-slice with it, so the helper goes on
+// the worker's SMT sibling, or anywhere in the process's mask when the core has none. Unpinned: left as is.
+static void pack_helper_affinity(pthread_attr_t *attr) {
+    cpu_set_t set;
+    if (pthread_getaffinity_np(pthread_self(), sizeof(set), &set) != 0 || CPU_COUNT(&set) != 1) return;
+    pthread_once(&hw_once, hw_topology_init);
+    const HwThread *self = NULL;
+    for (int i = 0; i < hw_count; i++) {
+        if (CPU_ISSET(hw_threads[i].cpu, &set)) self = &hw_threads[i];
+    }
+    CPU_ZERO(&set);
+    for (int i = 0; self && i < hw_count; i++) {
+        const HwThread *h = &hw_threads[i];
+        if (h != self && h->domain == self->domain && h->slot == self->slot) CPU_SET(h->cpu, &set);
+    }
+    if (CPU_COUNT(&set) == 0) {
+        for (int i = 0; i < hw_count; i++) CPU_SET(hw_threads[i].cpu, &set);
+    }
+    pthread_attr_setaffinity_np(attr, sizeof(set), &set);
+}
+
+// Programs that run several processes side by side on one box (forked SUMMA ranks) give each its own share:
+// process index of count narrows its affinity to a disjoint slice of the allowed hardware threads, whole cores
+// of one L3 domain first, and worker placement starts over inside it. Call before any workers start. Returns
+// the hardware threads now allowed; with O5_PIN=none nothing is narrowed and all of them are.
+int placement_slice(int index, int count) {
+    HwThread order[MAX_CPUS];
+    pthread_once(&hw_once, hw_topology_init);
+    const char *pin = getenv("O5_PIN");
+    if ((pin && strcmp(pin, "none") == 0) || count <= 1 || hw_count == 0) return hw_count;
+
+    memcpy(order, hw_threads, hw_count * sizeof(HwThread));
+    qsort(order, hw_count, sizeof(HwThread), by_compact);
+    // More processes than hardware threads share them one each
+    int lo = count <= hw_count ? (int)((long)hw_count * index / count) : index % hw_count;
+    int hi = count <= hw_count ? (int)((long)hw_count * (index + 1) / count) : lo + 1;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int i = lo; i < hi; i++) CPU_SET(order[i].cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+        perror("sched_setaffinity");
+        return hw_count;
+    }
+    hw_count = hw_domains = 0;
+    hw_topology_init();
+    return hw_count;
+}
+
+// num_threads, capped at the allowed hardware threads when O5_THREADS_PER_CORE asks for a limit
+int worker_count(int num_threads) {
+    HwThread order[MAX_CPUS];
+    int n = worker_placement(order);
+    if (n > 0 && getenv("O5_THREADS_PER_CORE") && num_threads > n) return n;
+    return num_threads;
+}
+
+void placement_report(int num_threads) {
+    HwThread order[MAX_CPUS];
+    int n = worker_placement(order);
+    const char *pin = getenv("O5_PIN");
+    if (!n) {
+        printf("Placement: unpinned\n");
+        return;
+    }
+    printf("Placement: %s, %d hardware threads in %d L3 domains, workers on CPUs", pin && *pin ? pin : "cores", n, hw_domains);
+    num_threads = worker_count(num_threads);
+    for (int i = 0; i < num_threads; i++) printf(" %d", order[i % n].cpu);
+    printf("\n");
+}
+
+// Run fn once per thread on consecutive arg_size-byte argument structs, and wait for all of them
+// Worker i is pinned to the same hardware thread on every call (see worker_placement), so the bands
+// parallel_rows first-touches stay next to the worker that later computes them.
+void launch_threads(void *(*fn)(void *), void *thread_args, size_t arg_size, int num_threads) {
+    pthread_t threads[MAX_THREADS];
+    HwThread order[MAX_CPUS];
+    int n = worker_placement(order);
+
+    for (int i = 0; i < num_threads; i++) {
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        if (n) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(order[i % n].cpu, &set);
+            pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+        }
+        int err = pthread_create(&threads[i], &attr, fn, (char *)thread_args + i * arg_size);
+        pthread_attr_destroy(&attr);
+        if (err != 0) {
+            fprintf(stderr, "Failed to create thread %d\n", i);
+            exit(1);
+        }
+    }
+
+    for (int i = 0; i < num_threads; i++) {
+        if (pthread_join(threads[i], NULL) != 0) {
+            fprintf(stderr, "Failed to join thread %d\n", i);
+            exit(1);
+        }
+    }
+}
+
+// Counter-based RNG (splitmix64 of seed and index): element i gets the same value whichever thread makes it
+FORCE_INLINE uint64_t rng_u64(uint64_t seed, uint64_t i) {
+    uint64_t z = (seed + 1) * 0x9E3779B97F4A7C15ULL + i * 0xD1B54A32D192ED03ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+// Uniform in [0, 1)
+FORCE_INLINE float rng_uniform(uint64_t seed, uint64_t i) {
+    return (float)(rng_u64(seed, i) >> 40) * (1.0f / 16777216.0f);
+}
+
+typedef struct {
+    void (*fn)(void *ctx, int start_row, int end_row);
+    void *ctx;
+    int start_row;
+    int end_row;
+} RowBand;
+
+void *row_band_thread(void *arg) {
+    RowBand *band = (RowBand *)arg;
+    band->fn(band->ctx, band->start_row, band->end_row);
+    return NULL;
+}
+
+// Run fn over row bands split exactly like matmul_ex's row split, one thread per band. Initializing A and C
+// through this first-touches each band's pages from the thread that later computes it, on its own node.
+void parallel_rows(int rows, int num_threads, void (*fn)(void *, int, int), void *ctx) {
+    RowBand bands[MAX_THREADS];
+
+    if (num_threads > MAX_THREADS) num_threads = MAX_THREADS;
+    if (num_threads > rows) num_threads = rows > 0 ? rows : 1;
+    for (int i = 0; i < num_threads; i++) {
+        bands[i].fn = fn;
+        bands[i].ctx = ctx;
+        bands[i].start_row = (int)((long)rows * i / num_threads);
+        bands[i].end_row = (int)((long)rows * (i + 1) / num_threads);
+    }
+    launch_threads(row_band_thread, bands, sizeof(RowBand), num_threads);
+}
+
+typedef struct {
+    int dtype;
+    void *X;
+    int cols;
+    size_t row_bytes;
+    float lo, hi;
+    uint64_t seed;
+} FillArgs;
+
+static void fill_uniform_rows(void *ctx, int start_row, int end_row) {
+    FillArgs *f = (FillArgs *)ctx;
+    for (size_t i = (size_t)start_row * f->cols; i < (size_t)end_row * f->cols; i++) {
+        float v = f->lo + (f->hi - f->lo) * rng_uniform(f->seed, i);
+        switch (f->dtype) {
+            case DTYPE_F16: ((uint16_t *)f->X)[i] = float_to_half(v); break;
+            case DTYPE_BF16: ((uint16_t *)f->X)[i] = float_to_bf16(v); break;
+            default: ((float *)f->X)[i] = v; break;
+        }
+    }
+}
+
+static void fill_zero_rows(void *ctx, int start_row, int end_row) {
+    FillArgs *f = (FillArgs *)ctx;
+    memset((char *)f->X + start_row * f->row_bytes, 0, (end_row - start_row) * f->row_bytes);
+}
+
+// X[rows x cols] uniform in [lo, hi), stored as dtype. The values depend only on seed, not on the thread count.
+void init_uniform(int dtype, void *X, int rows, int cols, float lo, float hi, uint64_t seed, int num_threads) {
+    FillArgs f = {dtype, X, cols, 0, lo, hi, seed};
+    parallel_rows(rows, num_threads, fill_uniform_rows, &f);
+}
+
+// Zero rows x row_bytes, any element type
+void init_zero(void *X, int rows, size_t row_bytes, int num_threads) {
+    FillArgs f = {0, X, 0, row_bytes, 0.0f, 0.0f, 0};
+    parallel_rows(rows, num_threads, fill_zero_rows, &f);
+}
+
+// Widened fp32 copy of a 16-bit operand, or NULL when it already is fp32
+float *widen_f32(int dtype, const void *src, size_t n) {
+    if (dtype == DTYPE_F32) return NULL;
+    float *dst = (float *)aligned_alloc(CACHE_LINE_SIZE, (n * sizeof(float) + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE);
+    if (!dst) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(1);
+    }
+    convert_to_f32(dtype, src, dst, n);
+    return dst;
+}
+
+// Shared by matmul_ex and sgemm_ex. stream: C is write-only (beta = 0), see matmul_stream_thread.
+// How many K slices the blocked path runs as: more than 1 only when C has fewer MC x NC blocks than there are
+// threads, every slice keeps SPLITK_MIN_K and the partial Cs fit in SPLITK_MAX_BYTES. O5_SPLITK=n forces n.
+int splitk_splits(int M, int N, int K, int num_threads) {
+    long blocks = (long)((M + MC - 1) / MC) * ((N + NC - 1) / NC);
+    const char *env = getenv("O5_SPLITK");
+    long s;
+    if (env && *env) {
+        s = atoi(env);
+    } else {
+        if (blocks >= num_threads) return 1;
+        s = num_threads / blocks;
+        if (s > K / SPLITK_MIN_K) s = K / SPLITK_MIN_K;
+        if (s > (long)(SPLITK_MAX_BYTES / ((size_t)M * N * sizeof(float)))) s = SPLITK_MAX_BYTES / ((size_t)M * N * sizeof(float));
+    }
+    if (s > num_threads) s = num_threads;
+    if (s > (K + KC - 1) / KC) s = (K + KC - 1) / KC;
+    return s < 1 ? 1 : (int)s;
+}
+
+typedef struct {
+    ThreadArgs t;
+    int k_start, k_end; // this slice of K, in whole KC blocks
+    float *P;           // the slice's private M x N partial C
+} SplitKArgs;
+
+// matmul_thread over one K slice, into the slice's partial C
+void *matmul_splitk_thread(void *arg) {
+    SplitKArgs *args = (SplitKArgs *)arg;
+    ThreadArgs *t = &args->t;
+    int N = t->N, K = t->K;
+    int kc = args->k_end - args->k_start < KC ? args->k_end - args->k_start : KC;
+    int mc = t->end_row - t->start_row < MC ? (t->end_row - t->start_row + MR - 1) / MR * MR : MC;
+    int nc = N < NC ? (N + NR - 1) / NR * NR : NC;
+    if (t->end_row <= t->start_row) return NULL;
+    size_t ac_size = ((size_t)mc * kc + 15) / 16 * 16;
+    size_t buf_bytes = (ac_size + (size_t)kc * nc) * sizeof(float);
+    float *Ac = (float *)alloc_pages(buf_bytes);
+    float *Bc = Ac + ac_size;
+
+    for (int i = t->start_row; i < t->end_row; i += MC) {
+        int mb = (i + MC <= t->end_row) ? MC : t->end_row - i;
+        for (int k = args->k_start; k < args->k_end; k += KC) {
+            int kb = (k + KC <= args->k_end) ? KC : args->k_end - k;
+            pack_a(t->a_dtype, mb, kb, elem_at(t->a_dtype, t->A, (size_t)i * K + k), K, Ac);
+            for (int j = 0; j < N; j += NC) {
+                int nb = (j + NC <= N) ? NC : N - j;
+                pack_b(t->b_dtype, kb, nb, elem_at(t->b_dtype, t->B, (size_t)k * N + j), N, Bc);
+                compute_kernel(mb, nb, kb, Ac, Bc, &args->P[(size_t)i * N + j], N, NULL, i, j);
+            }
+        }
+    }
+
+    free_pages(Ac, buf_bytes);
+    return NULL;
+}
+
+typedef struct {
+    float *C;
+    float *P; // splits partials of M x N
+    int M, N, splits;
+    const Epilogue *ep;
+} SplitKReduce;
+
+// Rows of the partials summed as a pairwise tree in a fixed order (P0 += P1, P2 += P3, then P0 += P2, ...),
+// then C = ep(C + P0). The order depends only on the split count, never on which thread finished first.
+static void splitk_reduce_rows(void *ctx, int start_row, int end_row) {
+    SplitKReduce *r = (SplitKReduce *)ctx;
+    size_t plane = (size_t)r->M * r->N;
+    int N = r->N;
+    for (int i = start_row; i < end_row; i++) {
+        for (int step = 1; step < r->splits; step *= 2) {
+            for (int s = 0; s + step < r->splits; s += 2 * step) {
+                float *dst = &r->P[s * plane + (size_t)i * N];
+                const float *src = &r->P[(s + step) * plane + (size_t)i * N];
+                int j = 0;
+                for (; j + 8 <= N; j += 8) _mm256_storeu_ps(&dst[j], _mm256_add_ps(_mm256_loadu_ps(&dst[j]), _mm256_loadu_ps(&src[j])));
+                for (; j < N; j++) dst[j] += src[j];
+            }
+        }
+        const float *sum = &r->P[(size_t)i * N];
+        float *c = &r->C[(size_t)i * N];
+        int j = 0;
+        for (; j + 8 <= N; j += 8) {
+            __m256 v = _mm256_add_ps(_mm256_loadu_ps(&c[j]), _mm256_loadu_ps(&sum[j]));
+            _mm256_storeu_ps(&c[j], r->ep ? epilogue8(r->ep, v, i, j) : v);
+        }
+        for (; j < N; j++) c[j] = r->ep ? epilogue1(r->ep, c[j] + sum[j], i, j) : c[j] + sum[j];
+    }
+}
+
+// Blocked path with K split in `splits` slices of whole KC blocks. Every slice gets num_threads / splits
+// threads over its rows and a private partial C; the partials are reduced by splitk_reduce_rows.
+static void matmul_splitk(const void *A, int a_dtype, const void *B, int b_dtype, float *C, int M, int N, int K,
+                          const Epilogue *ep, int splits, int num_threads) {
+    SplitKArgs args[MAX_THREADS];
+    int per_split = num_threads / splits;
+    int kblocks = (K + KC - 1) / KC;
+    size_t p_bytes = (size_t)splits * M * N * sizeof(float);
+    float *P = (float *)alloc_pages(p_bytes); // zero filled, the kernel accumulates into it
+
+    for (int s = 0; s < splits; s++) {
+        for (int r = 0; r < per_split; r++) {
+            SplitKArgs *a = &args[s * per_split + r];
+            a->t = (ThreadArgs){A, B, NULL, M, N, K, a_dtype, b_dtype};
+            a->t.start_row = (int)((long)M * r / per_split);
+            a->t.end_row = (int)((long)M * (r + 1) / per_split);
+            a->k_start = kblocks * s / splits * KC;
+            a->k_end = kblocks * (s + 1) / splits * KC < K ? kblocks * (s + 1) / splits * KC : K;
+            a->P = P + (size_t)s * M * N;
+        }
+    }
+    launch_threads(matmul_splitk_thread, args, sizeof(SplitKArgs), splits * per_split);
+
+    SplitKReduce reduce = {C, P, M, N, splits, ep};
+    parallel_rows(M, num_threads, splitk_reduce_rows, &reduce);
+    free_pages(P, p_bytes);
+}
+
+// One L3 domain's share of the blocked path: its workers pack each KC x NC block of B into one shared Bc
+// (a slice of the NR panels each), then each computes its own rows against it
+typedef struct {
+    pthread_barrier_t barrier;
+    float *Bc;
+    int start_col, end_col;
+    int nthreads;
+} DomainShare;
+
+typedef struct {
+    ThreadArgs t; // rows: this worker's share of M
+    DomainShare *dom;
+    int rank;     // within the domain
+} SharedArgs;
+
+void *matmul_shared_thread(void *arg) {
+    SharedArgs *args = (SharedArgs *)arg;
+    const ThreadArgs *t = &args->t;
+    DomainShare *dom = args->dom;
+    int N = t->N, K = t->K;
+    int kc = K < KC ? K : KC;
+    int mc = t->end_row - t->start_row < MC ? (t->end_row - t->start_row + MR - 1) / MR * MR : MC;
+    size_t buf_bytes = ((size_t)mc * kc + 15) / 16 * 16 * sizeof(float);
+    float *Ac = mc ? (float *)alloc_pages(buf_bytes) : NULL;
+
+    for (int j = dom->start_col; j < dom->end_col; j += NC) {
+        int nb = (j + NC <= dom->end_col) ? NC : dom->end_col - j;
+        int panels = (nb + NR - 1) / NR;
+
+        for (int k = 0; k < K; k += KC) {
+            int kb = (k + KC <= K) ? KC : K - k;
+            const Epilogue *ep = (k + kb >= K) ? t->ep : NULL;
+
+            // This worker's panels of the shared block; only the last slice can hold a partial panel
+            int p0 = panels * args->rank / dom->nthreads, p1 = panels * (args->rank + 1) / dom->nthreads;
+            int c1 = p1 * NR < nb ? p1 * NR : nb;
+            if (p1 > p0) {
+                pack_b(t->b_dtype, kb, c1 - p0 * NR, elem_at(t->b_dtype, t->B, (size_t)k * N + j + p0 * NR), N,
+                       &dom->Bc[(size_t)kb * p0 * NR]);
+            }
+            pthread_barrier_wait(&dom->barrier);
+
+            for (int i = t->start_row; i < t->end_row; i += MC) {
+                int mb = (i + MC <= t->end_row) ? MC : t->end_row - i;
+                pack_a(t->a_dtype, mb, kb, elem_at(t->a_dtype, t->A, (size_t)i * K + k), K, Ac);
+                compute_kernel(mb, nb, kb, Ac, dom->Bc, &t->C[(size_t)i * N + j], N, ep, i, j);
+            }
+            // Everyone is done with the block before it is repacked
+            pthread_barrier_wait(&dom->barrier);
+        }
+    }
+
+    if (Ac) free_pages(Ac, buf_bytes);
+    return NULL;
+}
+
+// Blocked path for pinned workers: columns are split over the L3 domains in NR panels, in proportion to their
+// workers, and rows over the workers of a domain. B is packed once per domain instead of once per thread.
+static void matmul_shared(const void *A, int a_dtype, const void *B, int b_dtype, float *C, int M, int N, int K,
+                          const Epilogue *ep, const HwThread *order, int n, int num_threads) {
+    SharedArgs args[MAX_THREADS];
+    DomainShare doms[MAX_DOMAINS];
+    int count[MAX_DOMAINS] = {0}, rank[MAX_THREADS];
+    int kc = K < KC ? K : KC;
+
+    for (int i = 0; i < num_threads; i++) rank[i] = count[order[i % n].domain]++;
+
+    int col_panels = (N + NR - 1) / NR, done = 0;
+    for (int d = 0; d < hw_domains; d++) {
+        DomainShare *dom = &doms[d];
+        int p0 = (int)((long)col_panels * done / num_threads);
+        done += count[d];
+        int p1 = (int)((long)col_panels * done / num_threads);
+        dom->start_col = p0 * NR;
+        dom->end_col = p1 * NR < N ? p1 * NR : N;
+        dom->nthreads = count[d];
+        if (!count[d]) continue;
+        int width = dom->end_col - dom->start_col < NC ? (dom->end_col - dom->start_col + NR - 1) / NR * NR : NC;
+        dom->Bc = width ? (float *)alloc_pages((size_t)kc * width * sizeof(float)) : NULL;
+        pthread_barrier_init(&dom->barrier, NULL, count[d]);
+    }
+
+    for (int i = 0; i < num_threads; i++) {
+        int d = order[i % n].domain;
+        SharedArgs *a = &args[i];
+        a->t = (ThreadArgs){A, B, C, M, N, K, a_dtype, b_dtype};
+        a->t.start_row = (int)((long)M * rank[i] / count[d]);
+        a->t.end_row = (int)((long)M * (rank[i] + 1) / count[d]);
+        a->t.ep = ep;
+        a->dom = &doms[d];
+        a->rank = rank[i];
+    }
+    launch_threads(matmul_shared_thread, args, sizeof(SharedArgs), num_threads);
+
+    for (int d = 0; d < hw_domains; d++) {
+        if (!count[d]) continue;
+        pthread_barrier_destroy(&doms[d].barrier);
+        int width = doms[d].end_col - doms[d].start_col < NC ? (doms[d].end_col - doms[d].start_col + NR - 1) / NR * NR : NC;
+        if (doms[d].Bc) free_pages(doms[d].Bc, (size_t)kc * width * sizeof(float));
+    }
+}
+
+static void matmul_dispatch(const void *A, int a_dtype, const void *B, int b_dtype, float *C, int M, int N, int K,
+                            const Epilogue *ep, int stream, int num_threads) {
+    ThreadArgs thread_args[MAX_THREADS];
+    void *(*fn)(void *) = matmul_thread;
+    float *widened = NULL;
+
+    num_threads = worker_count(num_threads);
+    if (num_threads > MAX_THREADS) num_threads = MAX_THREADS;
+
+    int splits = (stream || N <= GEMV_MAX_N || M <= SMALL_M) ? 1 : splitk_splits(M, N, K, num_threads);
+    if (splits > 1) {
+        matmul_splitk(A, a_dtype, B, b_dtype, C, M, N, K, ep, splits, num_threads);
+        return;
+    }
+
+    if (N <= GEMV_MAX_N) {
+        // Only A is streamed, so a 16-bit x is widened once up front
+        if ((widened = widen_f32(b_dtype, B, K))) {
+            B = widened;
+            b_dtype = DTYPE_F32;
+        }
+        // Split rows in multiples of 4 so every thread runs the 4-row kernel
+        fn = gemv_thread;
+        int groups = (M + 3) / 4;
+        int max_threads = (M + SKINNY_MIN_WORK - 1) / SKINNY_MIN_WORK;
+        if (num_threads > max_threads) num_threads = max_threads;
+        for (int i = 0; i < num_threads; i++) {
+            thread_args[i].start_row = (int)((long)groups * i / num_threads) * 4;
+            thread_args[i].end_row = (int)((long)groups * (i + 1) / num_threads) * 4;
+            if (thread_args[i].end_row > M) thread_args[i].end_row = M;
+        }
+    } else if (M <= SMALL_M) {
+        // Only B is streamed, so a 16-bit A (at most SMALL_M rows) is widened once up front
+        if ((widened = widen_f32(a_dtype, A, (size_t)M * K))) {
+            A = widened;
+            a_dtype = DTYPE_F32;
+        }
+
+        // Split columns in multiples of the 16-wide strip
+        fn = small_m_thread;
+        int strips = (N + 15) / 16;
+        int max_threads = (N + SKINNY_MIN_WORK - 1) / SKINNY_MIN_WORK;
+        if (num_threads > max_threads) num_threads = max_threads;
+        for (int i = 0; i < num_threads; i++) {
+            thread_args[i].start_col = (int)((long)strips * i / num_threads) * 16;
+            thread_args[i].end_col = (int)((long)strips * (i + 1) / num_threads) * 16;
+            if (thread_args[i].end_col > N) thread_args[i].end_col = N;
+        }
+    } else {
+        HwThread order[MAX_CPUS];
+        int n = worker_placement(order);
+        if (stream) fn = matmul_stream_thread;
+        else if (pipeline_packing()) fn = matmul_pipeline_thread;
+        else if (n && num_threads > 1) {
+            matmul_shared(A, a_dtype, B, b_dtype, C, M, N, K, ep, order, n, num_threads);
+            return;
+        }
+        for (int i = 0; i < num_threads; i++) {
+            thread_args[i].start_row = (M * i) / num_threads;
+            thread_args[i].end_row = (M * (i + 1)) / num_threads;
+            thread_args[i].start_col = 0;
+            thread_args[i].end_col = N;
+        }
+    }
+
+    for (int i = 0; i < num_threads; i++) {
+        thread_args[i].A = A;
+        thread_args[i].B = B;
+        thread_args[i].C = C;
+        thread_args[i].M = M;
+        thread_args[i].N = N;
+        thread_args[i].K = K;
+        thread_args[i].a_dtype = a_dtype;
+        thread_args[i].b_dtype = b_dtype;
+        thread_args[i].Bp = NULL;
+        thread_args[i].ep = ep;
+    }
+
+    launch_threads(fn, thread_args, sizeof(ThreadArgs), num_threads);
+    free(widened);
+}
+
+// C += A B with A and B stored as DTYPE_F32 / DTYPE_F16 / DTYPE_BF16, dispatched on shape.
+// With ep, C = act(scale * (C + A B) + bias) + residual, fused into the final store.
+void matmul_ex(const void *A, int a_dtype, const void *B, int b_dtype, float *C, int M, int N, int K,
+               const Epilogue *ep, int num_threads) {
+    matmul_dispatch(A, a_dtype, B, b_dtype, C, M, N, K, ep, 0, num_threads);
+}
+
+// Whether a beta = 0 call streams C out: only the blocked path (not GEMV / small-M), and only once
+// C is well past L3. O5_STREAM=0 / 1 overrides the size check.
+int stream_stores(int M, int N) {
+    if (N <= GEMV_MAX_N || M <= SMALL_M) return 0;
+    const char *env = getenv("O5_STREAM");
+    if (env && *env) return atoi(env) != 0;
+    return (size_t)M * N * sizeof(float) > STREAM_MIN_BYTES;
+}
+
+typedef struct {
+    float *C;
+    int N;
+    float beta;
+} ScaleArgs;
+
+static void scale_rows(void *ctx, int start_row, int end_row) {
+    ScaleArgs *s = (ScaleArgs *)ctx;
+    for (size_t i = (size_t)start_row * s->N; i < (size_t)end_row * s->N; i++) s->C[i] *= s->beta;
+}
+
+// C = A B + beta C (epilogue as in matmul_ex). With beta = 0 C is never read, so it may hold garbage,
+// and a large C is written with streaming stores instead of being read for ownership first.
+void sgemm_ex(const void *A, int a_dtype, const void *B, int b_dtype, float *C, int M, int N, int K, float beta,
+              const Epilogue *ep, int num_threads) {
+    if (beta == 0.0f && stream_stores(M, N)) {
+        matmul_dispatch(A, a_dtype, B, b_dtype, C, M, N, K, ep, 1, num_threads);
+        return;
+    }
+    if (beta == 0.0f) {
+        init_zero(C, M, (size_t)N * sizeof(float), num_threads);
+    } else if (beta != 1.0f) {
+        ScaleArgs s = {C, N, beta};
+        parallel_rows(M, num_threads, scale_rows, &s);
+    }
+    matmul_ex(A, a_dtype, B, b_dtype, C, M, N, K, ep, num_threads);
+}
+
+// Handle for a GEMM running in the background, see sgemm_async
+typedef struct GemmEvent {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int done;
+
+    const void *A, *B;
+    int a_dtype, b_dtype;
+    float *C;
+    int M, N, K;
+    float beta;
+    Epilogue ep;
+    int has_ep;
+    int num_threads;
+    void (*callback)(void *user);
+    void *user;
+} GemmEvent;
+
+void *gemm_event_thread(void *arg) {
+    GemmEvent *e = (GemmEvent *)arg;
+    sgemm_ex(e->A, e->a_dtype, e->B, e->b_dtype, e->C, e->M, e->N, e->K, e->beta, e->has_ep ? &e->ep : NULL, e->num_threads);
+    if (e->callback) e->callback(e->user);
+
+    pthread_mutex_lock(&e->lock);
+    e->done = 1;
+    pthread_cond_broadcast(&e->cond);
+    pthread_mutex_unlock(&e->lock);
+    return NULL;
+}
+
+// sgemm_ex in the background: returns at once, the caller keeps working and collects the result with
+// sgemm_wait. callback (may be NULL) runs on the GEMM's thread once C is complete, before sgemm_wait returns.
+// A, B, C and whatever ep points to must stay valid until then (the Epilogue itself is copied).
+GemmEvent *sgemm_async(const void *A, int a_dtype, const void *B, int b_dtype, float *C, int M, int N, int K, float beta,
+                       const Epilogue *ep, int num_threads, void (*callback)(void *user), void *user) {
+    GemmEvent *e = (GemmEvent *)calloc(1, sizeof(GemmEvent));
+    if (!e) {
+        fprintf(stderr, "Failed to allocate GEMM event\n");
+        exit(1);
+    }
+    e->A = A;
+    e->B = B;
+    e->a_dtype = a_dtype;
+    e->b_dtype = b_dtype;
+    e->C = C;
+    e->M = M;
+    e->N = N;
+    e->K = K;
+    e->beta = beta;
+    if (ep) e->ep = *ep;
+    e->has_ep = ep != NULL;
+    e->num_threads = num_threads;
+    e->callback = callback;
+    e->user = user;
+    pthread_mutex_init(&e->lock, NULL);
+    pthread_cond_init(&e->cond, NULL);
+    if (pthread_create(&e->thread, NULL, gemm_event_thread, e) != 0) {
+        fprintf(stderr, "Failed to create GEMM thread\n");
+        exit(1);
+    }
+    return e;
+}
+
+// 1 once the GEMM (and its callback) finished, 0 while it runs. Never blocks.
+int sgemm_test(GemmEvent *e) {
+    pthread_mutex_lock(&e->lock);
+    int done = e->done;
+    pthread_mutex_unlock(&e->lock);
+    return done;
+}
+
+// Block until the GEMM finished, then release the event. Exactly once per sgemm_async.
+void sgemm_wait(GemmEvent *e) {
+    pthread_mutex_lock(&e->lock);
+    while (!e->done) pthread_cond_wait(&e->cond, &e->lock);
+    pthread_mutex_unlock(&e->lock);
+    pthread_join(e->thread, NULL);
+    pthread_mutex_destroy(&e->lock);
+    pthread_cond_destroy(&e->cond);
+    free(e);
+}
+
+// C += A B, dispatched on shape
+void matmul(float *A, float *B, float *C, int M, int N, int K, int num_threads) {
+    matmul_ex(A, DTYPE_F32, B, DTYPE_F32, C, M, N, K, NULL, num_threads);
+}
+
+// Pack B[K x N] once into the micro-kernel's panel layout. Block (k, j) sits at k * Np + kb * j.
+// A 16-bit B is widened here, so the packed copy is always fp32.
+PackedB *sgemm_pack_b_ex(const void *B, int dtype, int K, int N) {
+    PackedB *p = (PackedB *)calloc(1, sizeof(PackedB));
+    if (!p) {
+        fprintf(stderr, "Failed to allocate packed B\n");
+        exit(1);
+    }
+    p->K = K;
+    p->N = N;
+    p->Np = (N + NR - 1) / NR * NR;
+    p->bytes = (size_t)K * p->Np * sizeof(float);
+    p->data = (float *)alloc_matrix(p->bytes);
+
+    for (int k = 0; k < K; k += KC) {
+        int kb = (k + KC <= K) ? KC : K - k;
+        for (int j = 0; j < N; j += NC) {
+            int nb = (j + NC <= N) ? NC : N - j;
+            pack_b(dtype, kb, nb, elem_at(dtype, B, (size_t)k * N + j), N, &p->data[(size_t)k * p->Np + (size_t)kb * j]);
+        }
+    }
+    return p;
+}
+
+PackedB *sgemm_pack_b(const float *B, int K, int N) {
+    return sgemm_pack_b_ex(B, DTYPE_F32, K, N);
+}
+
+void sgemm_packed_free(PackedB *p) {
+    if (!p) return;
+    if (p->map) {
+        munmap(p->map, p->map_size);
+    } else {
+        free_matrix(p->data, p->bytes);
+    }
+    free(p);
+}
+
+// C[M x N] += A[M x K] B, with B pre-packed. Threads are laid out as a grid over
+// MR-row and NR-column tiles, so small M still keeps every thread busy. ep as in matmul_ex.
+void sgemm_compute_packed_ex(const void *A, int a_dtype, const PackedB *Bp, float *C, int M, const Epilogue *ep, int num_threads) {
+    ThreadArgs thread_args[MAX_THREADS];
+    int N = Bp->N, K = Bp->K;
+    if (M <= 0 || N <= 0) return;
+
+    num_threads = worker_count(num_threads);
+    if (num_threads > MAX_THREADS) num_threads = MAX_THREADS;
+    int row_tiles = (M + MR - 1) / MR;
+    int col_tiles = (N + NR - 1) / NR;
+    int tr = num_threads < row_tiles ? num_threads : row_tiles;
+    int tc = num_threads / tr;
+    if (tc > col_tiles) tc = col_tiles;
+    num_threads = tr * tc;
+
+    for (int r = 0; r < tr; r++) {
+        for (int c = 0; c < tc; c++) {
+            ThreadArgs *t = &thread_args[r * tc + c];
+            t->A = A;
+            t->B = NULL;
+            t->C = C;
+            t->M = M;
+            t->N = N;
+            t->K = K;
+            t->a_dtype = a_dtype;
+            t->b_dtype = DTYPE_F32;
+            t->start_row = row_tiles * r / tr * MR;
+            t->end_row = row_tiles * (r + 1) / tr * MR;
+            if (t->end_row > M) t->end_row = M;
+            t->start_col = col_tiles * c / tc * NR;
+            t->end_col = col_tiles * (c + 1) / tc * NR;
+            if (t->end_col > N) t->end_col = N;
+            t->Bp = Bp->data;
+            t->Np = Bp->Np;
+            t->ep = ep;
+        }
+    }
+
+    launch_threads(pipeline_packing() ? matmul_pipeline_thread : matmul_thread, thread_args, sizeof(ThreadArgs), num_threads);
+}
+
+void sgemm_compute_packed(float *A, const PackedB *Bp, float *C, int M, int num_threads) {
+    sgemm_compute_packed_ex(A, DTYPE_F32, Bp, C, M, NULL, num_threads);
+}
+
+// On-disk packed B: a page sized header followed by the panels, so the file can be mmapped as is
+#define PACKED_B_MAGIC 0x42503530 // "05PB"
+#define PACKED_B_HEADER 4096
+
+typedef struct {
+    unsigned int magic;
+    int K, N, Np;
+    int mr, nr, kc, nc; // layout is only valid for the blocking it was packed with
+} PackedBHeader;
+
+int sgemm_packed_save(const PackedB *p, const char *path) {
+    char ALIGN header[PACKED_B_HEADER] = {0};
+    PackedBHeader h = {PACKED_B_MAGIC, p->K, p->N, p->Np, MR, NR, KC, NC};
+    memcpy(header, &h, sizeof(h));
+
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+    if (fwrite(header, 1, PACKED_B_HEADER, f) != PACKED_B_HEADER || fwrite(p->data, 1, p->bytes, f) != p->bytes) {
+        perror(path);
+        fclose(f);
+        return -1;
+    }
+    return fclose(f) == 0 ? 0 : -1;
+}
+
+// Map a packed B written by sgemm_packed_save. Pages are faulted in lazily and shared with
+// every other process mapping the same file.
+PackedB *sgemm_packed_load(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror(path);
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < PACKED_B_HEADER) {
+        fprintf(stderr, "%s: not a packed B file\n", path);
+        close(fd);
+        return NULL;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror(path);
+        return NULL;
+    }
+
+    // The shape must be the one sgemm_pack_b_ex would have written, or compute indexes past the mapping
+    PackedBHeader h;
+    memcpy(&h, map, sizeof(h));
+    int shape_ok = h.K > 0 && h.N > 0 && h.Np == (int)(((long)h.N + NR - 1) / NR * NR);
+    size_t bytes = shape_ok ? (size_t)h.K * h.Np * sizeof(float) : 0;
+    if (h.magic != PACKED_B_MAGIC || h.mr != MR || h.nr != NR || h.kc != KC || h.nc != NC || !shape_ok ||
+        (size_t)st.st_size - PACKED_B_HEADER < bytes) {
+        fprintf(stderr, "%s: packed B header does not match this build\n", path);
+        munmap(map, st.st_size);
+        return NULL;
+    }
+
+    PackedB *p = (PackedB *)calloc(1, sizeof(PackedB));
+    if (!p) {
+        fprintf(stderr, "Failed to allocate packed B\n");
+        exit(1);
+    }
+    p->K = h.K;
+    p->N = h.N;
+    p->Np = h.Np;
+    p->data = (float *)((char *)map + PACKED_B_HEADER);
+    p->bytes = bytes;
+    p->map = map;
+    p->map_size = st.st_size;
+    return p;
+}
+
+// C = A B on matrix files (see matfile.h). A and B are f32 / f16 / bf16 in either layout,
+// C must be a dense row-major f32 M x N, e.g. from mat_create. Returns 0, or -1 on a mismatch.
+int matmul_mat(const Matrix *A, const Matrix *B, Matrix *C, const Epilogue *ep, int num_threads) {
+    if (A->dtype > MAT_BF16 || B->dtype > MAT_BF16 || C->dtype != MAT_F32 || C->layout != MAT_ROW_MAJOR || C->ld != C->cols ||
+        A->cols != B->rows || C->rows != A->rows || C->cols != B->cols) {
+        fprintf(stderr, "matmul_mat: shapes / types do not match (%dx%d %s, %dx%d %s -> %dx%d %s)\n",
+                A->rows, A->cols, mat_dtype_names[A->dtype], B->rows, B->cols, mat_dtype_names[B->dtype],
+                C->rows, C->cols, mat_dtype_names[C->dtype]);
+        return -1;
+    }
+
+    void *a_copy, *b_copy;
+    const void *a = mat_dense(A, &a_copy);
+    const void *b = mat_dense(B, &b_copy);
+    memset(C->data, 0, (size_t)C->rows * C->cols * sizeof(float));
+    matmul_ex(a, A->dtype, b, B->dtype, (float *)C->data, A->rows, B->cols, A->cols, ep, num_threads);
+    free(a_copy);
+    free(b_copy);
+    return 0;
+}
+
+double get_time() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+// Telemetry for a measured run: a background thread samples the clock of the CPUs the run's workers are placed
+// on (cpufreq, or "cpu MHz" in /proc/cpuinfo without it) and the RAPL package energy counters, when readable.
+// Idle CPUs are left out: a parked core sits below base clock and would read as throttling.
+#define TELEMETRY_INTERVAL_US 10000
+#define MAX_RAPL 8
+
+typedef struct {
+    pthread_t thread;
+    int stop;
+    int cpus[MAX_CPUS];      // sampled: the workers' hardware threads, every allowed CPU when unpinned
+    int ncpus;
+    int samples;
+    double ghz_min, ghz_sum; // lowest sampled CPU over all samples; sum of per-sample averages
+    int ghz_cores;           // CPUs with a readable clock, 0 when none is
+    double base_ghz;         // below this under load is throttling, 0 when unknown
+    long long energy_uj[MAX_RAPL], range_uj[MAX_RAPL];
+    int rapl;                // package domains with a readable counter
+    double joules;
+    long throttle_events;    // thermal_throttle counters, summed over the sampled CPUs
+    int throttled;           // throttle events, or a sampled CPU below base clock
+    double start_time, seconds;
+} Telemetry;
+
+static long long sysfs_ll(const char *path) {
+    FILE *f = fopen(path, "r");
+    long long v = -1;
+    if (f && fscanf(f, "%lld", &v) != 1) v = -1;
+    if (f) fclose(f);
+    return v;
+}
+
+static int telemetry_has_cpu(const Telemetry *t, int cpu) {
+    for (int i = 0; i < t->ncpus; i++) {
+        if (t->cpus[i] == cpu) return 1;
+    }
+    return 0;
+}
+
+static long throttle_count(const Telemetry *t) {
+    char path[128];
+    long total = 0;
+    for (int i = 0; i < t->ncpus; i++) {
+        const char *files[] = {"core_throttle_count", "package_throttle_count"};
+        for (int f = 0; f < 2; f++) {
+            snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/thermal_throttle/%s", t->cpus[i], files[f]);
+            long long v = sysfs_ll(path);
+            if (v > 0) total += v;
+        }
+    }
+    return total;
+}
+
+static void telemetry_sample(Telemetry *t) {
+    char path[128];
+    double sum = 0.0, lo = 0.0;
+    int n = 0;
+    for (int i = 0; i < t->ncpus; i++) {
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cpufreq/scaling_cur_freq", t->cpus[i]);
+        long long khz = sysfs_ll(path);
+        if (khz <= 0) continue;
+        double ghz = khz * 1e-6;
+        sum += ghz;
+        if (!n++ || ghz < lo) lo = ghz;
+    }
+    if (!n) {
+        // No cpufreq (VMs): "cpu MHz" of the sampled processors
+        char line[256];
+        double mhz;
+        int cpu = -1;
+        FILE *f = fopen("/proc/cpuinfo", "r");
+        while (f && fgets(line, sizeof(line), f)) {
+            if (sscanf(line, "processor : %d", &cpu) == 1) continue;
+            if (sscanf(line, "cpu MHz : %lf", &mhz) != 1 || mhz <= 0 || !telemetry_has_cpu(t, cpu)) continue;
+            sum += mhz * 1e-3;
+            if (!n++ || mhz * 1e-3 < lo) lo = mhz * 1e-3;
+        }
+        if (f) fclose(f);
+    }
+    if (n) {
+        if (!t->samples || lo < t->ghz_min) t->ghz_min = lo;
+        t->ghz_sum += sum / n;
+        t->ghz_cores = n;
+        t->samples++;
+    }
+
+    // Energy since the last sample, across counter wraparound
+    for (int d = 0; d < t->rapl; d++) {
+        snprintf(path, sizeof(path), "/sys/class/powercap/intel-rapl:%d/energy_uj", d);
+        long long e = sysfs_ll(path);
+        if (e < 0) continue;
+        long long delta = e - t->energy_uj[d];
+        if (delta < 0) delta += t->range_uj[d];
+        t->joules += delta * 1e-6;
+        t->energy_uj[d] = e;
+    }
+}
+
+static void *telemetry_thread(void *arg) {
+    Telemetry *t = (Telemetry *)arg;
+    while (!__atomic_load_n(&t->stop, __ATOMIC_ACQUIRE)) {
+        usleep(TELEMETRY_INTERVAL_US);
+        telemetry_sample(t);
+    }
+    return NULL;
+}
+
+// Starts sampling and timing a run on num_threads workers. The sampler itself is left unpinned so it never
+// shares a worker's hardware thread for long.
+void telemetry_start(Telemetry *t, int num_threads) {
+    char path[128];
+    HwThread order[MAX_CPUS];
+    memset(t, 0, sizeof(*t));
+    int n = worker_placement(order); // runs hw_topology_init
+    if (n) {
+        num_threads = worker_count(num_threads);
+        for (int i = 0; i < num_threads; i++) {
+            if (!telemetry_has_cpu(t, order[i % n].cpu)) t->cpus[t->ncpus++] = order[i % n].cpu;
+        }
+    } else {
+        for (int i = 0; i < hw_count; i++) t->cpus[t->ncpus++] = hw_threads[i].cpu;
+    }
+    for (int d = 0; d < MAX_RAPL; d++) {
+        snprintf(path, sizeof(path), "/sys/class/powercap/intel-rapl:%d/energy_uj", d);
+        long long e = sysfs_ll(path);
+        if (e < 0) break;
+        snprintf(path, sizeof(path), "/sys/class/powercap/intel-rapl:%d/max_energy_range_uj", d);
+        t->energy_uj[d] = e;
+        t->range_uj[d] = sysfs_ll(path);
+        t->rapl = d + 1;
+    }
+    long long base_khz = -1;
+    if (t->ncpus) {
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cpufreq/base_frequency", t->cpus[0]);
+        base_khz = sysfs_ll(path);
+    }
+    t->base_ghz = base_khz > 0 ? base_khz * 1e-6 : 0.0;
+    t->throttle_events = throttle_count(t);
+    if (pthread_create(&t->thread, NULL, telemetry_thread, t) != 0) {
+        fprintf(stderr, "Failed to create telemetry thread\n");
+        exit(1);
+    }
+    t->start_time = get_time();
+}
+
+// Stops sampling, returns the seconds since telemetry_start
+double telemetry_stop(Telemetry *t) {
+    t->seconds = get_time() - t->start_time;
+    __atomic_store_n(&t->stop, 1, __ATOMIC_RELEASE);
+    pthread_join(t->thread, NULL);
+    telemetry_sample(t); // runs shorter than one interval still get a sample
+    t->throttle_events = throttle_count(t) - t->throttle_events;
+    t->throttled = t->throttle_events > 0 || (t->samples && t->base_ghz > 0 && t->ghz_min < t->base_ghz);
+    return t->seconds;
+}
+
+// One line next to a result: clocks, GFLOPS per GHz of the average clock, package power and GFLOPS per watt.
+// THROTTLED when the CPU counted thermal throttling events or a worker's CPU ran below its base clock.
+void telemetry_report(const Telemetry *t, const char *name, double gflops) {
+    printf("Telemetry, %s:", name);
+    if (t->samples) {
+        double avg = t->ghz_sum / t->samples;
+        printf(" clock min %.2f avg %.2f GHz over %d CPUs (%d samples), %.2f GFLOPS/GHz", t->ghz_min, avg,
+               t->ghz_cores, t->samples, gflops / avg);
+    } else {
+        printf(" clock unreadable");
+    }
+    if (t->rapl && t->joules > 0) {
+        double watts = t->joules / t->seconds;
+        printf(", package %.1f W, %.2f GFLOPS/W", watts, gflops / watts);
+    } else {
+        printf(", package power unreadable");
+    }
+    if (t->throttled) {
+        int below_base = t->samples && t->base_ghz > 0 && t->ghz_min < t->base_ghz;
+        printf(", THROTTLED (");
+        if (t->throttle_events > 0) printf("%ld throttle events%s", t->throttle_events, below_base ? ", " : "");
+        if (below_base) printf("min clock below base %.2f GHz", t->base_ghz);
+        printf(")");
+    }
+    printf("\n");
+}
+
+// Result history: every harness's main appends one JSON line per measured run to O5_RESULTS (default
+// results.jsonl in the working directory, "none" to skip), keyed by commit, kernel, shape, dtype, threads, CPU
+// and build flags.
+// results.py lists and compares them. Builds made by results.py pass -DO5_COMMIT and -DO5_CFLAGS; otherwise
+// the commit is asked of git in the working directory, with "-dirty" when tracked files have changed.
+#ifndef O5_CFLAGS
+#define O5_CFLAGS ""
+#endif
+
+static void json_string(FILE *f, const char *s) {
+    fputc('"', f);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') fputc('\\', f);
+        if ((unsigned char)*s >= 0x20) fputc(*s, f);
+    }
+    fputc('"', f);
+}
+
+// First line of a shell command's output, "" when it fails
+static void command_line(const char *cmd, char *out, size_t size) {
+    out[0] = '\0';
+    FILE *p = popen(cmd, "r");
+    if (!p) return;
+    if (!fgets(out, (int)size, p)) out[0] = '\0';
+    pclose(p);
+    out[strcspn(out, "\n")] = '\0';
+}
+
+static const char *result_commit(void) {
+    static char commit[64];
+#ifdef O5_COMMIT
+    snprintf(commit, sizeof(commit), "%s", O5_COMMIT);
+#else
+    char dirty[8];
+    command_line("git rev-parse HEAD 2>/dev/null", commit, sizeof(commit) - 8);
+    if (!commit[0]) return "unknown";
+    command_line("git status --porcelain --untracked-files=no 2>/dev/null", dirty, sizeof(dirty));
+    if (dirty[0]) strcat(commit, "-dirty");
+#endif
+    return commit;
+}
+
+static const char *cpu_model(void) {
+    static char model[256];
+    char line[512];
+    snprintf(model, sizeof(model), "unknown");
+    FILE *f = fopen("/proc/cpuinfo", "r");
+    while (f && fgets(line, sizeof(line), f)) {
+        char *v = strchr(line, ':');
+        if (strncmp(line, "model name", 10) != 0 || !v) continue;
+        v += 1 + (v[1] == ' ');
+        v[strcspn(v, "\n")] = '\0';
+        snprintf(model, sizeof(model), "%s", v);
+        break;
+    }
+    if (f) fclose(f);
+    return model;
+}
+
+static void results_append(const char *kernel, int M, int N, int K, const char *dtype, int num_threads,
+                           double seconds, double gflops, const Telemetry *t) {
+    const char *path = getenv("O5_RESULTS");
+    if (!path || !*path) path = "results.jsonl";
+    if (strcmp(path, "none") == 0) return;
+    FILE *f = fopen(path, "a");
+    if (!f) {
+        perror(path);
+        return;
+    }
+
+    // Tuning that changes the numbers: compile-time constants and the O5_* environment
+    char flags[1024];
+    int len = snprintf(flags, sizeof(flags), "%s%sPF_A_DIST=%d PF_B_DIST=%d PF_C=%d PF_PACK_DIST=%d", O5_CFLAGS,
+                       *O5_CFLAGS ? " " : "", PF_A_DIST, PF_B_DIST, PF_C, PF_PACK_DIST);
+    for (char **e = environ; *e; e++) {
+        if (strncmp(*e, "O5_", 3) == 0 && strncmp(*e, "O5_RESULTS=", 11) != 0 && len < (int)sizeof(flags)) {
+            len += snprintf(flags + len, sizeof(flags) - len, " %s", *e);
+        }
+    }
+
+    fprintf(f, "{\"time\": %.3f, \"commit\": ", get_time());
+    json_string(f, result_commit());
+    fprintf(f, ", \"kernel\": ");
+    json_string(f, kernel);
+    fprintf(f, ", \"M\": %d, \"N\": %d, \"K\": %d, \"dtype\": ", M, N, K);
+    json_string(f, dtype);
+    fprintf(f, ", \"threads\": %d, \"cpu\": ", num_threads);
+    json_string(f, cpu_model());
+    fprintf(f, ", \"compiler\": ");
+    json_string(f, __VERSION__);
+    fprintf(f, ", \"flags\": ");
+    json_string(f, flags);
+    fprintf(f, ", \"seconds\": %.6f, \"gflops\": %.4f", seconds, gflops);
+    if (t && t->samples) fprintf(f, ", \"clock_min_ghz\": %.3f, \"clock_avg_ghz\": %.3f", t->ghz_min, t->ghz_sum / t->samples);
+    if (t && t->rapl && t->joules > 0) fprintf(f, ", \"watts\": %.2f", t->joules / t->seconds);
+    if (t) fprintf(f, ", \"throttled\": %s", t->throttled ? "true" : "false");
+    fprintf(f, "}\n");
+    fclose(f);
+}
+
+// After every measured run: the telemetry line, then the result history. kernel names the run (with whatever
+// the shape leaves out, like a sparsity or an einsum spec), M x N x K is its GEMM shape and flops what it did.
+void bench_record(const Telemetry *t, const char *kernel, int M, int N, int K, const char *dtype, int num_threads,
+                  double seconds, double flops) {
+    double gflops = flops / (seconds * 1e9);
+    telemetry_report(t, kernel, gflops);
+    results_append(kernel, M, N, K, dtype, num_threads, seconds, gflops, t);
+}
+
+// Other programs reuse the engine with #define O5_NO_MAIN / #include "o5.c"
+#ifndef O5_NO_MAIN
+// sgemm_async callback for main: completion time
+static void on_gemm_done(void *user) {
+    *(double *)user = get_time();
+}
+
+// ./a.out file A.mat B.mat [C.mat [threads]]
+static int run_files(int argc, char *argv[]) {
+    int num_threads = argc >= 6 ? atoi(argv[5]) : 24;
+    if (num_threads <= 0 || num_threads > MAX_THREADS) {
+        fprintf(stderr, "Usage: %s file A.mat B.mat [C.mat [threads (1..%d)]]\n", argv[0], MAX_THREADS);
+        return 1;
+    }
+    Matrix *A = mat_load(argv[2]);
+    Matrix *B = mat_load(argv[3]);
+    if (!A || !B) return 1;
+
+    // Without an output path C goes to an anonymous buffer
+    Matrix scratch = {A->rows, B->cols, B->cols, MAT_F32, MAT_ROW_MAJOR, NULL, NULL, 0};
+    Matrix *C = argc >= 5 ? mat_create(argv[4], A->rows, B->cols, MAT_F32) : &scratch;
+    if (!C) return 1;
+    if (C == &scratch) scratch.data = alloc_matrix((size_t)A->rows * B->cols * sizeof(float));
+
+    Telemetry tel;
+    telemetry_start(&tel, num_threads);
+    if (matmul_mat(A, B, C, NULL, num_threads) != 0) return 1;
+    double elapsed_time = telemetry_stop(&tel);
+    double gflops = 2.0 * A->rows * B->cols * A->cols / (elapsed_time * 1e9);
+
+    printf("Shape: %d x %d x %d (%s x %s)\n", A->rows, B->cols, A->cols, mat_dtype_names[A->dtype], mat_dtype_names[B->dtype]);
+    printf("Time: %.6f seconds\n", elapsed_time);
+    printf("Performance: %.2f GFLOPS\n", gflops);
+    bench_record(&tel, "matmul_mat", A->rows, B->cols, A->cols, mat_dtype_names[A->dtype], num_threads, elapsed_time,
+                 2.0 * A->rows * B->cols * A->cols);
+
+    if (C == &scratch) free_matrix(scratch.data, (size_t)A->rows * B->cols * sizeof(float));
+    else mat_free(C);
+    mat_free(A);
+    mat_free(B);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc >= 4 && strcmp(argv[1], "file") == 0) return run_files(argc, argv);
+
+    int M = 4096, N = 4096, K = 4096;
+    //int M = 512, N = 512, K = 512;
+    int num_threads = 24; // Adjust based on your CPU
+    if (argc >= 4) {
+        M = atoi(argv[1]);
+        N = atoi(argv[2]);
+        K = atoi(argv[3]);
+    }
+    if (argc >= 5) {
+        num_threads = atoi(argv[4]);
+    }
+    int dtype = DTYPE_F32;
+    if (argc >= 6) {
+        if (strcmp(argv[5], "f16") == 0) dtype = DTYPE_F16;
+        else if (strcmp(argv[5], "bf16") == 0) dtype = DTYPE_BF16;
+        else if (strcmp(argv[5], "f32") != 0) dtype = -1;
+    }
+    int plain = 0;
+    if (argc >= 7) {
+        if (strcmp(argv[6], "plain") == 0) plain = 1;
+        else if (strcmp(argv[6], "all") != 0) plain = -1;
+    }
+    if (M <= 0 || N <= 0 || K <= 0 || num_threads <= 0 || num_threads > MAX_THREADS || dtype < 0 || plain < 0) {
+        fprintf(stderr, "Usage: %s [M N K [threads (1..%d) [f32|f16|bf16 [all|plain]]]]\n", argv[0], MAX_THREADS);
+        return 1;
+    }
+
+    // A and B are generated directly in their storage type
+    void *A = alloc_matrix((size_t)M * K * dtype_size(dtype));
+    void *B = alloc_matrix((size_t)K * N * dtype_size(dtype));
+    float *C = (float *)alloc_matrix((size_t)M * N * sizeof(float));
+
+    // Initialize matrices with random values, in parallel so every row band is first touched by its worker
+    uint64_t seed = time(NULL);
+    init_uniform(dtype, A, M, K, 0.0f, 1.0f, seed, num_threads);
+    init_uniform(dtype, B, K, N, 0.0f, 1.0f, seed + 1, num_threads);
+    init_zero(C, M, (size_t)N * sizeof(float), num_threads);
+    const void *Ain = A, *Bin = B;
+
+    Telemetry tel, tel2;
+    telemetry_start(&tel, num_threads);
+    matmul_ex(Ain, dtype, Bin, dtype, C, M, N, K, NULL, num_threads);
+    double elapsed_time = telemetry_stop(&tel);
+
+    double flops = 2.0 * M * N * K;
+    double gflops = flops / (elapsed_time * 1e9);
+    // Compulsory traffic: read A and B once, read and write C once
+    double bytes = dtype_size(dtype) * ((double)M * K + (double)K * N) + sizeof(float) * 2.0 * M * N;
+
+    placement_report(num_threads);
+    printf("Time: %.6f seconds\n", elapsed_time);
+    printf("Performance: %.2f GFLOPS\n", gflops);
+    printf("Bandwidth: %.2f GB/s\n", bytes / (elapsed_time * 1e9));
+    const char *dt = mat_dtype_names[dtype];
+    bench_record(&tel, "matmul_ex", M, N, K, dt, num_threads, elapsed_time, flops);
+
+    // plain: the run above only, so a sweep (tune_prefetch.py) measures matmul_ex and not the variants below
+    if (plain) {
+        free_matrix(A, (size_t)M * K * dtype_size(dtype));
+        free_matrix(B, (size_t)K * N * dtype_size(dtype));
+        free_matrix(C, (size_t)M * N * sizeof(float));
+        return 0;
+    }
+
+    // Steady state with B packed once up front
+    PackedB *Bp = sgemm_pack_b_ex(Bin, dtype, K, N);
+    memset(C, 0, (size_t)M * N * sizeof(float));
+    telemetry_start(&tel, num_threads);
+    sgemm_compute_packed_ex(Ain, dtype, Bp, C, M, NULL, num_threads);
+    elapsed_time = telemetry_stop(&tel);
+    printf("Pre-packed B: %.6f seconds, %.2f GFLOPS\n", elapsed_time, flops / (elapsed_time * 1e9));
+    bench_record(&tel, "prepacked", M, N, K, dt, num_threads, elapsed_time, flops);
+
+    // The same B through sgemm_packed_save / sgemm_packed_load must give the same C bit for bit
+    char packed_path[] = "/tmp/o5_packed_XXXXXX";
+    int fd = mkstemp(packed_path);
+    PackedB *loaded = NULL;
+    if (fd >= 0) {
+        close(fd);
+        if (sgemm_packed_save(Bp, packed_path) == 0) loaded = sgemm_packed_load(packed_path);
+        unlink(packed_path);
+    }
+    if (loaded) {
+        float *C2 = (float *)alloc_matrix((size_t)M * N * sizeof(float));
+        init_zero(C2, M, (size_t)N * sizeof(float), num_threads);
+        sgemm_compute_packed_ex(Ain, dtype, loaded, C2, M, NULL, num_threads);
+        printf("Packed B file round trip: %s\n", memcmp(C, C2, (size_t)M * N * sizeof(float)) == 0 ? "bitwise identical" : "DIFFERS");
+        free_matrix(C2, (size_t)M * N * sizeof(float));
+        sgemm_packed_free(loaded);
+    } else {
+        printf("Packed B file round trip: FAILED to save or load %s\n", packed_path);
+    }
+    sgemm_packed_free(Bp);
+
+    // Layer: gelu(A B + bias) + residual, fused against a GEMM followed by separate passes over C
+    float *bias = (float *)alloc_matrix((size_t)N * sizeof(float));
+    float *residual = (float *)alloc_matrix((size_t)M * N * sizeof(float));
+    init_uniform(DTYPE_F32, bias, 1, N, -0.5f, 0.5f, seed + 2, 1);
+    init_uniform(DTYPE_F32, residual, M, N, 0.0f, 1.0f, seed + 3, num_threads);
+    Epilogue ep = {1.0f, bias, ACT_GELU, residual, N};
+
+    memset(C, 0, (size_t)M * N * sizeof(float));
+    telemetry_start(&tel2, num_threads);
+    matmul_ex(Ain, dtype, Bin, dtype, C, M, N, K, NULL, num_threads);
+    Epilogue ep_bias = {1.0f, bias, ACT_GELU, NULL, 0};
+    for (int i = 0; i < M; i++) {
+        for (int j = 0; j < N; j++) C[(size_t)i * N + j] = epilogue1(&ep_bias, C[(size_t)i * N + j], i, j);
+    }
+    for (long i = 0; i < (long)M * N; i++) C[i] += residual[i];
+    double unfused = telemetry_stop(&tel2);
+
+    memset(C, 0, (size_t)M * N * sizeof(float));
+    telemetry_start(&tel, num_threads);
+    matmul_ex(Ain, dtype, Bin, dtype, C, M, N, K, &ep, num_threads);
+    double fused = telemetry_stop(&tel);
+    printf("Bias + GELU + residual: fused %.6f seconds, separate passes %.6f seconds\n", fused, unfused);
+    bench_record(&tel, "epilogue_fused", M, N, K, dt, num_threads, fused, flops);
+    bench_record(&tel2, "epilogue_separate", M, N, K, dt, num_threads, unfused, flops);
+
+    // Write-only C: zero it and accumulate, against streaming the result out (forced on whatever the size)
+    telemetry_start(&tel2, num_threads);
+    init_zero(C, M, (size_t)N * sizeof(float), num_threads);
+    matmul_ex(Ain, dtype, Bin, dtype, C, M, N, K, NULL, num_threads);
+    double zeroed = telemetry_stop(&tel2);
+    telemetry_start(&tel, num_threads);
+    matmul_dispatch(Ain, dtype, Bin, dtype, C, M, N, K, NULL, 1, num_threads);
+    double streamed = telemetry_stop(&tel);
+    printf("beta = 0: streaming stores %.6f seconds, zero + accumulate %.6f seconds%s\n", streamed, zeroed,
+           stream_stores(M, N) ? "" : " (sgemm_ex would not stream this C)");
+    bench_record(&tel, "beta0_stream", M, N, K, dt, num_threads, streamed, flops);
+    bench_record(&tel2, "beta0_zero_accumulate", M, N, K, dt, num_threads, zeroed, flops);
+
+    // Packing moved onto a helper thread per worker
+    setenv("O5_PIPELINE", "1", 1);
+    init_zero(C, M, (size_t)N * sizeof(float), num_threads);
+    telemetry_start(&tel, num_threads);
+    matmul_ex(Ain, dtype, Bin, dtype, C, M, N, K, NULL, num_threads);
+    elapsed_time = telemetry_stop(&tel);
+    printf("Pipelined packing: %.6f seconds\n", elapsed_time);
+    bench_record(&tel, "pipelined", M, N, K, dt, num_threads, elapsed_time, flops);
+    unsetenv("O5_PIPELINE");
+
+    // Split-K where the planner picks it, against the row split alone; two split runs must agree bit for bit
+    int splits = splitk_splits(M, N, K, num_threads);
+    if (splits > 1) {
+        float *C2 = (float *)alloc_matrix((size_t)M * N * sizeof(float));
+        setenv("O5_SPLITK", "1", 1);
+        init_zero(C, M, (size_t)N * sizeof(float), num_threads);
+        telemetry_start(&tel2, num_threads);
+        matmul_ex(Ain, dtype, Bin, dtype, C, M, N, K, NULL, num_threads);
+        double rows_only = telemetry_stop(&tel2);
+        unsetenv("O5_SPLITK");
+        init_zero(C, M, (size_t)N * sizeof(float), num_threads);
+        telemetry_start(&tel, num_threads);
+        matmul_ex(Ain, dtype, Bin, dtype, C, M, N, K, NULL, num_threads);
+        double split = telemetry_stop(&tel);
+        matmul_ex(Ain, dtype, Bin, dtype, C2, M, N, K, NULL, num_threads);
+        printf("Split-K (%d slices): %.6f seconds, row split only %.6f seconds, repeat %s\n", splits, split, rows_only,
+               memcmp(C, C2, (size_t)M * N * sizeof(float)) == 0 ? "bitwise identical" : "DIFFERS");
+        bench_record(&tel, "splitk", M, N, K, dt, num_threads, split, flops);
+        bench_record(&tel2, "splitk_rows_only", M, N, K, dt, num_threads, rows_only, flops);
+        free_matrix(C2, (size_t)M * N * sizeof(float));
+    } else {
+        printf("Split-K: not chosen for this shape (C has enough MC x NC blocks, or K is short)\n");
+    }
+
+    // Pinned workers with B shared per L3 domain, against unpinned workers each packing their own B
+    const char *pin_env = getenv("O5_PIN");
+    char *pin = pin_env ? strdup(pin_env) : NULL;
+    setenv("O5_PIN", "none", 1);
+    init_zero(C, M, (size_t)N * sizeof(float), num_threads);
+    telemetry_start(&tel2, num_threads);
+    matmul_ex(Ain, dtype, Bin, dtype, C, M, N, K, NULL, num_threads);
+    double unpinned = telemetry_stop(&tel2);
+    if (pin) setenv("O5_PIN", pin, 1);
+    else unsetenv("O5_PIN");
+    free(pin);
+    init_zero(C, M, (size_t)N * sizeof(float), num_threads);
+    telemetry_start(&tel, num_threads);
+    matmul_ex(Ain, dtype, Bin, dtype, C, M, N, K, NULL, num_threads);
+    double pinned = telemetry_stop(&tel);
+    printf("Pinned, B shared per L3 domain: %.6f seconds, unpinned %.6f seconds\n", pinned, unpinned);
+    bench_record(&tel, "pinned", M, N, K, dt, num_threads, pinned, flops);
+    bench_record(&tel2, "unpinned", M, N, K, dt, num_threads, unpinned, flops);
+
+    // Asynchronous: the caller regenerates the residual while the GEMM runs
+    double finished = 0.0;
+    telemetry_start(&tel, num_threads);
+    double start_time = get_time();
+    GemmEvent *ev = sgemm_async(Ain, dtype, Bin, dtype, C, M, N, K, 0.0f, NULL, num_threads, on_gemm_done, &finished);
+    double submitted = get_time() - start_time;
+    init_uniform(DTYPE_F32, residual, M, N, 0.0f, 1.0f, seed + 4, 1);
+    double overlapped = get_time() - start_time;
+    sgemm_wait(ev);
+    double waited = get_time() - start_time;
+    telemetry_stop(&tel);
+    printf("sgemm_async: returned after %.1f us, caller worked %.6f s, GEMM done at %.6f s, wait returned at %.6f s\n",
+           submitted * 1e6, overlapped, finished - start_time, waited);
+    bench_record(&tel, "sgemm_async", M, N, K, dt, num_threads, finished - start_time, flops);
+    free_matrix(bias, (size_t)N * sizeof(float));
+    free_matrix(residual, (size_t)M * N * sizeof(float));
 
-    free(A);
-    free(B);
-    free(C);
+    page_report();
+    free_matrix(A, (size_t)M * K * dtype_size(dtype));
+    free_matrix(B, (size_t)K * N * dtype_size(dtype));
+    free_matrix(C, (size_t)M * N * sizeof(float));
     return 0;
 }
+#endif
@@ -0,0 +1,340 @@
+/*
+Out-of-core GEMM: A, B and C live in files, only a few tiles are ever in memory
+
+- C is computed one OOC_MB x OOC_NB tile at a time, each as a sum over OOC_KB-deep A / B tiles
+- a reader thread fills the next A / B tile pair while o5's matmul() runs on the current one (double buffered)
+- finished C tiles are handed to a writer thread, which pwrites them while the next tile is computed
+- memory use is 2 x (A tile + B tile) + 2 x C tile, 384 MB with the defaults, whatever the matrix size
+- A is reread N / OOC_NB times and B M / OOC_MB times: with 4096^3 tiles a step is 137 GFLOP against 128 MB of reads,
+  so about 1 GB/s of disk keeps a 1 TFLOPS node compute bound
+
+A and B are f32 row-major matrix files (matfile.h), C is created / truncated in the same format.
+
+Usage: gcc ooc.c -O3 -mavx2 -mfma ; ./a.out [M N K [threads [dir]]]
+main() writes random A and B into dir (default /tmp), runs the product and spot checks C.
+*/
+
+#define O5_NO_MAIN
+#include "o5.c"
+
+// Tile sizes, 64 MB each
+#define OOC_MB 4096
+#define OOC_NB 4096
+#define OOC_KB 4096
+
+typedef struct {
+    int fd_a, fd_b, fd_c;
+    off_t off_a, off_b, off_c; // data offsets
+    long lda, ldb;             // row lengths in the files
+    int M, N, K;
+    int mb, nb, kb; // tile sizes, clamped to the matrix
+    int tiles_m, tiles_n, tiles_k;
+
+    float *a_buf[2], *b_buf[2]; // A / B tile slots, filled by the reader
+    float *c_buf[2];            // C tile slots, drained by the writer
+    long filled, consumed;      // A / B steps read / multiplied
+    long computed, written;     // C tiles finished / on disk
+
+    double stall; // seconds compute spent waiting on the reader
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} OocState;
+
+// Read a rows x cols tile at (r0, c0) of row-major data at byte offset base, row length ld
+static void read_tile(int fd, off_t base, int rows, int cols, long ld, long r0, long c0, float *buf) {
+    for (int r = 0; r < rows; r++) {
+        char *dst = (char *)&buf[(size_t)r * cols];
+        size_t left = (size_t)cols * sizeof(float);
+        off_t off = base + ((r0 + r) * ld + c0) * (off_t)sizeof(float);
+        while (left > 0) {
+            ssize_t got = pread(fd, dst, left, off);
+            if (got <= 0) {
+                fprintf(stderr, "Failed to read tile (short file?)\n");
+                exit(1);
+            }
+            dst += got;
+            off += got;
+            left -= got;
+        }
+    }
+}
+
+static void write_tile(int fd, off_t base, int rows, int cols, long ld, long r0, long c0, const float *buf) {
+    for (int r = 0; r < rows; r++) {
+        const char *src = (const char *)&buf[(size_t)r * cols];
+        size_t left = (size_t)cols * sizeof(float);
+        off_t off = base + ((r0 + r) * ld + c0) * (off_t)sizeof(float);
+        while (left > 0) {
+            ssize_t put = pwrite(fd, src, left, off);
+            if (put <= 0) {
+                fprintf(stderr, "Failed to write tile\n");
+                exit(1);
+            }
+            src += put;
+            off += put;
+            left -= put;
+        }
+    }
+}
+
+// Step s is (C tile t = s / tiles_k, k block s % tiles_k), C tiles go row band by row band
+static void step_coords(const OocState *st, long s, int *i0, int *j0, int *k0) {
+    long t = s / st->tiles_k;
+    *k0 = (int)(s % st->tiles_k) * st->kb;
+    *i0 = (int)(t / st->tiles_n) * st->mb;
+    *j0 = (int)(t % st->tiles_n) * st->nb;
+}
+
+static int tile_len(int start, int tile, int total) {
+    return (start + tile <= total) ? tile : total - start;
+}
+
+void *ooc_reader(void *arg) {
+    OocState *st = (OocState *)arg;
+    long steps = (long)st->tiles_m * st->tiles_n * st->tiles_k;
+
+    for (long s = 0; s < steps; s++) {
+        pthread_mutex_lock(&st->lock);
+        while (st->filled - st->consumed >= 2) pthread_cond_wait(&st->cond, &st->lock);
+        pthread_mutex_unlock(&st->lock);
+
+        int i0, j0, k0;
+        step_coords(st, s, &i0, &j0, &k0);
+        int m = tile_len(i0, st->mb, st->M), n = tile_len(j0, st->nb, st->N), k = tile_len(k0, st->kb, st->K);
+        read_tile(st->fd_a, st->off_a, m, k, st->lda, i0, k0, st->a_buf[s % 2]);
+        read_tile(st->fd_b, st->off_b, k, n, st->ldb, k0, j0, st->b_buf[s % 2]);
+
+        pthread_mutex_lock(&st->lock);
+        st->filled++;
+        pthread_cond_broadcast(&st->cond);
+        pthread_mutex_unlock(&st->lock);
+    }
+    return NULL;
+}
+
+void *ooc_writer(void *arg) {
+    OocState *st = (OocState *)arg;
+    long tiles = (long)st->tiles_m * st->tiles_n;
+
+    for (long t = 0; t < tiles; t++) {
+        pthread_mutex_lock(&st->lock);
+        while (st->computed <= t) pthread_cond_wait(&st->cond, &st->lock);
+        pthread_mutex_unlock(&st->lock);
+
+        int i0 = (int)(t / st->tiles_n) * st->mb, j0 = (int)(t % st->tiles_n) * st->nb;
+        write_tile(st->fd_c, st->off_c, tile_len(i0, st->mb, st->M), tile_len(j0, st->nb, st->N), st->N, i0, j0, st->c_buf[t % 2]);
+
+        pthread_mutex_lock(&st->lock);
+        st->written++;
+        pthread_cond_broadcast(&st->cond);
+        pthread_mutex_unlock(&st->lock);
+    }
+    return NULL;
+}
+
+// Header of an f32 row-major matrix file, exits if it is anything else
+static MatHeader read_header(int fd, const char *path) {
+    MatHeader h;
+    struct stat sb;
+    if (fd < 0 || fstat(fd, &sb) != 0 || pread(fd, &h, sizeof(h), 0) != (ssize_t)sizeof(h) ||
+        !mat_check_header(&h, sb.st_size) || h.dtype != MAT_F32 || h.layout != MAT_ROW_MAJOR) {
+        fprintf(stderr, "%s: not an f32 row-major matrix file\n", path);
+        exit(1);
+    }
+    return h;
+}
+
+// C = A B with every operand in a matrix file. Returns the seconds compute spent waiting on reads.
+double matmul_ooc(const char *a_path, const char *b_path, const char *c_path, int num_threads) {
+    OocState st = {0};
+    st.fd_a = open(a_path, O_RDONLY);
+    st.fd_b = open(b_path, O_RDONLY);
+    MatHeader ha = read_header(st.fd_a, a_path), hb = read_header(st.fd_b, b_path);
+    if (ha.cols != hb.rows) {
+        fprintf(stderr, "%s / %s: inner dimensions differ\n", a_path, b_path);
+        exit(1);
+    }
+    int M = (int)ha.rows, N = (int)hb.cols, K = (int)ha.cols;
+
+    // mat_create writes the header and sizes the file, tiles then go in with pwrite
+    Matrix *c = mat_create(c_path, M, N, MAT_F32);
+    if (!c) exit(1);
+    mat_free(c);
+    st.fd_c = open(c_path, O_RDWR);
+    if (st.fd_c < 0) {
+        perror(c_path);
+        exit(1);
+    }
+
+    st.off_a = ha.data_offset;
+    st.off_b = hb.data_offset;
+    st.off_c = MAT_HEADER;
+    st.lda = ha.ld;
+    st.ldb = hb.ld;
+    st.M = M;
+    st.N = N;
+    st.K = K;
+    st.mb = M < OOC_MB ? M : OOC_MB;
+    st.nb = N < OOC_NB ? N : OOC_NB;
+    st.kb = K < OOC_KB ? K : OOC_KB;
+    st.tiles_m = (M + st.mb - 1) / st.mb;
+    st.tiles_n = (N + st.nb - 1) / st.nb;
+    st.tiles_k = (K + st.kb - 1) / st.kb;
+    size_t a_bytes = (size_t)st.mb * st.kb * sizeof(float);
+    size_t b_bytes = (size_t)st.kb * st.nb * sizeof(float);
+    size_t c_bytes = (size_t)st.mb * st.nb * sizeof(float);
+    for (int s = 0; s < 2; s++) {
+        st.a_buf[s] = (float *)alloc_pages(a_bytes);
+        st.b_buf[s] = (float *)alloc_pages(b_bytes);
+        st.c_buf[s] = (float *)alloc_pages(c_bytes);
+    }
+    pthread_mutex_init(&st.lock, NULL);
+    pthread_cond_init(&st.cond, NULL);
+
+    pthread_t reader, writer;
+    if (pthread_create(&reader, NULL, ooc_reader, &st) != 0 || pthread_create(&writer, NULL, ooc_writer, &st) != 0) {
+        fprintf(stderr, "Failed to create I/O threads\n");
+        exit(1);
+    }
+
+    long step = 0;
+    long tiles = (long)st.tiles_m * st.tiles_n;
+    for (long t = 0; t < tiles; t++) {
+        int i0 = (int)(t / st.tiles_n) * st.mb, j0 = (int)(t % st.tiles_n) * st.nb;
+        int m = tile_len(i0, st.mb, M), n = tile_len(j0, st.nb, N);
+        float *C = st.c_buf[t % 2];
+
+        // The slot is free once the tile two back is on disk
+        pthread_mutex_lock(&st.lock);
+        while (st.written < t - 1) pthread_cond_wait(&st.cond, &st.lock);
+        pthread_mutex_unlock(&st.lock);
+        memset(C, 0, (size_t)m * n * sizeof(float));
+
+        for (int kt = 0; kt < st.tiles_k; kt++, step++) {
+            int k = tile_len(kt * st.kb, st.kb, K);
+
+            double wait_start = get_time();
+            pthread_mutex_lock(&st.lock);
+            while (st.filled <= step) pthread_cond_wait(&st.cond, &st.lock);
+            pthread_mutex_unlock(&st.lock);
+            st.stall += get_time() - wait_start;
+
+            matmul(st.a_buf[step % 2], st.b_buf[step % 2], C, m, n, k, num_threads);
+
+            pthread_mutex_lock(&st.lock);
+            st.consumed++;
+            pthread_cond_broadcast(&st.cond);
+            pthread_mutex_unlock(&st.lock);
+        }
+
+        pthread_mutex_lock(&st.lock);
+        st.computed++;
+        pthread_cond_broadcast(&st.cond);
+        pthread_mutex_unlock(&st.lock);
+    }
+
+    pthread_join(reader, NULL);
+    pthread_join(writer, NULL);
+    if (fsync(st.fd_c) != 0) {
+        fprintf(stderr, "Failed to sync %s\n", c_path);
+        exit(1);
+    }
+
+    for (int s = 0; s < 2; s++) {
+        free_pages(st.a_buf[s], a_bytes);
+        free_pages(st.b_buf[s], b_bytes);
+        free_pages(st.c_buf[s], c_bytes);
+    }
+    pthread_mutex_destroy(&st.lock);
+    pthread_cond_destroy(&st.cond);
+    close(st.fd_a);
+    close(st.fd_b);
+    close(st.fd_c);
+    return st.stall;
+}
+
+// Fill a rows x cols matrix file with random values through its mapping
+static void write_random_file(const char *path, int rows, int cols, uint64_t seed, int num_threads) {
+    Matrix *m = mat_create(path, rows, cols, MAT_F32);
+    if (!m) exit(1);
+    init_uniform(DTYPE_F32, m->data, rows, cols, 0.0f, 1.0f, seed, num_threads);
+    mat_free(m);
+}
+
+int main(int argc, char *argv[]) {
+    int M = 16384, N = 16384, K = 16384;
+    int num_threads = 24; // Adjust based on your CPU
+    const char *dir = "/tmp";
+    if (argc >= 4) {
+        M = atoi(argv[1]);
+        N = atoi(argv[2]);
+        K = atoi(argv[3]);
+    }
+    if (argc >= 5) {
+        num_threads = atoi(argv[4]);
+    }
+    if (argc >= 6) {
+        dir = argv[5];
+    }
+    if (M <= 0 || N <= 0 || K <= 0 || num_threads <= 0 || num_threads > MAX_THREADS) {
+        fprintf(stderr, "Usage: %s [M N K [threads (1..%d) [dir]]]\n", argv[0], MAX_THREADS);
+        return 1;
+    }
+
+    char a_path[4096], b_path[4096], c_path[4096];
+    snprintf(a_path, sizeof(a_path), "%s/ooc_a.mat", dir);
+    snprintf(b_path, sizeof(b_path), "%s/ooc_b.mat", dir);
+    snprintf(c_path, sizeof(c_path), "%s/ooc_c.mat", dir);
+
+    srand(time(NULL));
+    write_random_file(a_path, M, K, time(NULL), num_threads);
+    write_random_file(b_path, K, N, time(NULL) + 1, num_threads);
+
+    Telemetry tel;
+    telemetry_start(&tel, num_threads);
+    double stall = matmul_ooc(a_path, b_path, c_path, num_threads);
+    double elapsed_time = telemetry_stop(&tel);
+
+    double flops = 2.0 * M * N * K;
+    int mb = M < OOC_MB ? M : OOC_MB, nb = N < OOC_NB ? N : OOC_NB;
+    // A is read once per C tile column, B once per C tile row, C written once
+    double bytes = sizeof(float) * ((double)M * K * ((N + nb - 1) / nb) + (double)K * N * ((M + mb - 1) / mb) + (double)M * N);
+
+    printf("Time: %.6f seconds\n", elapsed_time);
+    printf("Performance: %.2f GFLOPS\n", flops / (elapsed_time * 1e9));
+    printf("I/O: %.2f GB/s, compute waited %.6f seconds on reads\n", bytes / (elapsed_time * 1e9), stall);
+    bench_record(&tel, "matmul_ooc", M, N, K, "f32", num_threads, elapsed_time, flops);
+
+    // Spot check a few entries against the files
+    int fd_a = open(a_path, O_RDONLY), fd_b = open(b_path, O_RDONLY), fd_c = open(c_path, O_RDONLY);
+    float *a_row = (float *)malloc((size_t)K * sizeof(float));
+    float *b_col = (float *)malloc((size_t)K * sizeof(float));
+    if (fd_a < 0 || fd_b < 0 || fd_c < 0 || !a_row || !b_col) {
+        fprintf(stderr, "Failed to reopen output\n");
+        return 1;
+    }
+    double max_err = 0.0;
+    for (int s = 0; s < 8; s++) {
+        int i = rand() % M, j = rand() % N;
+        float c;
+        read_tile(fd_a, MAT_HEADER, 1, K, K, i, 0, a_row);
+        for (int k = 0; k < K; k++) read_tile(fd_b, MAT_HEADER, 1, 1, N, k, j, &b_col[k]);
+        read_tile(fd_c, MAT_HEADER, 1, 1, N, i, j, &c);
+        double ref = 0.0;
+        for (int k = 0; k < K; k++) ref += (double)a_row[k] * b_col[k];
+        double err = (ref - c) / ref;
+        if (err < 0) err = -err;
+        if (err > max_err) max_err = err;
+    }
+    printf("Max relative error: %.3e\n", max_err);
+
+    free(a_row);
+    free(b_col);
+    close(fd_a);
+    close(fd_b);
+    close(fd_c);
+    unlink(a_path);
+    unlink(b_path);
+    unlink(c_path);
+    return 0;
+}
@@ -0,0 +1,202 @@
+"""
+History of benchmark results, and regressions between commits
+
+- every harness built on o5.c (o5, int8, dgemm, blas3, conv, summa, ...) appends one JSON object per measured run
+  to results.jsonl (O5_RESULTS) through bench_record
+- run TARGET: builds a harness from the working tree, stamped with the commit, and runs it --repeat times
+- list: median GFLOPS per commit and configuration
+- compare BASE HEAD: per configuration (kernel, shape, dtype, threads, CPU, compiler, flags), the median change
+  and a two-sided Mann-Whitney U test over the runs of both commits. A change is only called a regression or a
+  speedup when it is past --threshold percent and the test says it is not noise (p < --alpha), which takes at
+  least 4 runs a side. Throttled runs are left out unless --keep-throttled. Exits 1 when anything regressed.
+
+HEAD-dirty names results from a working tree with uncommitted changes on top of HEAD.
+"""
+import argparse
+import json
+import math
+import os
+import statistics
+import subprocess
+import sys
+import tempfile
+from functools import lru_cache
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+KEY = ("kernel", "M", "N", "K", "dtype", "threads", "cpu", "compiler", "flags")
+
+def git(*args):
+    out = subprocess.run(["git", "-C", HERE, *args], capture_output=True, text=True)
+    return out.stdout.strip() if out.returncode == 0 else None
+
+def resolve(rev):
+    # Full hash, keeping a -dirty suffix; unknown revisions are matched as given (a prefix)
+    dirty = rev.endswith("-dirty")
+    base = rev[:-len("-dirty")] if dirty else rev
+    sha = git("rev-parse", "--verify", "--quiet", base + "^{commit}")
+    return (sha or base) + ("-dirty" if dirty else "")
+
+def load(path, keep_throttled):
+    runs = []
+    with open(path) as f:
+        for n, line in enumerate(f, 1):
+            if not line.strip():
+                continue
+            try:
+                r = json.loads(line)
+            except json.JSONDecodeError:
+                print(f"{path}:{n}: skipping malformed line", file=sys.stderr)
+                continue
+            if keep_throttled or not r.get("throttled"):
+                runs.append(r)
+    return runs
+
+def matches(commit, rev):
+    # A prefix of the hash, not of the dirty suffix: HEAD does not pick up HEAD-dirty runs
+    clean = commit[:-len("-dirty")] if commit.endswith("-dirty") else commit
+    if rev.endswith("-dirty"):
+        return commit.endswith("-dirty") and clean.startswith(rev[:-len("-dirty")])
+    return commit == clean and clean.startswith(rev)
+
+def by_config(runs, rev):
+    groups = {}
+    for r in runs:
+        if matches(r.get("commit", ""), rev):
+            groups.setdefault(tuple(r.get(k) for k in KEY), []).append(r["gflops"])
+    return groups
+
+@lru_cache(maxsize=None)
+def u_count(u, n1, n2):
+    # Orderings of n1 + n2 distinct values whose U statistic is u
+    if u < 0:
+        return 0
+    if n1 == 0 or n2 == 0:
+        return 1 if u == 0 else 0
+    return u_count(u - n2, n1 - 1, n2) + u_count(u, n1, n2 - 1)
+
+def mann_whitney(x, y):
+    # Two-sided p-value: exact without ties for small samples, else the normal approximation with tie correction
+    n1, n2 = len(x), len(y)
+    values = sorted((v, i) for i, v in enumerate(x + y))
+    ranks = [0.0] * (n1 + n2)
+    ties = 0.0
+    i = 0
+    while i < len(values):
+        j = i
+        while j + 1 < len(values) and values[j + 1][0] == values[i][0]:
+            j += 1
+        for t in range(i, j + 1):
+            ranks[values[t][1]] = (i + j) / 2 + 1
+        ties += (j - i + 1) ** 3 - (j - i + 1)
+        i = j + 1
+    u = sum(ranks[:n1]) - n1 * (n1 + 1) / 2
+    if ties == 0 and n1 + n2 <= 40:
+        total = math.comb(n1 + n2, n1)
+        lo = sum(u_count(k, n1, n2) for k in range(int(u) + 1)) / total
+        hi = sum(u_count(k, n1, n2) for k in range(int(u), n1 * n2 + 1)) / total
+        return min(1.0, 2 * min(lo, hi))
+    n = n1 + n2
+    sigma = math.sqrt(n1 * n2 / 12 * ((n + 1) - ties / (n * (n - 1))))
+    if sigma == 0:
+        return 1.0
+    z = (abs(u - n1 * n2 / 2) - 0.5) / sigma
+    return min(1.0, math.erfc(max(z, 0.0) / math.sqrt(2)))
+
+def describe(key):
+    c = dict(zip(KEY, key))
+    return f"{c['kernel']} {c['M']}x{c['N']}x{c['K']} {c['dtype']} {c['threads']}t"
+
+def harness(target):
+    # Next to this script (o5.c, int8.c, ../8-multi-node/summa.c), else a path as given
+    for path in (os.path.join(HERE, target), target):
+        if os.path.isfile(path):
+            return path
+    sys.exit(f"{target}: no such harness")
+
+def cmd_run(args):
+    source = harness(args.target)
+    commit = git("rev-parse", "HEAD") or "unknown"
+    if git("status", "--porcelain", "--untracked-files=no"):
+        commit += "-dirty"
+    cflags = ["-O3", "-mavx2", "-mfma", "-mf16c"] + args.cflags
+    path = os.path.abspath(args.file)
+    with tempfile.TemporaryDirectory() as tmp:
+        binary = os.path.join(tmp, os.path.splitext(os.path.basename(source))[0])
+        subprocess.run(["gcc", source, *cflags, "-lpthread", "-lm", "-o", binary,
+                        f'-DO5_COMMIT="{commit}"', f'-DO5_CFLAGS="{" ".join(cflags)}"'], check=True)
+        env = dict(os.environ, O5_RESULTS=path)
+        for i in range(args.repeat):
+            before = os.path.getsize(path) if os.path.exists(path) else 0
+            subprocess.run([binary, *args.args], env=env, stdout=subprocess.DEVNULL, check=True)
+            # What this run appended
+            with open(path) as f:
+                f.seek(before)
+                new = [json.loads(line) for line in f if line.strip()]
+            results = ", ".join(f"{r['kernel']} {r['gflops']:.2f}" for r in new) or "no result"
+            print(f"run {i + 1}/{args.repeat} at {commit[:12]}: {results}", flush=True)
+
+def cmd_list(args):
+    table = {}
+    for r in load(args.file, args.keep_throttled):
+        table.setdefault((r.get("commit", "unknown"), tuple(r.get(k) for k in KEY)), []).append(r)
+    for (commit, key), runs in sorted(table.items(), key=lambda kv: min(r["time"] for r in kv[1])):
+        g = [r["gflops"] for r in runs]
+        print(f"{commit[:12]:<18} {describe(key):<36} {len(g):3d} runs, median {statistics.median(g):8.2f} GFLOPS")
+
+def cmd_compare(args):
+    runs = load(args.file, args.keep_throttled)
+    base, head = resolve(args.base), resolve(args.head)
+    a, b = by_config(runs, base), by_config(runs, head)
+    common = [k for k in a if k in b]
+    if not common:
+        print(f"No configuration was measured at both {args.base} and {args.head}")
+        return 2
+
+    regressions = 0
+    for key in common:
+        x, y = a[key], b[key]
+        change = (statistics.median(y) / statistics.median(x) - 1) * 100
+        p = mann_whitney(x, y)
+        if min(len(x), len(y)) < 4:
+            verdict = "too few runs"
+        elif abs(change) < args.threshold or p >= args.alpha:
+            verdict = "noise"
+        elif change < 0:
+            verdict = "REGRESSION"
+            regressions += 1
+        else:
+            verdict = "speedup"
+        print(f"{describe(key):<36} {statistics.median(x):8.2f} -> {statistics.median(y):8.2f} GFLOPS "
+              f"{change:+6.1f}%  p={p:.3f}  ({len(x)} vs {len(y)} runs)  {verdict}")
+    return 1 if regressions else 0
+
+def main():
+    parser = argparse.ArgumentParser(description="benchmark result history and regression checks")
+    parser.add_argument("--file", default="results.jsonl")
+    parser.add_argument("--keep-throttled", action="store_true")
+    sub = parser.add_subparsers(dest="command", required=True)
+
+    run = sub.add_parser("run", help="build a harness from the working tree and record --repeat runs")
+    run.add_argument("--repeat", type=int, default=5)
+    run.add_argument("--cflags", nargs="*", default=[])
+    run.add_argument("target", help="harness source: o5.c, int8.c, dgemm.c, ../8-multi-node/summa.c, ...")
+    run.add_argument("args", nargs="*", help="the harness's own arguments, e.g. M N K [threads [dtype]] for o5.c")
+
+    sub.add_parser("list", help="median GFLOPS per commit and configuration")
+
+    compare = sub.add_parser("compare", help="flag regressions from BASE to HEAD")
+    compare.add_argument("base")
+    compare.add_argument("head")
+    compare.add_argument("--threshold", type=float, default=3.0, help="percent change that matters")
+    compare.add_argument("--alpha", type=float, default=0.05)
+
+    args = parser.parse_args()
+    if args.command == "run":
+        cmd_run(args)
+    elif args.command == "list":
+        cmd_list(args)
+    else:
+        sys.exit(cmd_compare(args))
+
+if __name__ == "__main__":
+    main()
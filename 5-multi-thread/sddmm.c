@@ -0,0 +1,224 @@
+/*
+Sampled dense-dense matmul (SDDMM): out[p] = dot(A row i, B row j) only for the (i, j) of a CSR mask
+
+For attention scores (Q K^T at the positions a sparse pattern keeps), computing the full M x N product
+and gathering from it does N / (nnz per row) times the work. Here:
+
+- A is M x K and B is N x K, both row-major, so every dot product is over contiguous K: SIMD over K,
+  two accumulators per dot, a masked tail
+- the mask is walked SDDMM_RB rows at a time in merged column order: each column j the group samples loads
+  its B row slice once per K step for every row of the group that has j, and the group's A rows stay in L1
+- rows are split over threads by mask nonzeros (spmm.c's split_by_nnz)
+- the output has the mask's pattern, out[p] for mask entry p (mask values are not used)
+
+Work is 2 nnz K instead of 2 M N K.
+
+Usage: gcc sddmm.c -O3 -mavx2 -mfma -mf16c -lpthread
+       ./a.out [M N K [density [threads [random|band]]]]
+density is the fraction of C kept (0.05 by default), band keeps a diagonal band (local attention window)
+*/
+
+#define SPMM_NO_MAIN
+#include "spmm.c"
+
+#define SDDMM_RB 4 // mask rows walked together
+
+// dot(A row, B row) for n rows of A against one row of B, loading B once per K step.
+// n is a constant in the switch below, so acc stays in registers.
+FORCE_INLINE void dot_rows(const int n, const float *const *a, const float *b, int K, float *out) {
+    __m256 acc[SDDMM_RB][2];
+    for (int r = 0; r < n; r++) acc[r][0] = acc[r][1] = _mm256_setzero_ps();
+
+    int k = 0;
+    for (; k + 16 <= K; k += 16) {
+        __m256 b0 = _mm256_loadu_ps(&b[k]);
+        __m256 b1 = _mm256_loadu_ps(&b[k + 8]);
+        for (int r = 0; r < n; r++) {
+            acc[r][0] = _mm256_fmadd_ps(_mm256_loadu_ps(&a[r][k]), b0, acc[r][0]);
+            acc[r][1] = _mm256_fmadd_ps(_mm256_loadu_ps(&a[r][k + 8]), b1, acc[r][1]);
+        }
+    }
+    for (; k < K; k += 8) {
+        __m256i mask = tail_mask(K - k);
+        __m256 b0 = _mm256_maskload_ps(&b[k], mask);
+        for (int r = 0; r < n; r++) acc[r][0] = _mm256_fmadd_ps(_mm256_maskload_ps(&a[r][k], mask), b0, acc[r][0]);
+    }
+    for (int r = 0; r < n; r++) out[r] = hsum(_mm256_add_ps(acc[r][0], acc[r][1]));
+}
+
+// Mask rows [start, end)
+void sddmm_rows(const CsrMatrix *mask, const float *A, const float *B, int K, float *out, int start, int end) {
+    for (int i0 = start; i0 < end; i0 += SDDMM_RB) {
+        int rows = end - i0 < SDDMM_RB ? end - i0 : SDDMM_RB;
+        int p[SDDMM_RB], p_end[SDDMM_RB];
+        for (int r = 0; r < rows; r++) {
+            p[r] = mask->row_ptr[i0 + r];
+            p_end[r] = mask->row_ptr[i0 + r + 1];
+        }
+
+        // Smallest column any row of the group still has, then every row that has it
+        for (;;) {
+            int j = INT32_MAX;
+            for (int r = 0; r < rows; r++) {
+                if (p[r] < p_end[r] && mask->col[p[r]] < j) j = mask->col[p[r]];
+            }
+            if (j == INT32_MAX) break;
+
+            const float *a[SDDMM_RB];
+            int at[SDDMM_RB], n = 0;
+            for (int r = 0; r < rows; r++) {
+                if (p[r] < p_end[r] && mask->col[p[r]] == j) {
+                    a[n] = &A[(size_t)(i0 + r) * K];
+                    at[n++] = p[r]++;
+                }
+            }
+
+            float dots[SDDMM_RB];
+            const float *b = &B[(size_t)j * K];
+            switch (n) {
+                case 1: dot_rows(1, a, b, K, dots); break;
+                case 2: dot_rows(2, a, b, K, dots); break;
+                case 3: dot_rows(3, a, b, K, dots); break;
+                default: dot_rows(4, a, b, K, dots); break;
+            }
+            for (int r = 0; r < n; r++) out[at[r]] = dots[r];
+        }
+    }
+}
+
+typedef struct {
+    const CsrMatrix *mask;
+    const float *A, *B;
+    int K;
+    float *out;
+    int start, end;
+} SddmmArgs;
+
+void *sddmm_thread(void *arg) {
+    SddmmArgs *args = (SddmmArgs *)arg;
+    sddmm_rows(args->mask, args->A, args->B, args->K, args->out, args->start, args->end);
+    return NULL;
+}
+
+// out[p] = dot(A[i, :], B[j, :]) for every mask entry p = (i, j). A is M x K, B is N x K (mask is M x N),
+// columns within a mask row must be ascending (csr_from_dense leaves them so).
+void sddmm_csr(const CsrMatrix *mask, const float *A, const float *B, int K, float *out, int num_threads) {
+    SddmmArgs args[MAX_THREADS];
+    int bounds[MAX_THREADS + 1];
+    if (num_threads > MAX_THREADS) num_threads = MAX_THREADS;
+    if (num_threads > mask->M) num_threads = mask->M > 0 ? mask->M : 1;
+    split_by_nnz(mask->row_ptr, mask->M, num_threads, bounds);
+    for (int t = 0; t < num_threads; t++) {
+        args[t] = (SddmmArgs){mask, A, B, K, out, bounds[t], bounds[t + 1]};
+    }
+    launch_threads(sddmm_thread, args, sizeof(SddmmArgs), num_threads);
+}
+
+// Random mask of the given density, or a diagonal band of about that density. Pattern only, values are 1.
+static CsrMatrix *make_mask(int M, int N, float density, int band, uint64_t seed) {
+    CsrMatrix *S = (CsrMatrix *)spmm_alloc(sizeof(CsrMatrix));
+    int half = (int)(density * N / 2);
+    S->M = M;
+    S->K = N;
+    S->row_ptr = (int *)spmm_alloc((M + 1) * sizeof(int));
+    for (int pass = 0; pass < 2; pass++) {
+        long p = 0;
+        for (int i = 0; i < M; i++) {
+            if (pass) S->row_ptr[i] = (int)p;
+            int centre = (int)((long)i * N / M);
+            for (int j = 0; j < N; j++) {
+                int keep = band ? j >= centre - half && j <= centre + half : rng_uniform(seed, (uint64_t)i * N + j) < density;
+                if (!keep) continue;
+                if (pass) {
+                    S->col[p] = j;
+                    S->val[p] = 1.0f;
+                }
+                p++;
+            }
+        }
+        if (!pass) {
+            S->nnz = p;
+            S->col = (int *)spmm_alloc(p * sizeof(int));
+            S->val = (float *)spmm_alloc(p * sizeof(float));
+        } else {
+            S->row_ptr[M] = (int)p;
+        }
+    }
+    return S;
+}
+
+int main(int argc, char *argv[]) {
+    int M = 4096, N = 4096, K = 128;
+    float density = 0.05f;
+    int num_threads = 24;
+    int band = 0;
+    if (argc >= 4) {
+        M = atoi(argv[1]);
+        N = atoi(argv[2]);
+        K = atoi(argv[3]);
+    }
+    if (argc >= 5) density = atof(argv[4]);
+    if (argc >= 6) num_threads = atoi(argv[5]);
+    if (argc >= 7) {
+        if (strcmp(argv[6], "band") == 0) band = 1;
+        else if (strcmp(argv[6], "random") != 0) band = -1;
+    }
+    if (M <= 0 || N <= 0 || K <= 0 || density <= 0.0f || density > 1.0f || num_threads <= 0 || num_threads > MAX_THREADS || band < 0) {
+        fprintf(stderr, "Usage: %s [M N K [density (0..1] [threads (1..%d) [random|band]]]]\n", argv[0], MAX_THREADS);
+        return 1;
+    }
+
+    float *A = (float *)alloc_matrix((size_t)M * K * sizeof(float));
+    float *B = (float *)alloc_matrix((size_t)N * K * sizeof(float));
+    float *Bt = (float *)alloc_matrix((size_t)K * N * sizeof(float));
+    float *C = (float *)alloc_matrix((size_t)M * N * sizeof(float));
+    uint64_t seed = time(NULL);
+    init_uniform(DTYPE_F32, A, M, K, -1.0f, 1.0f, seed, num_threads);
+    init_uniform(DTYPE_F32, B, N, K, -1.0f, 1.0f, seed + 1, num_threads);
+    for (int j = 0; j < N; j++) {
+        for (int k = 0; k < K; k++) Bt[(size_t)k * N + j] = B[(size_t)j * K + k];
+    }
+    CsrMatrix *mask = make_mask(M, N, density, band, seed + 2);
+    float *out = (float *)spmm_alloc(mask->nnz * sizeof(float));
+    float *ref = (float *)spmm_alloc(mask->nnz * sizeof(float));
+    printf("Mask: %s, %ld of %ld entries (%.2f%%)\n", band ? "band" : "random", mask->nnz, (long)M * N,
+           100.0 * mask->nnz / ((double)M * N));
+
+    // What this replaces: the full product, then a gather of the kept entries
+    init_zero(C, M, (size_t)N * sizeof(float), num_threads);
+    Telemetry tel;
+    telemetry_start(&tel, num_threads);
+    matmul_ex(A, DTYPE_F32, Bt, DTYPE_F32, C, M, N, K, NULL, num_threads);
+    for (int i = 0; i < M; i++) {
+        for (int p = mask->row_ptr[i]; p < mask->row_ptr[i + 1]; p++) ref[p] = C[(size_t)i * N + mask->col[p]];
+    }
+    double dense = telemetry_stop(&tel);
+    printf("Dense + gather: %.6f seconds, %.2f GFLOPS\n", dense, 2.0 * M * N * K / (dense * 1e9));
+    bench_record(&tel, "sddmm_dense", M, N, K, "f32", num_threads, dense, 2.0 * M * N * K);
+
+    telemetry_start(&tel, num_threads);
+    sddmm_csr(mask, A, B, K, out, num_threads);
+    double elapsed = telemetry_stop(&tel);
+
+    double worst = 0.0;
+    for (long p = 0; p < mask->nnz; p++) {
+        double err = out[p] - ref[p];
+        if (err < 0) err = -err;
+        if (!(err <= worst)) worst = err;
+    }
+    printf("SDDMM:          %.6f seconds, %.2f GFLOPS on sampled entries, %.2fx dense, max abs error %.2e\n", elapsed,
+           2.0 * mask->nnz * K / (elapsed * 1e9), dense / elapsed, worst);
+    // At the sampled entries' flops, the mask in the kernel name
+    char kernel[64];
+    snprintf(kernel, sizeof(kernel), "sddmm_csr %s %.3f", band ? "band" : "random", density);
+    bench_record(&tel, kernel, M, N, K, "f32", num_threads, elapsed, 2.0 * mask->nnz * K);
+
+    free(out);
+    free(ref);
+    csr_free(mask);
+    free_matrix(A, (size_t)M * K * sizeof(float));
+    free_matrix(B, (size_t)N * K * sizeof(float));
+    free_matrix(Bt, (size_t)K * N * sizeof(float));
+    free_matrix(C, (size_t)M * N * sizeof(float));
+    return 0;
+}
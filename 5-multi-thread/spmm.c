@@ -0,0 +1,400 @@
+/*
+Sparse x dense GEMM: C += A B with A pruned (mostly zeros) in CSR or BSR, B and C dense row-major
+
+- CSR: every nonzero a(i, k) is broadcast and FMAed against a row of B, 32 columns (4 ymm) of C row i
+  held in registers across the whole row of A
+- BSR: br x bc dense blocks (8 x 1 matches the micro-kernel's MR rows, 4 x 4 suits 2D pruning), one FMA per
+  block element against an 8 wide slice of B row, br rows of C held in registers
+- work is split by nonzero (block) count, not by rows, so uneven pruning still balances across threads
+- csr_from_dense / bsr_from_dense convert from the dense layout
+
+The flops are 2 * nnz * N instead of 2 * M * N * K, so time follows the nonzero count.
+
+Usage: gcc spmm.c -O3 -mavx2 -mfma -mf16c -lpthread
+       ./a.out [M N K [sparsity [threads [1x1|8x1|4x4]]]]
+sparsity is the fraction of zeros (0.9 by default), the last argument the pruning granularity of the generated A
+*/
+
+#define O5_NO_MAIN
+#include "o5.c"
+
+#define SPMM_NB 32 // C columns held in registers per CSR row pass
+
+typedef struct {
+    int M, K;
+    long nnz;
+    int *row_ptr; // M + 1
+    int *col;     // nnz
+    float *val;   // nnz
+} CsrMatrix;
+
+typedef struct {
+    int M, K;
+    int br, bc;   // block shape, br <= MR
+    int mb;       // block rows, ceil(M / br)
+    long nnzb;    // stored blocks
+    int *row_ptr; // mb + 1
+    int *col;     // block column of each block (K offset col * bc)
+    float *val;   // nnzb blocks of br x bc, row-major inside the block, zero padded past M / K
+} BsrMatrix;
+
+static void *spmm_alloc(size_t bytes) {
+    void *p = malloc(bytes ? bytes : 1);
+    if (!p) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(1);
+    }
+    return p;
+}
+
+CsrMatrix *csr_from_dense(const float *A, int M, int K, int lda) {
+    CsrMatrix *S = (CsrMatrix *)spmm_alloc(sizeof(CsrMatrix));
+    S->M = M;
+    S->K = K;
+    S->row_ptr = (int *)spmm_alloc((M + 1) * sizeof(int));
+    S->nnz = 0;
+    for (int i = 0; i < M; i++) {
+        for (int k = 0; k < K; k++) S->nnz += A[(size_t)i * lda + k] != 0.0f;
+    }
+    S->col = (int *)spmm_alloc(S->nnz * sizeof(int));
+    S->val = (float *)spmm_alloc(S->nnz * sizeof(float));
+
+    long p = 0;
+    for (int i = 0; i < M; i++) {
+        S->row_ptr[i] = (int)p;
+        for (int k = 0; k < K; k++) {
+            float v = A[(size_t)i * lda + k];
+            if (v == 0.0f) continue;
+            S->col[p] = k;
+            S->val[p++] = v;
+        }
+    }
+    S->row_ptr[M] = (int)p;
+    return S;
+}
+
+// A block is stored when any of its elements is nonzero
+BsrMatrix *bsr_from_dense(const float *A, int M, int K, int lda, int br, int bc) {
+    if (br < 1 || br > MR || bc < 1) {
+        fprintf(stderr, "bsr_from_dense: block %d x %d, rows must be 1..%d\n", br, bc, MR);
+        exit(1);
+    }
+    BsrMatrix *S = (BsrMatrix *)spmm_alloc(sizeof(BsrMatrix));
+    S->M = M;
+    S->K = K;
+    S->br = br;
+    S->bc = bc;
+    S->mb = (M + br - 1) / br;
+    int kb = (K + bc - 1) / bc;
+    S->row_ptr = (int *)spmm_alloc((S->mb + 1) * sizeof(int));
+
+    // Two passes: count, then fill
+    for (int pass = 0; pass < 2; pass++) {
+        long p = 0;
+        for (int ib = 0; ib < S->mb; ib++) {
+            if (pass) S->row_ptr[ib] = (int)p;
+            for (int jb = 0; jb < kb; jb++) {
+                int any = 0;
+                for (int r = 0; r < br && ib * br + r < M && !any; r++) {
+                    for (int c = 0; c < bc && jb * bc + c < K && !any; c++) any = A[(size_t)(ib * br + r) * lda + jb * bc + c] != 0.0f;
+                }
+                if (!any) continue;
+                if (pass) {
+                    S->col[p] = jb;
+                    float *v = &S->val[(size_t)p * br * bc];
+                    for (int r = 0; r < br; r++) {
+                        for (int c = 0; c < bc; c++) {
+                            int i = ib * br + r, k = jb * bc + c;
+                            v[r * bc + c] = i < M && k < K ? A[(size_t)i * lda + k] : 0.0f;
+                        }
+                    }
+                }
+                p++;
+            }
+        }
+        if (!pass) {
+            S->nnzb = p;
+            S->col = (int *)spmm_alloc(p * sizeof(int));
+            S->val = (float *)spmm_alloc((size_t)p * br * bc * sizeof(float));
+        } else {
+            S->row_ptr[S->mb] = (int)p;
+        }
+    }
+    return S;
+}
+
+void csr_free(CsrMatrix *S) {
+    free(S->row_ptr);
+    free(S->col);
+    free(S->val);
+    free(S);
+}
+
+void bsr_free(BsrMatrix *S) {
+    free(S->row_ptr);
+    free(S->col);
+    free(S->val);
+    free(S);
+}
+
+// Lanes below n set
+FORCE_INLINE __m256i tail_mask(int n) {
+    return _mm256_cmpgt_epi32(_mm256_set1_epi32(n), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+}
+
+// C row i += A row i B
+FORCE_INLINE void csr_row(const CsrMatrix *A, int i, const float *B, float *C, int N) {
+    int p0 = A->row_ptr[i], p1 = A->row_ptr[i + 1];
+    float *c = &C[(size_t)i * N];
+    int j = 0;
+
+    for (; j + SPMM_NB <= N; j += SPMM_NB) {
+        __m256 c0 = _mm256_loadu_ps(&c[j]);
+        __m256 c1 = _mm256_loadu_ps(&c[j + 8]);
+        __m256 c2 = _mm256_loadu_ps(&c[j + 16]);
+        __m256 c3 = _mm256_loadu_ps(&c[j + 24]);
+        for (int p = p0; p < p1; p++) {
+            __m256 v = _mm256_broadcast_ss(&A->val[p]);
+            const float *b = &B[(size_t)A->col[p] * N + j];
+            c0 = _mm256_fmadd_ps(v, _mm256_loadu_ps(&b[0]), c0);
+            c1 = _mm256_fmadd_ps(v, _mm256_loadu_ps(&b[8]), c1);
+            c2 = _mm256_fmadd_ps(v, _mm256_loadu_ps(&b[16]), c2);
+            c3 = _mm256_fmadd_ps(v, _mm256_loadu_ps(&b[24]), c3);
+        }
+        _mm256_storeu_ps(&c[j], c0);
+        _mm256_storeu_ps(&c[j + 8], c1);
+        _mm256_storeu_ps(&c[j + 16], c2);
+        _mm256_storeu_ps(&c[j + 24], c3);
+    }
+    for (; j < N; j += 8) {
+        __m256i mask = tail_mask(N - j);
+        __m256 c0 = _mm256_maskload_ps(&c[j], mask);
+        for (int p = p0; p < p1; p++) {
+            c0 = _mm256_fmadd_ps(_mm256_broadcast_ss(&A->val[p]), _mm256_maskload_ps(&B[(size_t)A->col[p] * N + j], mask), c0);
+        }
+        _mm256_maskstore_ps(&c[j], mask, c0);
+    }
+}
+
+// C rows i0 .. i0 + rows += A block row p0 .. p1 B, columns j .. j + 8 nv. Plain loads when full,
+// otherwise masked to the columns left in the row.
+FORCE_INLINE void bsr_tile(const int br, const int bc, const int nv, const int full, const BsrMatrix *A, int p0, int p1,
+                           int i0, int rows, const float *B, float *C, int N, int j) {
+    __m256i mask = full ? _mm256_set1_epi32(-1) : tail_mask(N - j);
+    __m256 acc[MR][2];
+    for (int r = 0; r < br; r++) {
+        for (int v = 0; v < nv; v++) {
+            const float *c = &C[(size_t)(i0 + r) * N + j + 8 * v];
+            acc[r][v] = r >= rows ? _mm256_setzero_ps() : full ? _mm256_loadu_ps(c) : _mm256_maskload_ps(c, mask);
+        }
+    }
+
+    for (int p = p0; p < p1; p++) {
+        int k0 = A->col[p] * bc;
+        int cols = A->K - k0 < bc ? A->K - k0 : bc; // last block column may hang over K
+        const float *val = &A->val[(size_t)p * br * bc];
+        for (int c = 0; c < bc; c++) {
+            if (c >= cols) break;
+            const float *b = &B[(size_t)(k0 + c) * N + j];
+            __m256 b0 = full ? _mm256_loadu_ps(b) : _mm256_maskload_ps(b, mask);
+            __m256 b1 = nv == 2 ? _mm256_loadu_ps(b + 8) : b0;
+            for (int r = 0; r < br; r++) {
+                __m256 a = _mm256_broadcast_ss(&val[r * bc + c]);
+                acc[r][0] = _mm256_fmadd_ps(a, b0, acc[r][0]);
+                if (nv == 2) acc[r][1] = _mm256_fmadd_ps(a, b1, acc[r][1]);
+            }
+        }
+    }
+
+    for (int r = 0; r < rows; r++) {
+        for (int v = 0; v < nv; v++) {
+            float *c = &C[(size_t)(i0 + r) * N + j + 8 * v];
+            if (full) _mm256_storeu_ps(c, acc[r][v]);
+            else _mm256_maskstore_ps(c, mask, acc[r][v]);
+        }
+    }
+}
+
+// C block row ib += A block row ib B. br and bc are constants in the specialized instantiations, so the
+// block loops unroll and acc stays in registers: 16 columns per pass up to 4 rows, 8 for taller blocks.
+FORCE_INLINE void bsr_block_row(const int br, const int bc, const BsrMatrix *A, int ib, const float *B, float *C, int N) {
+    int p0 = A->row_ptr[ib], p1 = A->row_ptr[ib + 1];
+    int i0 = ib * br;
+    int rows = A->M - i0 < br ? A->M - i0 : br;
+    int j = 0;
+
+    if (br <= 4) {
+        for (; j + 16 <= N; j += 16) bsr_tile(br, bc, 2, 1, A, p0, p1, i0, rows, B, C, N, j);
+    }
+    for (; j + 8 <= N; j += 8) bsr_tile(br, bc, 1, 1, A, p0, p1, i0, rows, B, C, N, j);
+    if (j < N) bsr_tile(br, bc, 1, 0, A, p0, p1, i0, rows, B, C, N, j);
+}
+
+void bsr_rows(const BsrMatrix *A, int start, int end, const float *B, float *C, int N) {
+    for (int ib = start; ib < end; ib++) {
+        if (A->br == 8 && A->bc == 1) bsr_block_row(8, 1, A, ib, B, C, N);
+        else if (A->br == 4 && A->bc == 4) bsr_block_row(4, 4, A, ib, B, C, N);
+        else bsr_block_row(A->br, A->bc, A, ib, B, C, N);
+    }
+}
+
+typedef struct {
+    const CsrMatrix *csr;
+    const BsrMatrix *bsr;
+    const float *B;
+    float *C;
+    int N;
+    int start, end; // rows (CSR) or block rows (BSR)
+} SpmmArgs;
+
+void *spmm_thread(void *arg) {
+    SpmmArgs *args = (SpmmArgs *)arg;
+    if (args->csr) {
+        for (int i = args->start; i < args->end; i++) csr_row(args->csr, i, args->B, args->C, args->N);
+    } else {
+        bsr_rows(args->bsr, args->start, args->end, args->B, args->C, args->N);
+    }
+    return NULL;
+}
+
+// Row boundaries giving every thread about the same number of nonzeros: thread t gets rows
+// [bounds[t], bounds[t + 1]), starting at the first row whose row_ptr reaches nnz * t / T
+void split_by_nnz(const int *row_ptr, int rows, int num_threads, int *bounds) {
+    long nnz = row_ptr[rows];
+    int r = 0;
+    for (int t = 0; t < num_threads; t++) {
+        long target = nnz * t / num_threads;
+        while (r < rows && row_ptr[r] < target) r++;
+        bounds[t] = r;
+    }
+    bounds[num_threads] = rows;
+}
+
+static void spmm_launch(const CsrMatrix *csr, const BsrMatrix *bsr, const float *B, float *C, int N, int num_threads) {
+    SpmmArgs args[MAX_THREADS];
+    int rows = csr ? csr->M : bsr->mb;
+    if (num_threads > MAX_THREADS) num_threads = MAX_THREADS;
+    if (num_threads > rows) num_threads = rows > 0 ? rows : 1;
+    for (int t = 0; t < num_threads; t++) {
+        args[t].csr = csr;
+        args[t].bsr = bsr;
+        args[t].B = B;
+        args[t].C = C;
+        args[t].N = N;
+    }
+    int bounds[MAX_THREADS + 1];
+    split_by_nnz(csr ? csr->row_ptr : bsr->row_ptr, rows, num_threads, bounds);
+    for (int t = 0; t < num_threads; t++) {
+        args[t].start = bounds[t];
+        args[t].end = bounds[t + 1];
+    }
+    launch_threads(spmm_thread, args, sizeof(SpmmArgs), num_threads);
+}
+
+// C[M x N] += A B[K x N], A in CSR
+void spmm_csr(const CsrMatrix *A, const float *B, float *C, int N, int num_threads) {
+    spmm_launch(A, NULL, B, C, N, num_threads);
+}
+
+// C[M x N] += A B[K x N], A in BSR
+void spmm_bsr(const BsrMatrix *A, const float *B, float *C, int N, int num_threads) {
+    spmm_launch(NULL, A, B, C, N, num_threads);
+}
+
+// Other programs reuse the sparse formats with #define SPMM_NO_MAIN / #include "spmm.c"
+#ifndef SPMM_NO_MAIN
+// Max relative error of C against the dense reference R
+static double max_rel_error(const float *C, const float *R, size_t n) {
+    double worst = 0.0;
+    for (size_t i = 0; i < n; i++) {
+        double mag = R[i] < 0 ? -R[i] : R[i];
+        double err = (C[i] - R[i]) / (mag > 1.0 ? mag : 1.0);
+        if (err < 0) err = -err;
+        if (!(err <= worst)) worst = err;
+    }
+    return worst;
+}
+
+int main(int argc, char *argv[]) {
+    int M = 4096, N = 4096, K = 4096;
+    float sparsity = 0.9f;
+    int num_threads = 24;
+    int pbr = 1, pbc = 1; // pruning granularity of the generated A
+    if (argc >= 4) {
+        M = atoi(argv[1]);
+        N = atoi(argv[2]);
+        K = atoi(argv[3]);
+    }
+    if (argc >= 5) sparsity = atof(argv[4]);
+    if (argc >= 6) num_threads = atoi(argv[5]);
+    if (argc >= 7 && sscanf(argv[6], "%dx%d", &pbr, &pbc) != 2) pbr = 0;
+    if (M <= 0 || N <= 0 || K <= 0 || sparsity < 0.0f || sparsity >= 1.0f || num_threads <= 0 || num_threads > MAX_THREADS ||
+        pbr <= 0 || pbc <= 0) {
+        fprintf(stderr, "Usage: %s [M N K [sparsity (0..1) [threads (1..%d) [1x1|8x1|4x4]]]]\n", argv[0], MAX_THREADS);
+        return 1;
+    }
+
+    float *A = (float *)alloc_matrix((size_t)M * K * sizeof(float));
+    float *B = (float *)alloc_matrix((size_t)K * N * sizeof(float));
+    float *C = (float *)alloc_matrix((size_t)M * N * sizeof(float));
+    float *R = (float *)alloc_matrix((size_t)M * N * sizeof(float));
+    uint64_t seed = time(NULL);
+    init_uniform(DTYPE_F32, A, M, K, 0.0f, 1.0f, seed, num_threads);
+    init_uniform(DTYPE_F32, B, K, N, 0.0f, 1.0f, seed + 1, num_threads);
+
+    // Prune whole pbr x pbc blocks
+    long kept = 0;
+    int kblocks = (K + pbc - 1) / pbc;
+    for (int i = 0; i < M; i++) {
+        for (int k = 0; k < K; k++) {
+            if (rng_uniform(seed + 2, (uint64_t)(i / pbr) * kblocks + k / pbc) < sparsity) A[(size_t)i * K + k] = 0.0f;
+            else kept++;
+        }
+    }
+    printf("Sparsity %.1f%% (%dx%d pruning), nnz %ld of %ld\n", 100.0 * (1.0 - (double)kept / ((double)M * K)), pbr, pbc,
+           kept, (long)M * K);
+
+    // Sparse runs are recorded at their useful flops, the sparsity and pruning in the kernel name
+    char kernel[64];
+    init_zero(R, M, (size_t)N * sizeof(float), num_threads);
+    Telemetry tel;
+    telemetry_start(&tel, num_threads);
+    matmul_ex(A, DTYPE_F32, B, DTYPE_F32, R, M, N, K, NULL, num_threads);
+    double dense = telemetry_stop(&tel);
+    printf("Dense:    %.6f seconds, %.2f GFLOPS\n", dense, 2.0 * M * N * K / (dense * 1e9));
+    bench_record(&tel, "spmm_dense", M, N, K, "f32", num_threads, dense, 2.0 * M * N * K);
+
+    CsrMatrix *csr = csr_from_dense(A, M, K, K);
+    init_zero(C, M, (size_t)N * sizeof(float), num_threads);
+    telemetry_start(&tel, num_threads);
+    spmm_csr(csr, B, C, N, num_threads);
+    double elapsed = telemetry_stop(&tel);
+    printf("CSR:      %.6f seconds, %.2f GFLOPS on nonzeros, %.2fx dense, max rel error %.2e\n", elapsed,
+           2.0 * csr->nnz * N / (elapsed * 1e9), dense / elapsed, max_rel_error(C, R, (size_t)M * N));
+    snprintf(kernel, sizeof(kernel), "spmm_csr sparsity %.2f %dx%d", sparsity, pbr, pbc);
+    bench_record(&tel, kernel, M, N, K, "f32", num_threads, elapsed, 2.0 * csr->nnz * N);
+    csr_free(csr);
+
+    int shapes[2][2] = {{8, 1}, {4, 4}};
+    for (int s = 0; s < 2; s++) {
+        BsrMatrix *bsr = bsr_from_dense(A, M, K, K, shapes[s][0], shapes[s][1]);
+        long stored = bsr->nnzb * bsr->br * bsr->bc;
+        init_zero(C, M, (size_t)N * sizeof(float), num_threads);
+        telemetry_start(&tel, num_threads);
+        spmm_bsr(bsr, B, C, N, num_threads);
+        elapsed = telemetry_stop(&tel);
+        printf("BSR %dx%d:  %.6f seconds, %.2f GFLOPS on stored blocks (%.0f%% nonzero), %.2fx dense, max rel error %.2e\n",
+               bsr->br, bsr->bc, elapsed, 2.0 * stored * N / (elapsed * 1e9), stored ? 100.0 * kept / stored : 0.0,
+               dense / elapsed, max_rel_error(C, R, (size_t)M * N));
+        snprintf(kernel, sizeof(kernel), "spmm_bsr%dx%d sparsity %.2f %dx%d", bsr->br, bsr->bc, sparsity, pbr, pbc);
+        bench_record(&tel, kernel, M, N, K, "f32", num_threads, elapsed, 2.0 * stored * N);
+        bsr_free(bsr);
+    }
+
+    free_matrix(A, (size_t)M * K * sizeof(float));
+    free_matrix(B, (size_t)K * N * sizeof(float));
+    free_matrix(C, (size_t)M * N * sizeof(float));
+    free_matrix(R, (size_t)M * N * sizeof(float));
+    return 0;
+}
+#endif
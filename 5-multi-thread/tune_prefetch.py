@@ -0,0 +1,57 @@
+"""
+Sweep o5.c's software prefetch distances
+
+- rebuilds o5.c with -DPF_A_DIST / -DPF_B_DIST / -DPF_C / -DPF_PACK_DIST for every combination
+- times only the plain matmul_ex run (o5's "plain" mode), the best of --runs runs per build (the machine is
+  rarely quiet), and keeps the sweep out of the result history (O5_RESULTS=none)
+- prints the builds sorted by GFLOPS, the top line is what to put in o5.c's defaults
+"""
+import argparse
+import itertools
+import os
+import re
+import subprocess
+import tempfile
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+
+def build(flags, out):
+    cmd = ["gcc", os.path.join(HERE, "o5.c"), "-O3", "-mavx2", "-mfma", "-mf16c", "-lpthread", "-o", out] + flags
+    subprocess.run(cmd, check=True)
+
+def best_gflops(binary, shape, threads, runs):
+    best = 0.0
+    env = dict(os.environ, O5_RESULTS="none")
+    for _ in range(runs):
+        out = subprocess.run([binary, *map(str, shape), str(threads), "f32", "plain"], env=env, capture_output=True,
+                             text=True, check=True).stdout
+        best = max(best, float(re.search(r"Performance: ([\d.]+) GFLOPS", out).group(1)))
+    return best
+
+def main():
+    parser = argparse.ArgumentParser(description="Sweep o5.c prefetch distances")
+    parser.add_argument("--shape", type=int, nargs=3, default=[2048, 2048, 2048], metavar=("M", "N", "K"))
+    parser.add_argument("--threads", type=int, default=os.cpu_count())
+    parser.add_argument("--runs", type=int, default=3)
+    parser.add_argument("--a", type=int, nargs="+", default=[0, 8, 16, 32])
+    parser.add_argument("--b", type=int, nargs="+", default=[0, 8, 16, 32])
+    parser.add_argument("--c", type=int, nargs="+", default=[0, 1])
+    parser.add_argument("--pack", type=int, nargs="+", default=[0, 4, 8, 16])
+    args = parser.parse_args()
+
+    results = []
+    with tempfile.TemporaryDirectory() as tmp:
+        binary = os.path.join(tmp, "o5")
+        for a, b, c, pack in itertools.product(args.a, args.b, args.c, args.pack):
+            flags = [f"-DPF_A_DIST={a}", f"-DPF_B_DIST={b}", f"-DPF_C={c}", f"-DPF_PACK_DIST={pack}"]
+            build(flags, binary)
+            gflops = best_gflops(binary, args.shape, args.threads, args.runs)
+            print(f"{' '.join(flags)}: {gflops:.2f} GFLOPS", flush=True)
+            results.append((gflops, flags))
+
+    print("\nBest first:")
+    for gflops, flags in sorted(results, reverse=True):
+        print(f"{gflops:8.2f} GFLOPS  {' '.join(flags)}")
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,375 @@
+/*
+Distributed GEMM: SUMMA on a pr x pc process grid
+
+- rank (r, c) owns the C block rows [M r / pr, M (r + 1) / pr), cols [N c / pc, N (c + 1) / pc),
+  the matching A rows split by K over the grid columns, and the matching B cols split by K over the grid rows
+- every step broadcasts one K panel (at most SUMMA_KB wide): the owner of the A panel along its grid row,
+  the owner of the B panel down its grid column, then every rank runs C_block += A_panel B_panel with o5
+- a communication thread fetches step s + 1 into the other half of a double buffer while step s computes
+- all traffic goes through transport.h (send / recv), so shm, tcp or a cluster interconnect are interchangeable
+
+Every rank generates its own blocks from o5's counter-based RNG, so no input is ever scattered, and
+checks SUMMA_CHECKS of its C entries against a dot product recomputed from the same RNG.
+
+Usage: gcc summa.c -O3 -mavx2 -mfma -mf16c -lpthread
+       ./a.out [M N K [pr pc [shm|tcp [threads per rank]]]]       forks pr x pc ranks on this box
+       SUMMA_RANK=r SUMMA_HOSTS=h0,h1,.. ./a.out M N K pr pc tcp [threads]   one rank per process / node
+SUMMA_PORT sets the tcp base port (rank r listens on SUMMA_PORT + r), SUMMA_SEED the matrix seed for SUMMA_RANK runs
+*/
+
+#define O5_NO_MAIN
+#include "../5-multi-thread/o5.c"
+#include "transport.h"
+#include <sys/wait.h>
+
+#define SUMMA_KB 256     // widest K panel per step
+#define SUMMA_PORT 29500
+#define SUMMA_CHECKS 16
+#define MAX_RANKS 64
+
+// Part i of n split p ways, the same split on every rank
+FORCE_INLINE int split(int n, int p, int i) {
+    return (int)((long)n * i / p);
+}
+
+typedef struct {
+    Transport *t;
+    int pr, pc, myr, myc;
+    int M, N, K;
+    int m0, m1, n0, n1;   // C block
+    int ka0, ka1;         // K columns of the local A block
+    int kb0, kb1;         // K rows of the local B block
+    float *A, *B, *C;     // (m1 - m0) x (ka1 - ka0), (kb1 - kb0) x (n1 - n0), (m1 - m0) x (n1 - n0)
+    int steps;
+    int *step_k;          // panel s is K range [step_k[s], step_k[s + 1])
+    float *Apan[2], *Bpan[2];
+    int threads;
+
+    // Comm thread -> compute handoff
+    int filled;           // panels received
+    int computed;         // panels multiplied
+    double wait_time;     // compute time spent waiting on a panel
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} Summa;
+
+FORCE_INLINE int grid_rank(const Summa *s, int r, int c) {
+    return r * s->pc + c;
+}
+
+static void xsend(Transport *t, int peer, const void *buf, size_t bytes) {
+    if (t->send(t, peer, buf, bytes) != 0) {
+        fprintf(stderr, "Rank %d: send to %d failed\n", t->rank, peer);
+        exit(1);
+    }
+}
+
+static void xrecv(Transport *t, int peer, void *buf, size_t bytes) {
+    if (t->recv(t, peer, buf, bytes) != 0) {
+        fprintf(stderr, "Rank %d: recv from %d failed\n", t->rank, peer);
+        exit(1);
+    }
+}
+
+// Root sends to every other member, in member order. Fine for the small grids this targets,
+// a tree (or the interconnect's own broadcast) would replace it at scale.
+static void bcast(Transport *t, const int *members, int count, int root, void *buf, size_t bytes) {
+    if (t->rank != root) {
+        xrecv(t, root, buf, bytes);
+        return;
+    }
+    for (int i = 0; i < count; i++) {
+        if (members[i] != root) xsend(t, members[i], buf, bytes);
+    }
+}
+
+static void barrier(Transport *t) {
+    char token = 0;
+    for (int i = 1; i < t->size; i++) {
+        if (t->rank == 0) xrecv(t, i, &token, 1);
+        else if (t->rank == i) xsend(t, 0, &token, 1);
+    }
+    for (int i = 1; i < t->size; i++) {
+        if (t->rank == 0) xsend(t, i, &token, 1);
+        else if (t->rank == i) xrecv(t, 0, &token, 1);
+    }
+}
+
+// Grid column owning K column k of A (K split over pc) / grid row owning K row k of B (K split over pr)
+FORCE_INLINE int owner(int K, int p, int k) {
+    int o = 0;
+    while (o + 1 < p && split(K, p, o + 1) <= k) o++;
+    return o;
+}
+
+void *summa_comm_thread(void *arg) {
+    Summa *s = (Summa *)arg;
+    int mb = s->m1 - s->m0, nb = s->n1 - s->n0;
+    int row[MAX_RANKS], col[MAX_RANKS];
+    for (int c = 0; c < s->pc; c++) row[c] = grid_rank(s, s->myr, c);
+    for (int r = 0; r < s->pr; r++) col[r] = grid_rank(s, r, s->myc);
+
+    for (int step = 0; step < s->steps; step++) {
+        // Both halves in use until step - 2 has been multiplied
+        pthread_mutex_lock(&s->lock);
+        while (s->computed < step - 1) pthread_cond_wait(&s->cond, &s->lock);
+        pthread_mutex_unlock(&s->lock);
+
+        int k0 = s->step_k[step], kw = s->step_k[step + 1] - k0;
+        float *ap = s->Apan[step % 2], *bp = s->Bpan[step % 2];
+
+        int oc = owner(s->K, s->pc, k0);
+        if (oc == s->myc) {
+            int lda = s->ka1 - s->ka0;
+            for (int i = 0; i < mb; i++) memcpy(&ap[(size_t)i * kw], &s->A[(size_t)i * lda + k0 - s->ka0], kw * sizeof(float));
+        }
+        bcast(s->t, row, s->pc, grid_rank(s, s->myr, oc), ap, (size_t)mb * kw * sizeof(float));
+
+        int orow = owner(s->K, s->pr, k0);
+        if (orow == s->myr) memcpy(bp, &s->B[(size_t)(k0 - s->kb0) * nb], (size_t)kw * nb * sizeof(float));
+        bcast(s->t, col, s->pr, grid_rank(s, orow, s->myc), bp, (size_t)kw * nb * sizeof(float));
+
+        pthread_mutex_lock(&s->lock);
+        s->filled = step + 1;
+        pthread_cond_broadcast(&s->cond);
+        pthread_mutex_unlock(&s->lock);
+    }
+    return NULL;
+}
+
+typedef struct {
+    float *X;
+    int cols;
+    long row0, col0, ld; // position of the block in the global matrix
+    uint64_t seed;
+} BlockFill;
+
+// Same values init_uniform(DTYPE_F32, X, ..., 0, 1, seed) gives the full matrix
+static void fill_block_rows(void *ctx, int start_row, int end_row) {
+    BlockFill *f = (BlockFill *)ctx;
+    for (long i = start_row; i < end_row; i++) {
+        for (long j = 0; j < f->cols; j++) {
+            f->X[i * f->cols + j] = rng_uniform(f->seed, (uint64_t)(f->row0 + i) * f->ld + f->col0 + j);
+        }
+    }
+}
+
+static float *alloc_block(int rows, int cols, long row0, long col0, long ld, uint64_t seed, int threads) {
+    float *X = (float *)alloc_matrix((size_t)rows * cols * sizeof(float));
+    BlockFill f = {X, cols, row0, col0, ld, seed};
+    parallel_rows(rows, threads, fill_block_rows, &f);
+    return X;
+}
+
+// One rank of the grid, returns the process exit status
+int summa_rank(Transport *t, int M, int N, int K, int pr, int pc, int threads, uint64_t seed) {
+    Summa s;
+    memset(&s, 0, sizeof(s));
+    s.t = t;
+    s.pr = pr;
+    s.pc = pc;
+    s.myr = t->rank / pc;
+    s.myc = t->rank % pc;
+    s.M = M;
+    s.N = N;
+    s.K = K;
+    s.m0 = split(M, pr, s.myr);
+    s.m1 = split(M, pr, s.myr + 1);
+    s.n0 = split(N, pc, s.myc);
+    s.n1 = split(N, pc, s.myc + 1);
+    s.ka0 = split(K, pc, s.myc);
+    s.ka1 = split(K, pc, s.myc + 1);
+    s.kb0 = split(K, pr, s.myr);
+    s.kb1 = split(K, pr, s.myr + 1);
+    s.threads = threads;
+    int mb = s.m1 - s.m0, nb = s.n1 - s.n0;
+
+    // Steps end at every ownership boundary of either split, so each panel has one A owner and one B owner
+    s.step_k = (int *)malloc(((size_t)K / SUMMA_KB + pr + pc + 2) * sizeof(int));
+    s.step_k[0] = 0;
+    for (int k = 0; k < K;) {
+        int next = k + SUMMA_KB < K ? k + SUMMA_KB : K;
+        for (int c = 1; c < pc; c++) {
+            if (split(K, pc, c) > k && split(K, pc, c) < next) next = split(K, pc, c);
+        }
+        for (int r = 1; r < pr; r++) {
+            if (split(K, pr, r) > k && split(K, pr, r) < next) next = split(K, pr, r);
+        }
+        s.step_k[++s.steps] = k = next;
+    }
+
+    s.A = alloc_block(mb, s.ka1 - s.ka0, s.m0, s.ka0, K, seed, threads);
+    s.B = alloc_block(s.kb1 - s.kb0, nb, s.kb0, s.n0, N, seed + 1, threads);
+    s.C = (float *)alloc_matrix((size_t)mb * nb * sizeof(float));
+    init_zero(s.C, mb, (size_t)nb * sizeof(float), threads);
+    for (int h = 0; h < 2; h++) {
+        s.Apan[h] = (float *)alloc_pages((size_t)mb * SUMMA_KB * sizeof(float));
+        s.Bpan[h] = (float *)alloc_pages((size_t)SUMMA_KB * nb * sizeof(float));
+    }
+    pthread_mutex_init(&s.lock, NULL);
+    pthread_cond_init(&s.cond, NULL);
+
+    barrier(t);
+    Telemetry tel;
+    telemetry_start(&tel, threads);
+
+    pthread_t comm;
+    if (pthread_create(&comm, NULL, summa_comm_thread, &s) != 0) {
+        fprintf(stderr, "Failed to create comm thread\n");
+        exit(1);
+    }
+    for (int step = 0; step < s.steps; step++) {
+        double wait_start = get_time();
+        pthread_mutex_lock(&s.lock);
+        while (s.filled <= step) pthread_cond_wait(&s.cond, &s.lock);
+        pthread_mutex_unlock(&s.lock);
+        s.wait_time += get_time() - wait_start;
+
+        int kw = s.step_k[step + 1] - s.step_k[step];
+        matmul_ex(s.Apan[step % 2], DTYPE_F32, s.Bpan[step % 2], DTYPE_F32, s.C, mb, nb, kw, NULL, threads);
+
+        pthread_mutex_lock(&s.lock);
+        s.computed = step + 1;
+        pthread_cond_broadcast(&s.cond);
+        pthread_mutex_unlock(&s.lock);
+    }
+    pthread_join(comm, NULL);
+    double elapsed_time = telemetry_stop(&tel);
+
+    // Spot check against the RNG directly
+    double max_rel = 0.0;
+    for (int c = 0; c < SUMMA_CHECKS; c++) {
+        int i = (int)(rng_u64(seed + 2, 2 * c) % mb), j = (int)(rng_u64(seed + 2, 2 * c + 1) % nb);
+        double ref = 0.0;
+        for (long k = 0; k < K; k++) {
+            ref += (double)rng_uniform(seed, (uint64_t)(s.m0 + i) * K + k) * rng_uniform(seed + 1, (uint64_t)k * N + s.n0 + j);
+        }
+        double rel = (s.C[(size_t)i * nb + j] - ref) / ref;
+        if (rel < 0) rel = -rel;
+        if (!(rel <= max_rel)) max_rel = rel; // NaN sticks
+    }
+
+    // Rank 0 reports the slowest rank
+    double stats[3] = {elapsed_time, s.wait_time, max_rel};
+    if (t->rank != 0) {
+        xsend(t, 0, stats, sizeof(stats));
+    } else {
+        for (int r = 1; r < t->size; r++) {
+            double other[3];
+            xrecv(t, r, other, sizeof(other));
+            for (int i = 0; i < 3; i++) {
+                if (!(other[i] <= stats[i])) stats[i] = other[i];
+            }
+        }
+        double bytes = 4.0 * ((double)M * K * (pc - 1) + (double)K * N * (pr - 1)); // every panel to every other grid member
+        printf("Grid: %d x %d ranks, %d thread(s) each, %d steps of up to %d\n", pr, pc, threads, s.steps, SUMMA_KB);
+        printf("Time: %.6f seconds\n", stats[0]);
+        printf("Performance: %.2f GFLOPS\n", 2.0 * M * N * K / (stats[0] * 1e9));
+        printf("Broadcast: %.1f MB, compute waited %.6f seconds for panels (slowest rank)\n", bytes / 1e6, stats[1]);
+        printf("Max relative error (%d samples per rank): %.3e\n", SUMMA_CHECKS, stats[2]);
+        // The slowest rank's time, rank 0's telemetry
+        char kernel[64];
+        snprintf(kernel, sizeof(kernel), "summa %dx%d %s", pr, pc, t->send == tcp_send ? "tcp" : "shm");
+        bench_record(&tel, kernel, M, N, K, "f32", threads, stats[0], 2.0 * M * N * K);
+    }
+    barrier(t);
+
+    free_matrix(s.A, (size_t)mb * (s.ka1 - s.ka0) * sizeof(float));
+    free_matrix(s.B, (size_t)(s.kb1 - s.kb0) * nb * sizeof(float));
+    free_matrix(s.C, (size_t)mb * nb * sizeof(float));
+    for (int h = 0; h < 2; h++) {
+        free_pages(s.Apan[h], (size_t)mb * SUMMA_KB * sizeof(float));
+        free_pages(s.Bpan[h], (size_t)SUMMA_KB * nb * sizeof(float));
+    }
+    free(s.step_k);
+    return stats[2] < 1e-3 ? 0 : 1;
+}
+
+int main(int argc, char *argv[]) {
+    int M = 2048, N = 2048, K = 2048, pr = 2, pc = 2;
+    int tcp = 0;
+    if (argc >= 4) {
+        M = atoi(argv[1]);
+        N = atoi(argv[2]);
+        K = atoi(argv[3]);
+    }
+    if (argc >= 6) {
+        pr = atoi(argv[4]);
+        pc = atoi(argv[5]);
+    }
+    if (argc >= 7) {
+        if (strcmp(argv[6], "tcp") == 0) tcp = 1;
+        else if (strcmp(argv[6], "shm") != 0) tcp = -1;
+    }
+    int size = pr * pc;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int threads = argc >= 8 ? atoi(argv[7]) : (size > 0 && cpus / size > 1 ? (int)(cpus / size) : 1);
+    const char *rank_env = getenv("SUMMA_RANK");
+    if (pr <= 0 || pc <= 0 || size > MAX_RANKS || M < pr || N < pc || K < pr || K < pc || tcp < 0 ||
+        threads <= 0 || threads > MAX_THREADS || (rank_env && !tcp)) {
+        fprintf(stderr, "Usage: %s [M N K [pr pc [shm|tcp [threads per rank (1..%d)]]]]   (pr x pc <= %d)\n", argv[0],
+                MAX_THREADS, MAX_RANKS);
+        fprintf(stderr, "       SUMMA_RANK=r SUMMA_HOSTS=h0,h1,.. %s M N K pr pc tcp [threads]\n", argv[0]);
+        return 1;
+    }
+    const char *port_env = getenv("SUMMA_PORT");
+    int port = port_env ? atoi(port_env) : SUMMA_PORT;
+
+    // One rank of a multi-process / multi-node run
+    if (rank_env) {
+        int rank = atoi(rank_env);
+        const char *hosts[MAX_RANKS];
+        char *list = strdup(getenv("SUMMA_HOSTS") ? getenv("SUMMA_HOSTS") : "");
+        int n = 0;
+        for (char *h = strtok(list, ","); h && n < MAX_RANKS; h = strtok(NULL, ",")) hosts[n++] = h;
+        if (n == 0) {
+            hosts[n++] = "127.0.0.1";
+        }
+        for (; n < size; n++) hosts[n] = hosts[n - 1]; // a short list repeats its last host
+        if (rank < 0 || rank >= size) {
+            fprintf(stderr, "SUMMA_RANK must be in 0..%d\n", size - 1);
+            return 1;
+        }
+        Transport *t = tcp_transport(rank, size, hosts, port);
+        if (!t) return 1;
+        const char *seed_env = getenv("SUMMA_SEED");
+        int status = summa_rank(t, M, N, K, pr, pc, threads, seed_env ? strtoull(seed_env, NULL, 10) : 0);
+        t->close(t);
+        free(list);
+        return status;
+    }
+
+    // Every rank on this box, forked
+    void *channels = tcp ? NULL : shm_channels_create(size);
+    if (!tcp && !channels) return 1;
+    const char *hosts[MAX_RANKS];
+    for (int r = 0; r < size; r++) hosts[r] = "127.0.0.1";
+    uint64_t seed = time(NULL);
+    fflush(stdout);
+
+    pid_t pids[MAX_RANKS];
+    for (int r = 0; r < size; r++) {
+        pids[r] = fork();
+        if (pids[r] < 0) {
+            perror("fork");
+            return 1;
+        }
+        if (pids[r] == 0) {
+            // Each rank on its own slice of the CPUs, or every rank's workers would pin onto the same first ones
+            placement_slice(r, size);
+            Transport *t = tcp ? tcp_transport(r, size, hosts, port) : shm_transport(channels, r, size);
+            if (!t) exit(1);
+            int status = summa_rank(t, M, N, K, pr, pc, threads, seed);
+            t->close(t);
+            exit(status);
+        }
+    }
+
+    int failed = 0;
+    for (int r = 0; r < size; r++) {
+        int status;
+        if (waitpid(pids[r], &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) failed = 1;
+    }
+    if (failed) fprintf(stderr, "A rank failed\n");
+    return failed;
+}
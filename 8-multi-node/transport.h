@@ -0,0 +1,261 @@
+/*
+Point-to-point transport for the distributed GEMM
+
+Blocking, in-order byte streams between every pair of ranks. Anything else (broadcasts, barriers,
+reductions) is built on send / recv in summa.c, so a new interconnect only has to provide these.
+
+- shm: one ring buffer per (src, dst) pair in a shared anonymous mapping, for ranks forked from one process
+- tcp: a full mesh of sockets, rank r listens on base_port + r. Loopback for testing on one box,
+  a host list for several nodes
+*/
+
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+
+typedef struct Transport {
+    int rank, size;
+    // Whole buffer or -1. Calls to one peer are ordered, different peers are independent.
+    int (*send)(struct Transport *t, int peer, const void *buf, size_t bytes);
+    int (*recv)(struct Transport *t, int peer, void *buf, size_t bytes);
+    void (*close)(struct Transport *t);
+    void *impl;
+} Transport;
+
+// ---- shm ----
+
+#define SHM_CHANNEL (1 << 20) // ring bytes per (src, dst) pair
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    size_t head, tail; // bytes written / read so far
+    char data[SHM_CHANNEL];
+} ShmChannel;
+
+typedef struct {
+    ShmChannel *channels; // size x size, channel (src, dst) at src * size + dst
+    size_t bytes;
+} ShmTransport;
+
+static inline int shm_send(Transport *t, int peer, const void *buf, size_t bytes) {
+    ShmChannel *ch = &((ShmTransport *)t->impl)->channels[t->rank * t->size + peer];
+    const char *src = (const char *)buf;
+    pthread_mutex_lock(&ch->lock);
+    while (bytes) {
+        while (ch->head - ch->tail == SHM_CHANNEL) pthread_cond_wait(&ch->cond, &ch->lock);
+        size_t at = ch->head % SHM_CHANNEL;
+        size_t n = SHM_CHANNEL - (ch->head - ch->tail);
+        if (n > SHM_CHANNEL - at) n = SHM_CHANNEL - at;
+        if (n > bytes) n = bytes;
+        memcpy(&ch->data[at], src, n);
+        ch->head += n;
+        src += n;
+        bytes -= n;
+        pthread_cond_broadcast(&ch->cond);
+    }
+    pthread_mutex_unlock(&ch->lock);
+    return 0;
+}
+
+static inline int shm_recv(Transport *t, int peer, void *buf, size_t bytes) {
+    ShmChannel *ch = &((ShmTransport *)t->impl)->channels[peer * t->size + t->rank];
+    char *dst = (char *)buf;
+    pthread_mutex_lock(&ch->lock);
+    while (bytes) {
+        while (ch->head == ch->tail) pthread_cond_wait(&ch->cond, &ch->lock);
+        size_t at = ch->tail % SHM_CHANNEL;
+        size_t n = ch->head - ch->tail;
+        if (n > SHM_CHANNEL - at) n = SHM_CHANNEL - at;
+        if (n > bytes) n = bytes;
+        memcpy(dst, &ch->data[at], n);
+        ch->tail += n;
+        dst += n;
+        bytes -= n;
+        pthread_cond_broadcast(&ch->cond);
+    }
+    pthread_mutex_unlock(&ch->lock);
+    return 0;
+}
+
+static inline void shm_close(Transport *t) {
+    ShmTransport *s = (ShmTransport *)t->impl;
+    munmap(s->channels, s->bytes);
+    free(s);
+    free(t);
+}
+
+// Shared channels for size ranks, created before fork() so every child inherits the mapping. NULL on error.
+static inline void *shm_channels_create(int size) {
+    size_t bytes = (size_t)size * size * sizeof(ShmChannel);
+    ShmChannel *channels = (ShmChannel *)mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (channels == MAP_FAILED) {
+        perror("shm channels");
+        return NULL;
+    }
+    pthread_mutexattr_t ma;
+    pthread_condattr_t ca;
+    pthread_mutexattr_init(&ma);
+    pthread_mutexattr_setpshared(&ma, PTHREAD_PROCESS_SHARED);
+    pthread_condattr_init(&ca);
+    pthread_condattr_setpshared(&ca, PTHREAD_PROCESS_SHARED);
+    for (int i = 0; i < size * size; i++) {
+        pthread_mutex_init(&channels[i].lock, &ma);
+        pthread_cond_init(&channels[i].cond, &ca);
+    }
+    return channels;
+}
+
+// Rank's view of channels from shm_channels_create (called in the child)
+static inline Transport *shm_transport(void *channels, int rank, int size) {
+    Transport *t = (Transport *)calloc(1, sizeof(Transport));
+    ShmTransport *s = (ShmTransport *)calloc(1, sizeof(ShmTransport));
+    if (!t || !s) {
+        fprintf(stderr, "Failed to allocate transport\n");
+        exit(1);
+    }
+    s->channels = (ShmChannel *)channels;
+    s->bytes = (size_t)size * size * sizeof(ShmChannel);
+    t->rank = rank;
+    t->size = size;
+    t->send = shm_send;
+    t->recv = shm_recv;
+    t->close = shm_close;
+    t->impl = s;
+    return t;
+}
+
+// ---- tcp ----
+
+typedef struct {
+    int *fds; // socket to each peer, -1 for self
+} TcpTransport;
+
+static inline int tcp_send(Transport *t, int peer, const void *buf, size_t bytes) {
+    int fd = ((TcpTransport *)t->impl)->fds[peer];
+    const char *src = (const char *)buf;
+    while (bytes) {
+        ssize_t n = write(fd, src, bytes);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        src += n;
+        bytes -= n;
+    }
+    return 0;
+}
+
+static inline int tcp_recv(Transport *t, int peer, void *buf, size_t bytes) {
+    int fd = ((TcpTransport *)t->impl)->fds[peer];
+    char *dst = (char *)buf;
+    while (bytes) {
+        ssize_t n = read(fd, dst, bytes);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        dst += n;
+        bytes -= n;
+    }
+    return 0;
+}
+
+static inline void tcp_close(Transport *t) {
+    TcpTransport *s = (TcpTransport *)t->impl;
+    for (int i = 0; i < t->size; i++) {
+        if (s->fds[i] >= 0) close(s->fds[i]);
+    }
+    free(s->fds);
+    free(s);
+    free(t);
+}
+
+// Full mesh: accept from higher ranks, connect to lower ones (retrying until they listen).
+// hosts[r] is rank r's address. NULL on error.
+static inline Transport *tcp_transport(int rank, int size, const char *const *hosts, int base_port) {
+    int *fds = (int *)malloc(size * sizeof(int));
+    if (!fds) {
+        fprintf(stderr, "Failed to allocate transport\n");
+        exit(1);
+    }
+    for (int i = 0; i < size; i++) fds[i] = -1;
+
+    int one = 1;
+    int lfd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(base_port + rank);
+    setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (lfd < 0 || bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(lfd, size) != 0) {
+        perror("tcp listen");
+        return NULL;
+    }
+
+    for (int peer = 0; peer < rank; peer++) {
+        char port[16];
+        snprintf(port, sizeof(port), "%d", base_port + peer);
+        struct addrinfo hints = {0}, *res;
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+        if (getaddrinfo(hosts[peer], port, &hints, &res) != 0) {
+            fprintf(stderr, "Cannot resolve %s\n", hosts[peer]);
+            return NULL;
+        }
+        int fd = -1;
+        for (int tries = 0; tries < 1000 && fd < 0; tries++) {
+            fd = socket(AF_INET, SOCK_STREAM, 0);
+            if (connect(fd, res->ai_addr, res->ai_addrlen) != 0) {
+                close(fd);
+                fd = -1;
+                usleep(10000);
+            }
+        }
+        freeaddrinfo(res);
+        if (fd < 0) {
+            fprintf(stderr, "Rank %d: cannot connect to rank %d at %s:%s\n", rank, peer, hosts[peer], port);
+            return NULL;
+        }
+        fds[peer] = fd;
+        if (write(fd, &rank, sizeof(rank)) != sizeof(rank)) return NULL; // who is calling
+    }
+    for (int i = rank + 1; i < size; i++) {
+        int fd = accept(lfd, NULL, NULL);
+        int peer;
+        if (fd < 0 || read(fd, &peer, sizeof(peer)) != sizeof(peer) || peer <= rank || peer >= size) {
+            fprintf(stderr, "Rank %d: bad connection\n", rank);
+            return NULL;
+        }
+        fds[peer] = fd;
+    }
+    close(lfd);
+    for (int i = 0; i < size; i++) {
+        if (fds[i] >= 0) setsockopt(fds[i], IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+
+    Transport *t = (Transport *)calloc(1, sizeof(Transport));
+    TcpTransport *s = (TcpTransport *)calloc(1, sizeof(TcpTransport));
+    if (!t || !s) {
+        fprintf(stderr, "Failed to allocate transport\n");
+        exit(1);
+    }
+    s->fds = fds;
+    t->rank = rank;
+    t->size = size;
+    t->send = tcp_send;
+    t->recv = tcp_recv;
+    t->close = tcp_close;
+    t->impl = s;
+    return t;
+}
+
+#endif